@@ -1,7 +1,5 @@
 #include "FeaturesComputer.hpp"
 
-#include <itkImageRegionIteratorWithIndex.h>
-
 #include <boost/program_options.hpp>
 
 #include <iostream>
@@ -9,7 +7,7 @@
 
 namespace po = boost::program_options;
 
-typedef itk::ImageRegionIteratorWithIndex< OutputImageType >  OutputImageIterator;
+typedef OutputImageType::PixelType::ValueType FeatureType;
 
 class CoordinatesComputer : public FeaturesComputer
 {
@@ -36,74 +34,104 @@ public:
 		os << this->options;
 	}
 
+	virtual std::vector< std::string > normalize_options(std::vector< std::string > params)
+	{
+		return FeaturesComputer::normalized_options(this->options, params);
+	}
+
 	virtual OutputImageType::Pointer compute( InputImageType::Pointer input_image, std::vector< std::string > params )
 	{
-		po::variables_map vm;
+		return this->compute_planes(input_image, 0, input_image->GetLargestPossibleRegion().GetSize()[2], params);
+	}
 
-		po::store(po::command_line_parser(params).options(this->options).run(), vm);
-		vm.notify();
+	virtual OutputImageType::Pointer compute_planes( InputImageType::Pointer input_image, const unsigned int first_plane, const unsigned int number_of_planes, std::vector< std::string > params )
+	{
+		this->parse(params);
 
-		if((this->dimension != 2) && (this->dimension != 3))
-		{
-			boost::program_options::validation_error err =
-				po::validation_error(
-					po::validation_error::invalid_option_value, 
-					boost::lexical_cast< std::string >(this->dimension), 
-					"dimension");
-			throw err;
-		}
+		const InputImageType::RegionType region = input_image->GetLargestPossibleRegion();
 
-		this->normalization = vm.count("normalize") > 0;
+		// The planes, with their geometry in the input image
+		InputImageType::IndexType start = region.GetIndex();
+		start[2] += first_plane;
+		InputImageType::PointType origin;
+		input_image->TransformIndexToPhysicalPoint(start, origin);
+
+		OutputImageType::SizeType size = region.GetSize();
+		size[2] = number_of_planes;
 
 		OutputImageType::Pointer output_image = OutputImageType::New();
-		output_image->SetRegions( input_image->GetLargestPossibleRegion() );
+		output_image->CopyInformation(input_image);
+		output_image->SetOrigin(origin);
+		output_image->SetRegions(size);
 		output_image->SetVectorLength(this->dimension);
 		output_image->Allocate();
 
-		const typename OutputImageType::RegionType image_region = output_image->GetLargestPossibleRegion();
-		typename OutputImageType::RegionType::SizeType image_size = image_region.GetSize();
+		const long nx = size[0], ny = size[1], z_offset = first_plane;
+		const unsigned int dimension = this->dimension;
+
+		// Relative to the whole image
+		FeatureType divisor[3] = {1, 1, 1};
+		if(this->normalization)
+			for(unsigned int i = 0; i < dimension; ++i)
+				divisor[i] = region.GetSize()[i];
+
+		FeatureType *output = output_image->GetBufferPointer();
+
+		TileScheduler::parallel_for(size, TileScheduler::row_tiles(size, this->tile_voxels), [&](const Tile &tile) {
+			for(long z = tile.begin[2]; z < tile.end[2]; ++z)
+				for(long y = tile.begin[1]; y < tile.end[1]; ++y)
+				{
+					FeatureType *out = output + (z * ny + y) * nx * dimension;
+					for(long x = 0; x < nx; ++x, out += dimension)
+					{
+						out[0] = static_cast< FeatureType >(x) / divisor[0];
+						out[1] = static_cast< FeatureType >(y) / divisor[1];
+						if(dimension == 3)
+							out[2] = static_cast< FeatureType >(z + z_offset) / divisor[2];
+					}
+				}
+		});
 
-		/*
-		for(itk::SizeValueType i = 0; i < OutputImageType::RegionType::SizeType::Dimension; ++i)
-		{
-			if(image_size[i] > 1)
-				image_size[i] -= 1;
-		}
-		*/
+		return output_image;
+	}
 
-		OutputImageIterator ito(output_image, image_region);
+	FeaturesEstimate estimate(const std::vector< std::string > &params, const InputImageType::SizeType &size)
+	{
+		this->parse(params);
 
-		OutputImageType::PixelType out_pix;
-		OutputImageType::IndexType coords;
-		out_pix.SetSize(this->dimension);
-		ito.GoToBegin();
-		while( !ito.IsAtEnd() )
-		{
-			coords = ito.GetIndex();
+		const double number_of_pixels = static_cast< double >(size[0]) * size[1] * size[2];
 
-			out_pix[0] = coords[0];
-			out_pix[1] = coords[1];
-			if(this->dimension == 3)
-				out_pix[2] = coords[2];
+		FeaturesEstimate estimate;
+		estimate.channels = this->dimension;
+		estimate.bytes = number_of_pixels * this->dimension * sizeof(OutputImageType::InternalPixelType);
+		estimate.cost = number_of_pixels * this->dimension;
+		// The coordinates are relative to the whole image, whose planes are computed alone
+		estimate.tileable = false;
+		estimate.planes = true;
 
-			if(this->normalization) {
-				out_pix[0] /= image_size[0];
-				out_pix[1] /= image_size[1];
-				if(this->dimension == 3)
-					out_pix[2] /= image_size[2];
-			}
+		return estimate;
+	}
 
-			std::cout << out_pix << std::endl;
+private:
+	void parse(const std::vector< std::string > &params)
+	{
+		po::variables_map vm;
 
-			ito.Set(out_pix);
+		po::store(po::command_line_parser(params).options(this->options).run(), vm);
+		vm.notify();
 
-			++ito;
+		if((this->dimension != 2) && (this->dimension != 3))
+		{
+			boost::program_options::validation_error err =
+				po::validation_error(
+					po::validation_error::invalid_option_value, 
+					boost::lexical_cast< std::string >(this->dimension), 
+					"dimension");
+			throw err;
 		}
 
-		return output_image;
+		this->normalization = vm.count("normalize") > 0;
 	}
 };
 
-extern "C" FeaturesComputer* create() {
-	return new CoordinatesComputer;
-}
+FEATURES_COMPUTER_PLUGIN(Coordinates)
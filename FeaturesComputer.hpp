@@ -2,15 +2,41 @@
 #define FEATURESCOMPUTER_HPP
 
 #include "datatypes.h"
+#include "buffer_pool.h"
+#include "tile_scheduler.h"
+#include "neighborhood_kernel.h"
+
+#include <boost/program_options.hpp>
+
+#include <algorithm>
+#include <string>
+#include <vector>
 
 #ifdef USE_LOG4CXX
 #  include "log4cxx/logger.h"
 #endif
 
+/**
+ * What a computer produces and needs for given options and image size,
+ * estimated without computing anything.
+ */
+struct FeaturesEstimate
+{
+	FeaturesEstimate() : channels(0), bytes(0), cost(0), tileable(false), planes(false), tiled(true) { halo.Fill(0); }
+
+	unsigned int channels;         // Number of channels of the output
+	InputImageType::SizeType halo; // Radius of the neighborhood an output voxel depends on
+	unsigned long long bytes;      // Peak memory allocated by the computation, output included
+	double cost;                   // Relative computation cost (about the number of elementary operations)
+	bool tileable;                 // Whether pieces of the image (with their halo) can be computed separately
+	bool planes;                   // Whether some planes of the features of the whole image can be computed alone (see compute_planes())
+	bool tiled;                    // Whether the computation is cut into tiles of the voxels set by set_tile_voxels()
+};
+
 class FeaturesComputer
 {
 public:
-	FeaturesComputer() {}
+	FeaturesComputer() : buffer_pool(NULL), tile_voxels(TileScheduler::default_tile_voxels) {}
 	virtual ~FeaturesComputer() {}
 	virtual OutputImageType::Pointer compute(InputImageType::Pointer input_image, std::vector< std::string > params) = 0;
 
@@ -20,15 +46,192 @@ public:
 	}
 #endif
 
+	/**
+	 * Pool the computer takes its large scratch buffers from (owned by the
+	 * caller, may be NULL).
+	 */
+	void set_buffer_pool(BufferPool *buffer_pool) {
+		this->buffer_pool = buffer_pool;
+	}
+
+	/**
+	 * Number of voxels of the tiles the computer cuts the image into (see
+	 * TileScheduler::row_tiles()).
+	 */
+	void set_tile_voxels(const unsigned long tile_voxels) {
+		this->tile_voxels = tile_voxels;
+	}
+
 	virtual void print_usage(std::ostream &os) = 0;
 
+	/**
+	 * Normalize the options of the computer, so that equivalent command lines
+	 * lead to the same vector (used to identify previously computed outputs).
+	 * The options left to their default are included with their value, a
+	 * change of a default changing the normalized options.
+	 */
+	virtual std::vector< std::string > normalize_options(std::vector< std::string > params)
+	{
+		return params;
+	}
+
+	/**
+	 * Version of the features of the computer, changed along with its
+	 * implementation whenever the features computed for some options change
+	 * (identifying previously computed outputs along with the options).
+	 */
+	virtual std::string version() const
+	{
+		return "1";
+	}
+
+	/**
+	 * Kernel computing the features of the computer for options (validated
+	 * as by compute()), to run it in a single sweep of the input with other
+	 * computers (see NeighborhoodKernel). NULL if the computer has none. The
+	 * caller owns the kernel.
+	 */
+	virtual NeighborhoodKernel* create_kernel(const std::vector< std::string > &params)
+	{
+		return NULL;
+	}
+
+	/**
+	 * Compute the planes [first_plane, first_plane + number_of_planes) (along
+	 * z) of the features of the whole input image, for a computer that is not
+	 * tileable (e.g. depending on the position in the image) but whose
+	 * estimate sets planes. The output holds these planes, with their
+	 * geometry in the input image. NULL if the computer cannot.
+	 */
+	virtual OutputImageType::Pointer compute_planes(InputImageType::Pointer input_image, const unsigned int first_plane, const unsigned int number_of_planes, std::vector< std::string > params)
+	{
+		return OutputImageType::Pointer();
+	}
+
+protected:
+	/**
+	 * Normalize options parsed by a description: each option is written with its
+	 * long name, the options taking a value that are not given are added with
+	 * their default value, and the options are sorted by name (keeping the
+	 * relative order of the repeated ones).
+	 */
+	static std::vector< std::string > normalized_options(const boost::program_options::options_description &options, std::vector< std::string > params)
+	{
+		boost::program_options::parsed_options parsed =
+			boost::program_options::command_line_parser(params).options(options).run();
+
+		std::vector< std::pair< std::string, std::string > > named_options;
+		std::vector< boost::program_options::option >::const_iterator it;
+		for(it = parsed.options.begin(); it != parsed.options.end(); ++it)
+		{
+			std::string option = "--" + it->string_key;
+			std::vector< std::string >::const_iterator value;
+			for(value = it->value.begin(); value != it->value.end(); ++value)
+				option += " " + *value;
+
+			named_options.push_back(std::make_pair(it->string_key, option));
+		}
+
+		std::vector< boost::shared_ptr< boost::program_options::option_description > >::const_iterator description;
+		for(description = options.options().begin(); description != options.options().end(); ++description)
+		{
+			const std::string name = (*description)->long_name();
+			if(std::find_if(parsed.options.begin(), parsed.options.end(), FeaturesComputer::has_key(name)) != parsed.options.end())
+				continue;
+
+			std::string value;
+			if(FeaturesComputer::default_value(**description, value))
+				named_options.push_back(std::make_pair(name, "--" + name + " " + value));
+		}
+
+		std::stable_sort(named_options.begin(), named_options.end(), FeaturesComputer::option_name_less);
+
+		std::vector< std::string > normalized;
+		std::vector< std::pair< std::string, std::string > >::const_iterator named_it;
+		for(named_it = named_options.begin(); named_it != named_options.end(); ++named_it)
+			normalized.push_back(named_it->second);
+
+		return normalized;
+	}
+
+	/**
+	 * Scratch buffer of count elements (not initialized), taken from the
+	 * buffer pool if any.
+	 */
+	template< typename T >
+	BufferPool::Buffer scratch(const size_t count) const
+	{
+		return this->buffer_pool ? this->buffer_pool->acquire(count * sizeof(T)) : BufferPool::unpooled(count * sizeof(T));
+	}
+
+private:
+	static bool option_name_less(const std::pair< std::string, std::string > &a, const std::pair< std::string, std::string > &b)
+	{
+		return a.first < b.first;
+	}
+
+	struct has_key
+	{
+		has_key(const std::string key) : key(key) {}
+		bool operator()(const boost::program_options::option &option) const { return option.string_key == this->key; }
+		const std::string key;
+	};
+
+	/**
+	 * Default value of an option taking a value, as shown by the usage
+	 * ("arg (=value)").
+	 * @return false if the option has no default value, or takes no value.
+	 */
+	static bool default_value(const boost::program_options::option_description &description, std::string &value)
+	{
+		if(description.semantic()->max_tokens() == 0)
+			return false;
+
+		const std::string name = description.semantic()->name();
+		const std::string::size_type begin = name.rfind(" (=");
+		if((begin == std::string::npos) || (name[name.size() - 1] != ')'))
+			return false;
+
+		value = name.substr(begin + 3, name.size() - begin - 4);
+		return true;
+	}
+
 protected:
 #ifdef USE_LOG4CXX
 	log4cxx::LoggerPtr m_Logger;
 #endif
+	BufferPool *buffer_pool;
+	unsigned long tile_voxels;
 };
 
 // the types of the class factories
 typedef FeaturesComputer* create_t();
 
+// the type of the estimation functions: they parse and validate the options
+// (throwing the errors compute() would throw) before estimating
+typedef FeaturesEstimate estimate_t(const std::vector< std::string > &params, const InputImageType::SizeType &size);
+
+// Defines the class factory and the estimation function of the computer class
+// <Name>Computer: exported as create() and estimate() by its plugin, or, when
+// the computers are built into the binaries (BUILTIN_COMPUTERS CMake option),
+// as create_<Name>Computer() and estimate_<Name>Computer(), found by
+// FeaturesComputerLoader in its registry
+#ifdef FEATURES_COMPUTER_BUILTIN
+#  define FEATURES_COMPUTER_PLUGIN(Name) \
+	FeaturesComputer* create_##Name##Computer() { \
+		return new Name##Computer; \
+	} \
+	FeaturesEstimate estimate_##Name##Computer(const std::vector< std::string > &params, const InputImageType::SizeType &size) { \
+		return Name##Computer().estimate(params, size); \
+	}
+#else
+#  define FEATURES_COMPUTER_PLUGIN(Name) \
+	extern "C" FeaturesComputer* create() { \
+		return new Name##Computer; \
+	} \
+	extern "C" FeaturesEstimate estimate(const std::vector< std::string > &params, const InputImageType::SizeType &size) { \
+		return Name##Computer().estimate(params, size); \
+	}
+#endif
+
 #endif /* FEATURESCOMPUTER_HPP */
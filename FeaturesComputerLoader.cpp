@@ -6,8 +6,51 @@
 #include <boost/filesystem.hpp>
 #include <boost/regex.hpp>
 
-FeaturesComputerLoader::FeaturesComputerLoader(const std::string name)
+#ifdef BUILTIN_COMPUTERS
+// The functions defined by FEATURES_COMPUTER_PLUGIN() in the built-in computers
+#define FEATURES_COMPUTER(Name) \
+	FeaturesComputer* create_##Name##Computer(); \
+	FeaturesEstimate estimate_##Name##Computer(const std::vector< std::string > &params, const InputImageType::SizeType &size);
+#include "builtin_computers.h"
+#undef FEATURES_COMPUTER
+
+namespace
 {
+
+struct BuiltinComputer
+{
+	const char *name;
+	create_t *create;
+	estimate_t *estimate;
+};
+
+// Registry of the computers linked into the binaries, generated by CMake
+const BuiltinComputer builtin_computers[] = {
+#define FEATURES_COMPUTER(Name) { #Name, create_##Name##Computer, estimate_##Name##Computer },
+#include "builtin_computers.h"
+#undef FEATURES_COMPUTER
+	{ NULL, NULL, NULL }
+};
+
+}
+#endif
+
+FeaturesComputerLoader::FeaturesComputerLoader(const std::string name) :
+	module(NULL), computer(NULL), estimate_function(NULL)
+{
+#ifdef BUILTIN_COMPUTERS
+	// A built-in computer needs no library, the others are still loaded as plugins
+	for(const BuiltinComputer *builtin = builtin_computers; builtin->name; ++builtin)
+	{
+		if(name == builtin->name)
+		{
+			this->computer = builtin->create();
+			this->estimate_function = builtin->estimate;
+			return;
+		}
+	}
+#endif
+
 	void* plug = dlopen(FeaturesComputerLoader::filename(name).c_str(), RTLD_LAZY);
 
 	if (!plug) {
@@ -35,6 +78,10 @@ FeaturesComputerLoader::FeaturesComputerLoader(const std::string name)
 
 	// create an instance of the class
 	this->computer = create_plug();
+
+	// the estimation function is optional
+	this->estimate_function = (estimate_t*) dlsym(this->module, "estimate");
+	dlerror();
 }
 
 FeaturesComputerLoader::~FeaturesComputerLoader()
@@ -54,6 +101,19 @@ FeaturesComputer* FeaturesComputerLoader::operator->()
 	return this->computer;
 }
 
+bool FeaturesComputerLoader::has_estimate() const
+{
+	return this->estimate_function != NULL;
+}
+
+FeaturesEstimate FeaturesComputerLoader::estimate(const std::vector< std::string > &params, const InputImageType::SizeType &size) const
+{
+	if(!this->estimate_function)
+		throw FeaturesComputerLoadingException("The computer does not provide estimates");
+
+	return this->estimate_function(params, size);
+}
+
 /*
 std::vector< std::string > FeaturesComputerLoader::getAvailableModules()
 {
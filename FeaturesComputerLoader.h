@@ -11,6 +11,7 @@ class FeaturesComputerLoader
 private:
 	void* module;
 	FeaturesComputer* computer;
+	estimate_t* estimate_function;
 
 public:
 	FeaturesComputerLoader(const std::string computer_name);
@@ -18,6 +19,17 @@ public:
 
 	FeaturesComputer* operator->();
 
+	/**
+	 * Whether the computer exports an estimation function (see estimate_t).
+	 */
+	bool has_estimate() const;
+
+	/**
+	 * Estimate the output and the needs of the computer, validating the options.
+	 * @throw FeaturesComputerLoadingException If the computer exports no estimation function.
+	 */
+	FeaturesEstimate estimate(const std::vector< std::string > &params, const InputImageType::SizeType &size) const;
+
 	//static std::vector< std::string > getAvailableModules();
 
 private:
@@ -0,0 +1,423 @@
+#include "FeaturesComputer.hpp"
+
+#include <itkCastImageFilter.h>
+#include <itkRecursiveGaussianImageFilter.h>
+
+#include <boost/program_options.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace po = boost::program_options;
+
+typedef OutputImageType::PixelType::ValueType FeatureType;
+typedef itk::Image< FeatureType, 3 > FloatingPointImageType;
+typedef itk::CastImageFilter< InputImageType, FloatingPointImageType > CastFilterType;
+typedef itk::RecursiveGaussianImageFilter< FloatingPointImageType, FloatingPointImageType > GaussianFilterType;
+
+namespace
+{
+
+// Smallest size along a direction accepted by itk::RecursiveGaussianImageFilter
+const itk::SizeValueType minimum_filtered_size = 4;
+
+/**
+ * Eigenvalues (in ascending order) of a 3x3 symmetric matrix, using the
+ * closed-form trigonometric solution.
+ */
+inline void symmetric_eigenvalues(const double a00, const double a01, const double a02, const double a11, const double a12, const double a22, double *eigenvalues)
+{
+	const double p1 = a01 * a01 + a02 * a02 + a12 * a12;
+	if(p1 == 0)
+	{
+		eigenvalues[0] = a00; eigenvalues[1] = a11; eigenvalues[2] = a22;
+		std::sort(eigenvalues, eigenvalues + 3);
+		return;
+	}
+
+	const double q = (a00 + a11 + a22) / 3;
+	const double p2 = (a00 - q) * (a00 - q) + (a11 - q) * (a11 - q) + (a22 - q) * (a22 - q) + 2 * p1;
+	const double p = std::sqrt(p2 / 6);
+
+	// B = (A - qI) / p, r = det(B) / 2
+	const double b00 = (a00 - q) / p, b11 = (a11 - q) / p, b22 = (a22 - q) / p;
+	const double b01 = a01 / p, b02 = a02 / p, b12 = a12 / p;
+	const double r = (b00 * (b11 * b22 - b12 * b12) - b01 * (b01 * b22 - b12 * b02) + b02 * (b01 * b12 - b11 * b02)) / 2;
+
+	const double phi = r <= -1 ? M_PI / 3 : (r >= 1 ? 0 : std::acos(r) / 3);
+
+	eigenvalues[2] = q + 2 * p * std::cos(phi);
+	eigenvalues[0] = q + 2 * p * std::cos(phi + 2 * M_PI / 3);
+	eigenvalues[1] = 3 * q - eigenvalues[0] - eigenvalues[2];
+}
+
+/**
+ * Call function(n) for the index n of each voxel of an image, in parallel by
+ * tiles of rows of about tile_voxels voxels.
+ */
+template< class TFunction >
+void for_each_voxel(const InputImageType::SizeType &size, const unsigned long tile_voxels, TFunction function)
+{
+	const long nx = size[0], ny = size[1];
+
+	TileScheduler::parallel_for(size, TileScheduler::row_tiles(size, tile_voxels), [&](const Tile &tile) {
+		for(long z = tile.begin[2]; z < tile.end[2]; ++z)
+			for(long y = tile.begin[1]; y < tile.end[1]; ++y)
+			{
+				const long first = (z * ny + y) * nx;
+				for(long n = first; n < first + nx; ++n)
+					function(n);
+			}
+	});
+}
+
+}
+
+class FilterBankComputer : public FeaturesComputer
+{
+private:
+	boost::program_options::options_description options;
+	std::vector< double > sigmas;
+	std::vector< std::string > features;
+	double tensor_scale;
+	bool normalize_across_scale;
+
+	/**
+	 * Gaussian derivatives of the current scale, indexed by their orders along
+	 * z, y and x (written as a string). Partial results (filtered along the
+	 * first directions only) are shared between the derivatives.
+	 * A null image stands for a derivative along a direction that is too
+	 * small to be filtered (and is therefore null).
+	 */
+	std::map< std::string, FloatingPointImageType::Pointer > derivatives;
+	FloatingPointImageType::Pointer input;
+	double sigma;
+
+public:
+	FilterBankComputer():
+		options("FilterBankComputer")
+	{
+		std::vector< std::string > default_features;
+		default_features.push_back("smoothed");
+		default_features.push_back("gradient");
+		default_features.push_back("log");
+		default_features.push_back("hessian");
+		default_features.push_back("structure");
+
+		options.add_options()
+			("sigma,s",
+			 po::value< std::vector< double > >(&this->sigmas)->required()->multitoken(),
+			 "Scales of the filters, in physical units (required)")
+			("features,f",
+			 po::value< std::vector< std::string > >(&this->features)->multitoken()->default_value(default_features, "smoothed gradient log hessian structure"),
+			 "Features computed at each scale: smoothed (gaussian smoothing), gradient (gradient magnitude), log (laplacian of gaussian), hessian (3 eigenvalues of the hessian), structure (3 eigenvalues of the structure tensor)")
+			("tensor-scale,t",
+			 po::value< double >(&this->tensor_scale)->default_value(2.0),
+			 "Integration scale of the structure tensor, relative to the scale of the filters")
+			("normalize-across-scale,n",
+			 "Enables the normalization of the derivatives across scales (default: disabled)")
+			;
+	}
+
+	virtual void print_usage(std::ostream &os)
+	{
+		os << this->options;
+	}
+
+	virtual std::vector< std::string > normalize_options(std::vector< std::string > params)
+	{
+		return FeaturesComputer::normalized_options(this->options, params);
+	}
+
+	virtual OutputImageType::Pointer compute( InputImageType::Pointer input_image, std::vector< std::string > params )
+	{
+		const unsigned int channels_per_scale = this->parse(params);
+
+		CastFilterType::Pointer caster = CastFilterType::New();
+		caster->SetInput(input_image);
+		caster->Update();
+		this->input = caster->GetOutput();
+
+		const unsigned int number_of_channels = channels_per_scale * this->sigmas.size();
+
+		OutputImageType::Pointer output_image = OutputImageType::New();
+		output_image->CopyInformation(input_image);
+		output_image->SetRegions( input_image->GetBufferedRegion() );
+		output_image->SetVectorLength(number_of_channels);
+		output_image->Allocate();
+
+		const InputImageType::SizeType size = input_image->GetBufferedRegion().GetSize();
+		FeatureType *output = output_image->GetBufferPointer();
+
+		unsigned int channel = 0;
+		std::vector< std::string >::const_iterator feature;
+		std::vector< double >::const_iterator sigma_it;
+		for(sigma_it = this->sigmas.begin(); sigma_it != this->sigmas.end(); ++sigma_it)
+		{
+			this->sigma = *sigma_it;
+			this->derivatives.clear();
+
+			for(feature = this->features.begin(); feature != this->features.end(); ++feature)
+			{
+				if(*feature == "smoothed")
+				{
+					const FeatureType *l = this->derivative(0, 0, 0);
+
+					for_each_voxel(size, this->tile_voxels, [&](const long i) {
+						output[i * number_of_channels + channel] = l[i];
+					});
+
+					channel += 1;
+				} else if(*feature == "gradient") {
+					const FeatureType *lx = this->derivative(1, 0, 0), *ly = this->derivative(0, 1, 0), *lz = this->derivative(0, 0, 1);
+
+					for_each_voxel(size, this->tile_voxels, [&](const long i) {
+						const double gx = lx ? lx[i] : 0, gy = ly ? ly[i] : 0, gz = lz ? lz[i] : 0;
+						output[i * number_of_channels + channel] = std::sqrt(gx * gx + gy * gy + gz * gz);
+					});
+
+					channel += 1;
+				} else if(*feature == "log") {
+					const FeatureType *lxx = this->derivative(2, 0, 0), *lyy = this->derivative(0, 2, 0), *lzz = this->derivative(0, 0, 2);
+
+					for_each_voxel(size, this->tile_voxels, [&](const long i) {
+						output[i * number_of_channels + channel] = (lxx ? lxx[i] : 0) + (lyy ? lyy[i] : 0) + (lzz ? lzz[i] : 0);
+					});
+
+					channel += 1;
+				} else if(*feature == "hessian") {
+					const FeatureType *lxx = this->derivative(2, 0, 0), *lyy = this->derivative(0, 2, 0), *lzz = this->derivative(0, 0, 2);
+					const FeatureType *lxy = this->derivative(1, 1, 0), *lxz = this->derivative(1, 0, 1), *lyz = this->derivative(0, 1, 1);
+
+					for_each_voxel(size, this->tile_voxels, [&](const long i) {
+						double eigenvalues[3];
+						symmetric_eigenvalues(
+								lxx ? lxx[i] : 0, lxy ? lxy[i] : 0, lxz ? lxz[i] : 0,
+								lyy ? lyy[i] : 0, lyz ? lyz[i] : 0,
+								lzz ? lzz[i] : 0,
+								eigenvalues);
+
+						std::copy(eigenvalues, eigenvalues + 3, output + i * number_of_channels + channel);
+					});
+
+					channel += 3;
+				} else if(*feature == "structure") {
+					this->compute_structure_tensor_eigenvalues(output + channel, number_of_channels);
+
+					channel += 3;
+				}
+			}
+
+#ifdef USE_LOG4CXX
+			LOG4CXX_INFO(m_Logger, "Features at scale " << this->sigma << " done.");
+#endif
+		}
+
+		this->derivatives.clear();
+		this->input = NULL;
+
+		return output_image;
+	}
+
+	FeaturesEstimate estimate(const std::vector< std::string > &params, const InputImageType::SizeType &size)
+	{
+		const unsigned int channels_per_scale = this->parse(params);
+
+		const double number_of_pixels = static_cast< double >(size[0]) * size[1] * size[2];
+
+		// Derivatives needed at each scale, as their orders along z, y and x
+		std::set< std::string > orders;
+		bool structure = false;
+		std::vector< std::string >::const_iterator feature;
+		for(feature = this->features.begin(); feature != this->features.end(); ++feature)
+		{
+			if(*feature == "smoothed") {
+				orders.insert("000");
+			} else if((*feature == "gradient") || (*feature == "structure")) {
+				orders.insert("001"); orders.insert("010"); orders.insert("100");
+				structure = structure || (*feature == "structure");
+			} else {
+				orders.insert("002"); orders.insert("020"); orders.insert("200");
+				if(*feature == "hessian")
+				{
+					orders.insert("011"); orders.insert("101"); orders.insert("110");
+				}
+			}
+		}
+
+		// Each filtering along a direction is kept (see derivative())
+		std::set< std::string > filtered;
+		std::set< std::string >::const_iterator it;
+		for(it = orders.begin(); it != orders.end(); ++it)
+			for(unsigned int length = 1; length <= 3; ++length)
+				filtered.insert(it->substr(0, length));
+
+		FeaturesEstimate estimate;
+		estimate.channels = channels_per_scale * this->sigmas.size();
+		// Output, cast input, filtered images of a scale, and the smoothed
+		// products of the structure tensor (one being filtered)
+		estimate.bytes = number_of_pixels * sizeof(FeatureType) * (estimate.channels + 1 + filtered.size() + (structure ? 7 : 0));
+		// About 16 operations per voxel and recursive filtering
+		estimate.cost = number_of_pixels * this->sigmas.size() * (16.0 * (filtered.size() + (structure ? 18 : 0)) + 10 * channels_per_scale);
+		// The recursive filters depend on the whole lines of the image
+		estimate.tileable = false;
+
+		return estimate;
+	}
+
+private:
+	/**
+	 * Parse and check the options.
+	 * @return The number of channels computed at each scale.
+	 */
+	unsigned int parse(const std::vector< std::string > &params)
+	{
+		po::variables_map vm;
+
+		po::store(po::command_line_parser(params).options(this->options).run(), vm);
+		vm.notify();
+
+		this->normalize_across_scale = vm.count("normalize-across-scale") > 0;
+
+		std::vector< std::string >::const_iterator feature;
+		unsigned int channels_per_scale = 0;
+		for(feature = this->features.begin(); feature != this->features.end(); ++feature)
+		{
+			if((*feature == "smoothed") || (*feature == "gradient") || (*feature == "log"))
+				channels_per_scale += 1;
+			else if((*feature == "hessian") || (*feature == "structure"))
+				channels_per_scale += 3;
+			else {
+				boost::program_options::validation_error err =
+					po::validation_error(
+						po::validation_error::invalid_option_value,
+						*feature,
+						"features");
+				throw err;
+			}
+		}
+
+		return channels_per_scale;
+	}
+
+	/**
+	 * Filter an image along a direction with the recursive gaussian filter of the current scale.
+	 */
+	FloatingPointImageType::Pointer filter(const FloatingPointImageType *image, const unsigned int direction, const unsigned int order, const double scale) const
+	{
+		GaussianFilterType::Pointer gaussian = GaussianFilterType::New();
+		gaussian->SetInput(image);
+		gaussian->SetDirection(direction);
+		gaussian->SetSigma(scale);
+		gaussian->SetNormalizeAcrossScale(this->normalize_across_scale);
+
+		switch(order)
+		{
+			case 0: gaussian->SetZeroOrder(); break;
+			case 1: gaussian->SetFirstOrder(); break;
+			default: gaussian->SetSecondOrder(); break;
+		}
+
+		gaussian->Update();
+
+		return gaussian->GetOutput();
+	}
+
+	/**
+	 * Get a gaussian derivative of the input at the current scale.
+	 * The image is filtered along z, then y, then x, each intermediate result
+	 * being kept to be shared with the other derivatives.
+	 * @return The buffer of the derivative, or NULL if the derivative is null.
+	 */
+	const FeatureType* derivative(const unsigned int ox, const unsigned int oy, const unsigned int oz)
+	{
+		const unsigned int orders[3] = {ox, oy, oz};
+		const InputImageType::SizeType size = this->input->GetBufferedRegion().GetSize();
+
+		FloatingPointImageType::Pointer image = this->input;
+		std::string key;
+
+		for(int direction = 2; direction >= 0; --direction)
+		{
+			key += static_cast< char >('0' + orders[direction]);
+
+			std::map< std::string, FloatingPointImageType::Pointer >::const_iterator it = this->derivatives.find(key);
+			if(it != this->derivatives.end()) {
+				image = it->second;
+			} else {
+				if(size[direction] >= minimum_filtered_size)
+					image = this->filter(image, direction, orders[direction], this->sigma);
+				else if(orders[direction] > 0)
+					image = NULL; // Derivative along a flat direction
+
+				this->derivatives[key] = image;
+			}
+
+			if(image.IsNull())
+				return NULL;
+		}
+
+		return image->GetBufferPointer();
+	}
+
+	/**
+	 * Compute the eigenvalues of the structure tensor (the outer product of the
+	 * gradient, smoothed at the integration scale).
+	 */
+	void compute_structure_tensor_eigenvalues(FeatureType *output, const unsigned int stride)
+	{
+		const FeatureType *gradient[3] = {this->derivative(1, 0, 0), this->derivative(0, 1, 0), this->derivative(0, 0, 1)};
+		const InputImageType::SizeType size = this->input->GetBufferedRegion().GetSize();
+
+		// Smoothed products of the gradient components, in row-major order of the upper triangle
+		FloatingPointImageType::Pointer tensor[6];
+		const FeatureType *t[6];
+
+		for(unsigned int i = 0, k = 0; i < 3; ++i)
+		{
+			for(unsigned int j = i; j < 3; ++j, ++k)
+			{
+				t[k] = NULL;
+				if(!gradient[i] || !gradient[j])
+					continue;
+
+				FloatingPointImageType::Pointer product = FloatingPointImageType::New();
+				product->CopyInformation(this->input);
+				product->SetRegions(this->input->GetBufferedRegion());
+				product->Allocate();
+
+				FeatureType *p = product->GetBufferPointer();
+				const FeatureType *gi = gradient[i], *gj = gradient[j];
+
+				for_each_voxel(size, this->tile_voxels, [&](const long n) {
+					p[n] = gi[n] * gj[n];
+				});
+
+				tensor[k] = product;
+				for(unsigned int direction = 0; direction < 3; ++direction)
+					if(size[direction] >= minimum_filtered_size)
+						tensor[k] = this->filter(tensor[k], direction, 0, this->tensor_scale * this->sigma);
+
+				t[k] = tensor[k]->GetBufferPointer();
+			}
+		}
+
+		for_each_voxel(size, this->tile_voxels, [&](const long n) {
+			double eigenvalues[3];
+			symmetric_eigenvalues(
+					t[0] ? t[0][n] : 0, t[1] ? t[1][n] : 0, t[2] ? t[2][n] : 0,
+					t[3] ? t[3][n] : 0, t[4] ? t[4][n] : 0,
+					t[5] ? t[5][n] : 0,
+					eigenvalues);
+
+			std::copy(eigenvalues, eigenvalues + 3, output + n * stride);
+		});
+	}
+};
+
+FEATURES_COMPUTER_PLUGIN(FilterBank)
@@ -1,81 +1,449 @@
 #include "FeaturesComputer.hpp"
+#include "posterization.h"
+#include "cli_offset.h"
+#include "texture_matrix.h"
 
-#include "itkImageRegionIteratorWithIndex.h"
-#include "itkRescaleIntensityImageFilter.h"
-#include "itkVectorImageToImageAdaptor.h"
 #include "itkComposeImageFilter.h"
 
 #include "itkScalarImageToHaralickTextureFeaturesImageFilter.h"
 
 #include <boost/program_options.hpp>
+#include <boost/cstdint.hpp>
 #include <boost/regex.hpp>
+#include <boost/scoped_ptr.hpp>
 
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include <iostream>
+#include <sstream>
 #include <string>
+#include <vector>
 
 namespace po = boost::program_options;
 
-typedef itk::RescaleIntensityImageFilter< InputImageType, InputImageType > RescaleFilter;
+typedef OutputImageType::PixelType::ValueType FeatureType;
 
-typedef typename itk::Statistics::ScalarImageToHaralickTextureFeaturesImageFilter< InputImageType, typename OutputImageType::PixelType::ValueType > HaralickFilter;
+typedef typename itk::Statistics::ScalarImageToHaralickTextureFeaturesImageFilter< PosterizedImageAdaptor, typename OutputImageType::PixelType::ValueType > HaralickFilter;
 
-typedef itk::VectorImageToImageAdaptor< typename OutputImageType::PixelType::ValueType, OutputImageType::ImageDimension > HaralickFeatureAdaptorType;
+namespace
+{
+
+// Energy, Entropy, Correlation, InverseDifferenceMoment, Inertia, ClusterShade,
+// ClusterProminence and HaralickCorrelation, as itk::Statistics::HistogramToTextureFeaturesFilter
+const unsigned int number_of_features = 8;
 
-typedef typename itk::Image< typename OutputImageType::PixelType::ValueType, 3 > HaralickFeatureImageType;
+/**
+ * Offset of the pairs of voxels, counted weight times.
+ */
+struct Offset
+{
+	long x, y, z;
+	unsigned int weight;
+};
 
-typedef itk::RescaleIntensityImageFilter< HaralickFeatureAdaptorType, HaralickFeatureImageType > HaralickFeatureImageRescaleFilter;
+/**
+ * Orient an offset so that its last non null component is positive: an
+ * offset and its opposite lead to the same pairs of voxels.
+ */
+inline Offset canonical(const Offset &offset)
+{
+	const long last = offset.z != 0 ? offset.z : (offset.y != 0 ? offset.y : offset.x);
+	if(last >= 0)
+		return offset;
 
-class cli_offset {
-public :
-	cli_offset() : m_offset(3)
+	Offset opposite = { -offset.x, -offset.y, -offset.z, offset.weight };
+	return opposite;
+}
+
+/**
+ * Merge the offsets leading to the same pairs of voxels, summing their weights.
+ */
+std::vector< Offset > unique_offsets(const std::vector< Offset > &offsets)
+{
+	std::vector< Offset > unique;
+
+	std::vector< Offset >::const_iterator it;
+	for(it = offsets.begin(); it != offsets.end(); ++it)
 	{
-		m_offset[0] = 0; m_offset[1] = 0; m_offset[2] = 0;
+		const Offset offset = canonical(*it);
+
+		std::vector< Offset >::iterator u;
+		for(u = unique.begin(); u != unique.end(); ++u)
+			if((u->x == offset.x) && (u->y == offset.y) && (u->z == offset.z))
+				break;
+
+		if(u == unique.end())
+			unique.push_back(offset);
+		else
+			u->weight += offset.weight;
 	}
 
-	cli_offset(unsigned int o1, unsigned int o2, unsigned int o3) : m_offset(3)
+	return unique;
+}
+
+/**
+ * Values of the cells of a matrix, in a fixed size array when their number is
+ * known at compile time (Size not 0), in a vector otherwise.
+ */
+template< typename T, unsigned int Size >
+struct Cells : public std::array< T, Size >
+{
+	explicit Cells(const unsigned int size) { this->fill(T()); }
+};
+
+template< typename T >
+struct Cells< T, 0 > : public std::vector< T >
+{
+	explicit Cells(const unsigned int size) : std::vector< T >(size) {}
+};
+
+/**
+ * Per cell weights of the statistics of a symmetric co-occurrence matrix.
+ *
+ * As the matrix is symmetric, only its upper triangle (i <= j) is stored, row
+ * by row. A cell counts the pairs of voxels whose values are (i, j) in any
+ * order, so that in the full normalized matrix, a cell stands for
+ * p(i, i) = c / N on the diagonal, and for p(i, j) = p(j, i) = c / 2N outside.
+ *
+ * StaticLevels is the number of gray levels when known at compile time (0
+ * otherwise), the tables being fixed size arrays then.
+ */
+template< unsigned int StaticLevels >
+struct TriangleWeights
+{
+	static const unsigned int StaticSize = StaticLevels * (StaticLevels + 1) / 2;
+
+	TriangleWeights(const unsigned int levels) :
+		levels(levels),
+		size(levels * (levels + 1) / 2),
+		diagonal(size), energy(size), mean(size), square(size), product(size),
+		inverse_difference(size), inertia(size), sum2(size), sum3(size), sum4(size)
 	{
-		m_offset[0] = o1; m_offset[1] = o2; m_offset[2] = o3;
+		unsigned int e = 0;
+		for(unsigned int i = 0; i < levels; ++i)
+		{
+			for(unsigned int j = i; j < levels; ++j, ++e)
+			{
+				const double d = static_cast< double >(j) - i, s = i + j;
+
+				diagonal[e] = (i == j);
+				energy[e] = (i == j) ? 1 : 0.5;
+				mean[e] = s / 2;
+				square[e] = (static_cast< double >(i) * i + static_cast< double >(j) * j) / 2;
+				product[e] = static_cast< double >(i) * j;
+				inverse_difference[e] = 1 / (1 + d * d);
+				inertia[e] = d * d;
+				sum2[e] = s * s;
+				sum3[e] = s * s * s;
+				sum4[e] = s * s * s * s;
+			}
+		}
 	}
 
-	std::vector< unsigned int > getOffset() { return m_offset; }
+	unsigned int levels, size;
+	Cells< bool, StaticSize > diagonal;
+	Cells< double, StaticSize > energy, mean, square, product, inverse_difference, inertia, sum2, sum3, sum4;
+};
 
-	const unsigned int operator[](int i) const { return m_offset[i]; }
+/**
+ * Symmetric gray level co-occurrence matrix of a window.
+ *
+ * StaticLevels is the number of gray levels when known at compile time (0
+ * otherwise), so that the common levels get fixed size loops and arrays, and
+ * TCount is the smallest integer type able to count the pairs of a window.
+ */
+template< typename TCount, unsigned int StaticLevels >
+class GLCM
+{
+public:
+	typedef TriangleWeights< StaticLevels > Weights;
+
+	GLCM(const Weights &weights, const std::vector< double > &c_log2_c) :
+		weights(weights), c_log2_c(c_log2_c), counts(weights.size), rows(weights.levels), total(0)
+	{
+	}
+
+	inline unsigned int levels() const
+	{
+		return StaticLevels ? StaticLevels : this->weights.levels;
+	}
+
+	inline unsigned int size() const
+	{
+		return StaticLevels ? StaticLevels * (StaticLevels + 1) / 2 : this->weights.size;
+	}
+
+	void clear()
+	{
+		std::fill(this->counts.begin(), this->counts.end(), 0);
+		std::fill(this->rows.begin(), this->rows.end(), 0);
+		this->total = 0;
+	}
+
+	/**
+	 * Cell of the pair (a, b) in the upper triangle: row min(a, b) starts
+	 * after the cells of the rows above it.
+	 */
+	inline unsigned int cell(const unsigned char a, const unsigned char b) const
+	{
+		const unsigned int i = std::min(a, b), j = std::max(a, b);
+		return i * (2 * this->levels() - i - 1) / 2 + j;
+	}
+
+	inline void add(const unsigned char a, const unsigned char b, const unsigned int weight)
+	{
+		this->counts[this->cell(a, b)] += weight;
+		this->rows[a] += weight;
+		this->rows[b] += weight;
+		this->total += weight;
+	}
+
+	inline void remove(const unsigned char a, const unsigned char b, const unsigned int weight)
+	{
+		this->counts[this->cell(a, b)] -= weight;
+		this->rows[a] -= weight;
+		this->rows[b] -= weight;
+		this->total -= weight;
+	}
+
+	/**
+	 * Compute the features the way itk::Statistics::HistogramToTextureFeaturesFilter
+	 * does on the normalized matrix. The moments of i + j give the cluster
+	 * features without a second pass once the mean is known.
+	 */
+	void features(FeatureType *output) const
+	{
+		if(this->total == 0)
+		{
+			std::fill(output, output + number_of_features, 0);
+			return;
+		}
+
+		const unsigned int size = this->size();
+		const unsigned int levels = this->levels();
+		const TCount *counts = &this->counts[0];
+
+		double energy = 0, mean = 0, square = 0, product = 0, inverse_difference = 0, inertia = 0, sum2 = 0, sum3 = 0, sum4 = 0;
+		for(unsigned int e = 0; e < size; ++e)
+		{
+			const double c = counts[e];
+			energy += c * c * this->weights.energy[e];
+			mean += c * this->weights.mean[e];
+			square += c * this->weights.square[e];
+			product += c * this->weights.product[e];
+			inverse_difference += c * this->weights.inverse_difference[e];
+			inertia += c * this->weights.inertia[e];
+			sum2 += c * this->weights.sum2[e];
+			sum3 += c * this->weights.sum3[e];
+			sum4 += c * this->weights.sum4[e];
+		}
+
+		// Entropy of the frequencies over 0.0001, as ITK
+		const double N = this->total;
+		const double diagonal_threshold = 0.0001 * N, off_diagonal_threshold = 0.0002 * N;
+		double c_log2_c = 0, diagonal_sum = 0, off_diagonal_sum = 0;
+		for(unsigned int e = 0; e < size; ++e)
+		{
+			const TCount c = counts[e];
+			if(c == 0)
+				continue;
+
+			if(this->weights.diagonal[e]) {
+				if(c <= diagonal_threshold)
+					continue;
+				diagonal_sum += c;
+			} else {
+				if(c <= off_diagonal_threshold)
+					continue;
+				off_diagonal_sum += c;
+			}
+
+			c_log2_c += (c < this->c_log2_c.size()) ? this->c_log2_c[c] : c * std::log(static_cast< double >(c)) / std::log(2.0);
+		}
+
+		// Sum of the squared marginal probabilities (the rows count in 1 / 2N units)
+		double marginal_square_sum = 0;
+		for(unsigned int i = 0; i < levels; ++i)
+			marginal_square_sum += static_cast< double >(this->rows[i]) * this->rows[i];
+		marginal_square_sum /= 4 * N * N;
+
+		mean /= N; square /= N; product /= N; inverse_difference /= N; inertia /= N;
+		sum2 /= N; sum3 /= N; sum4 /= N;
+
+		const double pixel_variance = square - mean * mean;
+		double pixel_variance_squared = pixel_variance * pixel_variance;
+		if(pixel_variance_squared < 1e-20)
+			pixel_variance_squared = 1;
+
+		// Mean and population variance of the marginal sums
+		const double marginal_mean = 1.0 / levels;
+		const double marginal_dev_squared = (marginal_square_sum - marginal_mean) / levels;
+
+		const double m = 2 * mean, m2 = m * m;
+
+		output[0] = energy / (N * N);
+		output[1] = -(c_log2_c - std::log(N) / std::log(2.0) * diagonal_sum - std::log(2 * N) / std::log(2.0) * off_diagonal_sum) / N;
+		output[2] = (product - mean * mean) / pixel_variance_squared;
+		output[3] = inverse_difference;
+		output[4] = inertia;
+		output[5] = sum3 - 3 * m * sum2 + 3 * m2 * m - m2 * m;
+		output[6] = sum4 - 4 * m * sum3 + 6 * m2 * sum2 - 4 * m2 * m * m + m2 * m2;
+		output[7] = (product - marginal_mean * marginal_mean) / marginal_dev_squared;
+	}
 
 private:
-	std::vector< unsigned int > m_offset;
+	const Weights &weights;
+	const std::vector< double > &c_log2_c;
+	Cells< TCount, Weights::StaticSize > counts;
+	Cells< unsigned int, StaticLevels > rows;
+	unsigned long total;
 };
 
-void validate(boost::any& v, const std::vector<std::string>& values, cli_offset* target_type, int)
+/**
+ * Box of the voxels of a window, clipped to the image: [x0, x1] along x...
+ */
+struct Box
 {
-	static boost::regex r("(\\d+),(\\d+),(\\d+)");
+	long x0, x1, y0, y1, z0, z1;
 
-	using namespace boost::program_options;
+	inline bool contains(const long x, const long y, const long z) const
+	{
+		return (x >= x0) && (x <= x1) && (y >= y0) && (y <= y1) && (z >= z0) && (z <= z1);
+	}
+};
 
-	// Make sure no previous assignment to 'v' was made.
-	validators::check_first_occurrence(v);
-	// Extract the first string from 'values'. If there is more than
-	// one string, it's an error, and exception will be thrown.
-	const std::string& s = validators::get_single_string(values);
+/**
+ * Features of the co-occurrence matrix of the window around each voxel,
+ * windows being clipped to the image. Along each row, the matrix is updated
+ * by removing the pairs involving the leaving column and adding the ones
+ * involving the entering column. The voxels are posterized as they are
+ * read, through the lookup table of the image.
+ */
+template< class TGLCM >
+class HaralickKernel : public NeighborhoodKernel
+{
+public:
+	HaralickKernel(const unsigned int levels, const cli_offset &window, const std::vector< Offset > &offsets, const unsigned long max_pairs) :
+		levels(levels), rx(window[0]), ry(window[1]), rz(window[2]), offsets(offsets),
+		weights(levels), c_log2_c(std::min(max_pairs, 0xffffUL) + 1, 0)
+	{
+		for(unsigned long c = 1; c < this->c_log2_c.size(); ++c)
+			this->c_log2_c[c] = c * std::log(static_cast< double >(c)) / std::log(2.0);
+	}
 
-	// Do regex match and convert the interesting part to int.
-	boost::smatch match;
-	if (boost::regex_match(s, match, r)) {
-		v = boost::any(cli_offset(boost::lexical_cast<unsigned int>(match[1]), boost::lexical_cast<unsigned int>(match[2]), boost::lexical_cast<unsigned int>(match[3])));
-	} else {
-		throw invalid_option_value(s);
+	virtual unsigned int get_number_of_channels() const
+	{
+		return number_of_features;
 	}
-}
 
-std::ostream &operator<<(std::ostream &out, cli_offset& t)
-{
-	std::vector<unsigned int> vec = t.getOffset();
+	virtual void prepare(const InputImageType *image)
+	{
+		this->posterization.Build(image, this->levels);
+	}
 
-	std::copy(vec.begin(), vec.end(), std::ostream_iterator<unsigned int>(out, ", ") );
+	virtual Workspace* create_workspace(const InputImageType::SizeType &size) const
+	{
+		return new Matrix(this->weights, this->c_log2_c);
+	}
 
-	return out;
-}
+	virtual void compute(const unsigned char *input, const InputImageType::SizeType &size, const Tile &tile, Workspace *workspace, FeatureType *output, const unsigned int stride) const
+	{
+		const long nx = size[0], ny = size[1], nz = size[2];
+		const long rx = this->rx, ry = this->ry, rz = this->rz;
+		TGLCM &glcm = static_cast< Matrix * >(workspace)->glcm;
+
+		for(long z = tile.begin[2]; z < tile.end[2]; ++z)
+		{
+			for(long y = tile.begin[1]; y < tile.end[1]; ++y)
+			{
+				const long row = z * ny + y;
+
+				Box box;
+				box.y0 = std::max(y - ry, 0L); box.y1 = std::min(y + ry, ny - 1);
+				box.z0 = std::max(z - rz, 0L); box.z1 = std::min(z + rz, nz - 1);
+				box.x0 = 0;
+
+				glcm.clear();
+				for(box.x1 = 0; box.x1 <= std::min(rx, nx - 1); ++box.x1)
+					this->update_column< true >(glcm, input, nx, ny, box.x1, box);
+				box.x1 = std::min(rx, nx - 1);
+
+				FeatureType *out = output + row * nx * stride;
+
+				for(long x = 0; x < nx; ++x)
+				{
+					if(x > 0)
+					{
+						if(x - rx - 1 >= 0)
+						{
+							this->update_column< false >(glcm, input, nx, ny, x - rx - 1, box);
+							box.x0 = x - rx;
+						}
+
+						if(x + rx < nx)
+						{
+							box.x1 = x + rx;
+							this->update_column< true >(glcm, input, nx, ny, x + rx, box);
+						}
+					}
+
+					glcm.features(out + x * stride);
+				}
+			}
+		}
+	}
+
+private:
+	struct Matrix : public Workspace
+	{
+		Matrix(const typename TGLCM::Weights &weights, const std::vector< double > &c_log2_c) : glcm(weights, c_log2_c) {}
+		TGLCM glcm;
+	};
+
+	/**
+	 * Add (or remove) the pairs of voxels of a window having at least one
+	 * voxel in a given column (x) of the window.
+	 */
+	template< bool Add >
+	inline void update_column(TGLCM &glcm, const unsigned char *input, const long nx, const long ny, const long x, const Box &box) const
+	{
+		for(long z = box.z0; z <= box.z1; ++z)
+		{
+			for(long y = box.y0; y <= box.y1; ++y)
+			{
+				const unsigned char a = this->posterization.Get(input[(z * ny + y) * nx + x]);
+
+				std::vector< Offset >::const_iterator o;
+				for(o = this->offsets.begin(); o != this->offsets.end(); ++o)
+				{
+					// The voxel of the column is the first one of the pair
+					if(box.contains(x + o->x, y + o->y, z + o->z))
+					{
+						const unsigned char b = this->posterization.Get(input[((z + o->z) * ny + y + o->y) * nx + x + o->x]);
+						if(Add) glcm.add(a, b, o->weight); else glcm.remove(a, b, o->weight);
+					}
+
+					// The voxel of the column is the second one, the first one being in another column
+					if((o->x != 0) && box.contains(x - o->x, y - o->y, z - o->z))
+					{
+						const unsigned char b = this->posterization.Get(input[((z - o->z) * ny + y - o->y) * nx + x - o->x]);
+						if(Add) glcm.add(b, a, o->weight); else glcm.remove(b, a, o->weight);
+					}
+				}
+			}
+		}
+	}
+
+	const unsigned int levels;
+	const long rx, ry, rz;
+	const std::vector< Offset > offsets;
+	const typename TGLCM::Weights weights;
+	std::vector< double > c_log2_c;
+	PosterizationAccessor posterization;
+};
 
-typedef itk::ImageRegionIteratorWithIndex< OutputImageType >  OutputImageIterator;
+}
 
 class HaralickComputer : public FeaturesComputer
 {
@@ -83,7 +451,10 @@ private:
 	boost::program_options::options_description options;
 	unsigned int posterization_level;
 	cli_offset window;
-	std::vector< cli_offset > offsets;
+	std::vector< cli_signed_offset > offsets;
+	std::string directions;
+	std::string distances;
+	std::string engine;
 
 public:
 	HaralickComputer():
@@ -95,7 +466,13 @@ public:
 			("window,w",
 				po::value< cli_offset >(&this->window)->required(), "Window radius (required)")
 			("offset,o",
-				po::value< std::vector< cli_offset > >(&this->offsets)->required()->multitoken(), "Offset (required)")
+				po::value< std::vector< cli_signed_offset > >(&this->offsets)->multitoken(), "Offset")
+			("directions,d",
+				po::value< std::string >(&this->directions), "Preset of directions: 3d13 (the 13 directions of the 26-neighborhood) or 2d4 (the 4 directions of the 8-neighborhood)")
+			("distances",
+				po::value< std::string >(&this->distances)->default_value("1"), "Comma separated distances of the preset directions (e.g. 1,2,4)")
+			("engine,e",
+				po::value< std::string >(&this->engine)->default_value("native"), "Computation engine: native or itk (ITK_Haralick)")
 			;
 	}
 
@@ -104,26 +481,193 @@ public:
 		os << this->options;
 	}
 
+	virtual std::vector< std::string > normalize_options(std::vector< std::string > params)
+	{
+		return FeaturesComputer::normalized_options(this->options, params);
+	}
+
+	/**
+	 * 2: native engine by default, opposite offsets merged.
+	 */
+	virtual std::string version() const
+	{
+		return "2";
+	}
+
 	virtual OutputImageType::Pointer compute( InputImageType::Pointer input_image, std::vector< std::string > params )
+	{
+		boost::scoped_ptr< NeighborhoodKernel > kernel(this->create_kernel(params));
+
+		OutputImageType::Pointer output_image;
+		if(kernel) {
+			output_image = NeighborhoodKernel::run(*kernel, input_image, this->tile_voxels);
+		} else {
+			// Posterize the input image on the fly, through a lookup table
+			PosterizationAccessor posterization;
+			posterization.Build(input_image, this->posterization_level);
+
+			output_image = this->compute_itk(input_image, posterization, this->requested_offsets());
+		}
+
+#ifdef USE_LOG4CXX
+		LOG4CXX_INFO(m_Logger, "Computation of Haralick features done.");
+#endif
+
+		return output_image;
+	}
+
+	/**
+	 * Kernel of the native engine (the itk engine has none).
+	 */
+	virtual NeighborhoodKernel* create_kernel(const std::vector< std::string > &params)
+	{
+		const std::vector< Offset > requested_offsets = this->parse(params);
+
+		if(this->engine == "itk")
+			return NULL;
+
+		// Opposite and repeated offsets are traversed once, with a greater weight
+		const std::vector< Offset > offsets = unique_offsets(requested_offsets);
+
+#ifdef USE_LOG4CXX
+		LOG4CXX_INFO(m_Logger, offsets.size() << " unique offsets out of " << requested_offsets.size());
+#endif
+
+		const unsigned long max_pairs = (2 * this->window[0] + 1) * (2 * this->window[1] + 1) * (2 * this->window[2] + 1) * requested_offsets.size();
+
+		switch(this->posterization_level)
+		{
+			case 8:  return this->create_kernel_with_levels< 8 >(offsets, max_pairs);
+			case 16: return this->create_kernel_with_levels< 16 >(offsets, max_pairs);
+			case 32: return this->create_kernel_with_levels< 32 >(offsets, max_pairs);
+			case 64: return this->create_kernel_with_levels< 64 >(offsets, max_pairs);
+			default: return this->create_kernel_with_levels< 0 >(offsets, max_pairs);
+		}
+	}
+
+	FeaturesEstimate estimate(const std::vector< std::string > &params, const InputImageType::SizeType &size)
+	{
+		const std::vector< Offset > all_offsets = this->parse(params);
+
+		const double number_of_pixels = static_cast< double >(size[0]) * size[1] * size[2];
+		const double levels = this->posterization_level;
+
+		FeaturesEstimate estimate;
+		estimate.channels = number_of_features;
+		for(unsigned int i = 0; i < InputImageType::ImageDimension; ++i)
+			estimate.halo[i] = this->window[i];
+		estimate.bytes = number_of_pixels * number_of_features * sizeof(FeatureType);
+		if(this->engine == "itk")
+		{
+			// Per-voxel co-occurrence matrices of the filter
+			estimate.bytes *= 2;
+			estimate.cost = number_of_pixels * ((2.0 * this->window[0] + 1) * (2 * this->window[1] + 1) * (2 * this->window[2] + 1) * all_offsets.size() + 8 * levels * levels);
+			// Threaded by ITK, not by tiles
+			estimate.tiled = false;
+		} else {
+			// Columns entering and leaving the window, and features of the packed matrix
+			estimate.cost = number_of_pixels * (2.0 * (2 * this->window[1] + 1) * (2 * this->window[2] + 1) * unique_offsets(all_offsets).size() + 6 * levels * (levels + 1));
+		}
+		// The posterization depends on the intensity range of the whole image
+		estimate.tileable = false;
+
+		return estimate;
+	}
+
+private:
+	/**
+	 * Parse and check the options.
+	 * @return The requested offsets (see requested_offsets()).
+	 */
+	std::vector< Offset > parse(const std::vector< std::string > &params)
 	{
 		po::variables_map vm;
 
 		po::store(po::command_line_parser(params).options(this->options).run(), vm);
 		vm.notify();
 
-		// Posterize the input image
-		typename RescaleFilter::Pointer rescaler = RescaleFilter::New();
-		rescaler->SetInput(input_image);
-		rescaler->SetOutputMinimum(0);
-		rescaler->SetOutputMaximum(this->posterization_level - 1);
-		rescaler->Update();
+		if((this->posterization_level < 1) || (this->posterization_level > 256))
+		{
+			boost::program_options::validation_error err =
+				po::validation_error(
+					po::validation_error::invalid_option_value,
+					boost::lexical_cast< std::string >(this->posterization_level),
+					"posterization");
+			throw err;
+		}
 
-#ifdef USE_LOG4CXX
-		LOG4CXX_INFO(m_Logger, "Posterization done.");
-#endif
+		if((this->engine != "native") && (this->engine != "itk"))
+		{
+			boost::program_options::validation_error err =
+				po::validation_error(
+					po::validation_error::invalid_option_value,
+					this->engine,
+					"engine");
+			throw err;
+		}
+
+		return this->requested_offsets();
+	}
+
+	/**
+	 * Offsets given with --offset, followed by the preset directions at each distance.
+	 */
+	std::vector< Offset > requested_offsets() const
+	{
+		std::vector< Offset > offsets;
+
+		std::vector< cli_signed_offset >::const_iterator it;
+		for(it = this->offsets.begin(); it != this->offsets.end(); ++it)
+		{
+			Offset offset = { (*it)[0], (*it)[1], (*it)[2], 1 };
+			offsets.push_back(offset);
+		}
+
+		if(!this->directions.empty())
+		{
+			const long (*preset)[3];
+			unsigned int preset_size;
+			if(this->directions == "3d13") {
+				preset = directions_3d13;
+				preset_size = 13;
+			} else if(this->directions == "2d4") {
+				preset = directions_2d4;
+				preset_size = 4;
+			} else {
+				throw po::validation_error(po::validation_error::invalid_option_value, this->directions, "directions");
+			}
+
+			static const boost::regex distances_format("\\d+(,\\d+)*");
+			if(!boost::regex_match(this->distances, distances_format))
+				throw po::validation_error(po::validation_error::invalid_option_value, this->distances, "distances");
+
+			std::istringstream distances(this->distances);
+			std::string distance;
+			while(std::getline(distances, distance, ','))
+			{
+				const long d = boost::lexical_cast< long >(distance);
+				for(unsigned int i = 0; i < preset_size; ++i)
+				{
+					Offset offset = { d * preset[i][0], d * preset[i][1], d * preset[i][2], 1 };
+					offsets.push_back(offset);
+				}
+			}
+		}
+
+		if(offsets.empty())
+			throw po::required_option("offset");
+
+		return offsets;
+	}
+
+	OutputImageType::Pointer compute_itk(InputImageType::Pointer input_image, const PosterizationAccessor &posterization, const std::vector< Offset > &offsets) const
+	{
+		typename PosterizedImageAdaptor::Pointer posterized_image = PosterizedImageAdaptor::New();
+		posterized_image->SetImage(input_image);
+		posterized_image->SetPixelAccessor(posterization);
 
 		typename HaralickFilter::Pointer haralickImageComputer = HaralickFilter::New();
-		haralickImageComputer->SetInput(rescaler->GetOutput());
+		haralickImageComputer->SetInput(posterized_image);
 		haralickImageComputer->SetNumberOfBinsPerAxis(this->posterization_level);
 
 		{
@@ -136,12 +680,12 @@ public:
 			typename HaralickFilter::OffsetVectorType::Pointer offsetV =
 				HaralickFilter::OffsetVectorType::New();
 			typename HaralickFilter::OffsetType offset;
-			std::vector< cli_offset >::const_iterator offsets_it;
-			for( offsets_it = this->offsets.begin(); offsets_it < this->offsets.end(); ++offsets_it)
+			std::vector< Offset >::const_iterator offsets_it;
+			for( offsets_it = offsets.begin(); offsets_it < offsets.end(); ++offsets_it)
 			{
-				offset[0] = (*offsets_it)[0];
-				offset[1] = (*offsets_it)[1];
-				offset[2] = (*offsets_it)[2];
+				offset[0] = offsets_it->x;
+				offset[1] = offsets_it->y;
+				offset[2] = offsets_it->z;
 
 				offsetV->push_back(offset);
 			}
@@ -151,15 +695,19 @@ public:
 
 		haralickImageComputer->Update();
 
-#ifdef USE_LOG4CXX
-		LOG4CXX_INFO(m_Logger, "Computation of Haralick features done.");
-#endif
-
 		return haralickImageComputer->GetOutput();
 	}
+
+	template< unsigned int StaticLevels >
+	NeighborhoodKernel* create_kernel_with_levels(const std::vector< Offset > &offsets, const unsigned long max_pairs) const
+	{
+		// The counts of the smaller windows fit in 16 bits
+		if(max_pairs <= 0xffff)
+			return new HaralickKernel< GLCM< boost::uint16_t, StaticLevels > >(this->posterization_level, this->window, offsets, max_pairs);
+		else
+			return new HaralickKernel< GLCM< boost::uint32_t, StaticLevels > >(this->posterization_level, this->window, offsets, max_pairs);
+	}
 };
 
-extern "C" FeaturesComputer* create() {
-	return new HaralickComputer;
-}
+FEATURES_COMPUTER_PLUGIN(Haralick)
 
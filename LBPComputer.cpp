@@ -0,0 +1,426 @@
+#include "FeaturesComputer.hpp"
+#include "cli_offset.h"
+
+#include <boost/program_options.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
+namespace po = boost::program_options;
+
+typedef OutputImageType::PixelType::ValueType FeatureType;
+
+namespace
+{
+
+struct NeighborOffset
+{
+	int x, y, z;
+};
+
+// In-plane neighbors, in circular order (required by the rotation invariant and uniform mappings)
+const NeighborOffset neighbors_2d[] = {
+	{ 1,  0, 0}, { 1,  1, 0}, { 0,  1, 0}, {-1,  1, 0},
+	{-1,  0, 0}, {-1, -1, 0}, { 0, -1, 0}, { 1, -1, 0}
+};
+
+// Face neighbors, ordered as -x, +x, -y, +y, -z, +z
+const NeighborOffset neighbors_3d[] = {
+	{-1, 0, 0}, { 1, 0, 0},
+	{ 0, -1, 0}, { 0, 1, 0},
+	{ 0, 0, -1}, { 0, 0, 1}
+};
+
+// Permutations of the face neighbors for rotations of 90 degrees around the x, y and z axes
+const unsigned int face_rotations[3][6] = {
+	{0, 1, 4, 5, 3, 2},
+	{5, 4, 2, 3, 0, 1},
+	{2, 3, 1, 0, 4, 5}
+};
+
+inline long clamp(const long v, const long size)
+{
+	return std::min(std::max(v, 0L), size - 1);
+}
+
+/**
+ * Set a bit in the code of each voxel of a row whose neighbor is greater or
+ * equal to the voxel itself.
+ */
+inline void compare_row(const unsigned char *center, const unsigned char *neighbor, unsigned char *code, const unsigned char bit, const long size)
+{
+	long x = 0;
+
+#ifdef __SSE2__
+	const __m128i bit_v = _mm_set1_epi8(static_cast< char >(bit));
+	for( ; x + 16 <= size; x += 16)
+	{
+		const __m128i c = _mm_loadu_si128(reinterpret_cast< const __m128i * >(center + x));
+		const __m128i n = _mm_loadu_si128(reinterpret_cast< const __m128i * >(neighbor + x));
+		// n >= c <=> max(n, c) == n
+		const __m128i ge = _mm_cmpeq_epi8(_mm_max_epu8(n, c), n);
+		const __m128i k = _mm_loadu_si128(reinterpret_cast< const __m128i * >(code + x));
+		_mm_storeu_si128(reinterpret_cast< __m128i * >(code + x), _mm_or_si128(k, _mm_and_si128(ge, bit_v)));
+	}
+#endif
+
+	for( ; x < size; ++x)
+		code[x] |= (neighbor[x] >= center[x]) ? bit : 0;
+}
+
+}
+
+class LBPComputer : public FeaturesComputer
+{
+private:
+	boost::program_options::options_description options;
+	unsigned int dimension;
+	std::string mapping_name;
+	cli_offset window;
+
+	std::vector< NeighborOffset > neighbors;
+	std::vector< unsigned char > mapping;
+	unsigned int number_of_bins;
+
+public:
+	LBPComputer():
+		options("LBPComputer")
+	{
+		options.add_options()
+			("dimension,d",
+			 po::value< unsigned int >(&this->dimension)->default_value(2),
+			 "Dimension of the patterns: (default) 2 (8 in-plane neighbors) or 3 (6 face neighbors)")
+			("mapping,m",
+			 po::value< std::string >(&this->mapping_name)->default_value("riu2"),
+			 "Mapping of the patterns: none, ri (rotation invariant, default in 3D), u2 (uniform, 2D only) or riu2 (rotation invariant uniform, 2D only, default in 2D)")
+			("window,w",
+			 po::value< cli_offset >(&this->window),
+			 "Window radius. If provided, computes the normalized histograms of the patterns in the window instead of the patterns")
+			;
+	}
+
+	virtual void print_usage(std::ostream &os)
+	{
+		os << this->options;
+	}
+
+	virtual std::vector< std::string > normalize_options(std::vector< std::string > params)
+	{
+		return FeaturesComputer::normalized_options(this->options, params);
+	}
+
+	virtual OutputImageType::Pointer compute( InputImageType::Pointer input_image, std::vector< std::string > params )
+	{
+		const bool histograms = this->parse(params);
+
+		const InputImageType::SizeType size = input_image->GetBufferedRegion().GetSize();
+
+		OutputImageType::Pointer output_image = OutputImageType::New();
+		output_image->CopyInformation(input_image);
+		output_image->SetRegions( input_image->GetBufferedRegion() );
+		output_image->SetVectorLength(histograms ? this->number_of_bins : 1);
+		output_image->Allocate();
+
+		if(histograms)
+		{
+			BufferPool::Buffer labels = this->scratch< unsigned char >(size[0] * size[1] * size[2]);
+			this->compute_labels(input_image->GetBufferPointer(), size, labels.get< unsigned char >());
+			this->compute_histograms(labels.get< unsigned char >(), size, output_image->GetBufferPointer());
+		} else {
+			this->compute_labels(input_image->GetBufferPointer(), size, output_image->GetBufferPointer());
+		}
+
+#ifdef USE_LOG4CXX
+		LOG4CXX_INFO(m_Logger, "Computation of local binary patterns done.");
+#endif
+
+		return output_image;
+	}
+
+	FeaturesEstimate estimate(const std::vector< std::string > &params, const InputImageType::SizeType &size)
+	{
+		const bool histograms = this->parse(params);
+
+		const double number_of_pixels = static_cast< double >(size[0]) * size[1] * size[2];
+
+		FeaturesEstimate estimate;
+		estimate.channels = histograms ? this->number_of_bins : 1;
+		// The patterns depend on the face (3D) or in-plane (2D) neighbors, and
+		// the histograms on the patterns of the window
+		for(unsigned int i = 0; i < InputImageType::ImageDimension; ++i)
+			estimate.halo[i] = ((i < 2) || (this->dimension == 3) ? 1 : 0) + (histograms ? this->window[i] : 0);
+		// Output, and the patterns when their histograms are computed
+		estimate.bytes = number_of_pixels * estimate.channels * sizeof(FeatureType) + (histograms ? number_of_pixels : 0);
+		estimate.cost = number_of_pixels * (2.0 * this->neighbors.size() + (histograms ? 2.0 * (2 * this->window[1] + 1) * (2 * this->window[2] + 1) + this->number_of_bins : 0));
+		estimate.tileable = true;
+
+		return estimate;
+	}
+
+private:
+	/**
+	 * Parse and check the options, and build the mapping.
+	 * @return Whether the histograms of the patterns are computed.
+	 */
+	bool parse(const std::vector< std::string > &params)
+	{
+		po::variables_map vm;
+
+		po::store(po::command_line_parser(params).options(this->options).run(), vm);
+		vm.notify();
+
+		if((this->dimension != 2) && (this->dimension != 3))
+		{
+			boost::program_options::validation_error err =
+				po::validation_error(
+					po::validation_error::invalid_option_value,
+					boost::lexical_cast< std::string >(this->dimension),
+					"dimension");
+			throw err;
+		}
+
+		if((this->dimension == 3) && vm["mapping"].defaulted())
+			this->mapping_name = "ri";
+
+		this->build_mapping();
+
+		return vm.count("window") > 0;
+	}
+
+	/**
+	 * Build the lookup table mapping the raw patterns to the requested labels.
+	 */
+	void build_mapping()
+	{
+		std::vector< std::vector< unsigned int > > rotations;
+
+		if(this->dimension == 2)
+		{
+			this->neighbors.assign(neighbors_2d, neighbors_2d + 8);
+
+			for(unsigned int r = 0; r < 8; ++r)
+			{
+				std::vector< unsigned int > rotation(8);
+				for(unsigned int i = 0; i < 8; ++i)
+					rotation[i] = (i + r) % 8;
+				rotations.push_back(rotation);
+			}
+		} else {
+			this->neighbors.assign(neighbors_3d, neighbors_3d + 6);
+
+			// Close the set of rotations of the cube under composition (24 rotations)
+			rotations.push_back(std::vector< unsigned int >(face_rotations[0], face_rotations[0] + 6));
+			for(unsigned int i = 0; i < rotations.size(); ++i)
+			{
+				for(unsigned int g = 0; g < 3; ++g)
+				{
+					std::vector< unsigned int > rotation(6);
+					for(unsigned int f = 0; f < 6; ++f)
+						rotation[f] = face_rotations[g][rotations[i][f]];
+
+					if(std::find(rotations.begin(), rotations.end(), rotation) == rotations.end())
+						rotations.push_back(rotation);
+				}
+			}
+		}
+
+		const unsigned int P = this->neighbors.size();
+		const unsigned int number_of_codes = 1 << P;
+
+		this->mapping.resize(number_of_codes);
+
+		if(this->mapping_name == "none")
+		{
+			for(unsigned int c = 0; c < number_of_codes; ++c)
+				this->mapping[c] = c;
+			this->number_of_bins = number_of_codes;
+		} else if(this->mapping_name == "ri") {
+			std::vector< unsigned int > canonical(number_of_codes);
+			std::set< unsigned int > classes;
+			for(unsigned int c = 0; c < number_of_codes; ++c)
+			{
+				canonical[c] = c;
+				for(unsigned int r = 0; r < rotations.size(); ++r)
+				{
+					unsigned int rotated = 0;
+					for(unsigned int i = 0; i < P; ++i)
+						if(c & (1 << i))
+							rotated |= 1 << rotations[r][i];
+					canonical[c] = std::min(canonical[c], rotated);
+				}
+				classes.insert(canonical[c]);
+			}
+
+			for(unsigned int c = 0; c < number_of_codes; ++c)
+				this->mapping[c] = std::distance(classes.begin(), classes.find(canonical[c]));
+			this->number_of_bins = classes.size();
+		} else if((this->mapping_name == "u2") || (this->mapping_name == "riu2")) {
+			if(this->dimension != 2)
+			{
+				boost::program_options::validation_error err =
+					po::validation_error(
+						po::validation_error::invalid_option_value,
+						this->mapping_name,
+						"mapping");
+				throw err;
+			}
+
+			const bool rotation_invariant = this->mapping_name == "riu2";
+			unsigned int next_uniform_label = 0;
+			for(unsigned int c = 0; c < number_of_codes; ++c)
+			{
+				unsigned int transitions = 0, ones = 0;
+				for(unsigned int i = 0; i < P; ++i)
+				{
+					transitions += ((c >> i) & 1) != ((c >> ((i + 1) % P)) & 1);
+					ones += (c >> i) & 1;
+				}
+
+				if(transitions <= 2)
+					this->mapping[c] = rotation_invariant ? ones : next_uniform_label++;
+				else
+					this->mapping[c] = rotation_invariant ? P + 1 : P * (P - 1) + 2;
+			}
+			this->number_of_bins = rotation_invariant ? P + 2 : P * (P - 1) + 3;
+		} else {
+			boost::program_options::validation_error err =
+				po::validation_error(
+					po::validation_error::invalid_option_value,
+					this->mapping_name,
+					"mapping");
+			throw err;
+		}
+	}
+
+	/**
+	 * Compute the mapped pattern of each voxel. The image is processed row by
+	 * row, each neighbor being compared to a whole row at once.
+	 * Borders are handled by replicating the edge voxels.
+	 */
+	template< typename TLabel >
+	void compute_labels(const unsigned char *input, const InputImageType::SizeType &size, TLabel *output) const
+	{
+		const long nx = size[0], ny = size[1], nz = size[2];
+		const unsigned int P = this->neighbors.size();
+
+		std::vector< bool > used_rows(9, false);
+		used_rows[4] = true;
+		for(unsigned int i = 0; i < P; ++i)
+			used_rows[(this->neighbors[i].z + 1) * 3 + this->neighbors[i].y + 1] = true;
+
+		TileScheduler tiles(size, TileScheduler::row_tiles(size, this->tile_voxels));
+
+#pragma omp parallel
+		{
+			// Rows padded by one voxel on each side, indexed by their (y, z) offset
+			std::vector< std::vector< unsigned char > > rows(9, std::vector< unsigned char >(nx + 2));
+			std::vector< unsigned char > codes(nx);
+
+			tiles.run([&](const Tile &tile) {
+				for(long z = tile.begin[2]; z < tile.end[2]; ++z)
+				{
+					for(long y = tile.begin[1]; y < tile.end[1]; ++y)
+					{
+						const long row = z * ny + y;
+
+						for(unsigned int r = 0; r < 9; ++r)
+						{
+							if(!used_rows[r])
+								continue;
+
+							const long dy = static_cast< long >(r % 3) - 1, dz = static_cast< long >(r / 3) - 1;
+							const unsigned char *source = input + (clamp(z + dz, nz) * ny + clamp(y + dy, ny)) * nx;
+							std::copy(source, source + nx, rows[r].begin() + 1);
+							rows[r][0] = source[0];
+							rows[r][nx + 1] = source[nx - 1];
+						}
+
+						std::fill(codes.begin(), codes.end(), 0);
+
+						const unsigned char *center = &rows[4][1];
+						for(unsigned int i = 0; i < P; ++i)
+						{
+							const NeighborOffset &n = this->neighbors[i];
+							compare_row(center, &rows[(n.z + 1) * 3 + n.y + 1][1 + n.x], &codes[0], 1 << i, nx);
+						}
+
+						TLabel *out = output + row * nx;
+						for(long x = 0; x < nx; ++x)
+							out[x] = this->mapping[codes[x]];
+					}
+				}
+			});
+		}
+	}
+
+	/**
+	 * Compute the normalized histograms of the labels in a sliding window.
+	 * Along each row, the histogram is updated by adding the entering column
+	 * of the window and removing the leaving one.
+	 */
+	void compute_histograms(const unsigned char *labels, const InputImageType::SizeType &size, FeatureType *output) const
+	{
+		const long nx = size[0], ny = size[1], nz = size[2];
+		const long rx = this->window[0], ry = this->window[1], rz = this->window[2];
+		const unsigned int bins = this->number_of_bins;
+		const FeatureType normalization = 1.0 / ((2 * rx + 1) * (2 * ry + 1) * (2 * rz + 1));
+
+		TileScheduler tiles(size, TileScheduler::row_tiles(size, this->tile_voxels));
+
+#pragma omp parallel
+		{
+			std::vector< unsigned int > histogram(bins);
+			std::vector< const unsigned char * > column_rows;
+
+			tiles.run([&](const Tile &tile) {
+				for(long z = tile.begin[2]; z < tile.end[2]; ++z)
+				{
+					for(long y = tile.begin[1]; y < tile.end[1]; ++y)
+					{
+						const long row = z * ny + y;
+
+						// The rows covered by the window
+						column_rows.clear();
+						for(long dz = -rz; dz <= rz; ++dz)
+							for(long dy = -ry; dy <= ry; ++dy)
+								column_rows.push_back(labels + (clamp(z + dz, nz) * ny + clamp(y + dy, ny)) * nx);
+
+						std::fill(histogram.begin(), histogram.end(), 0);
+						for(long dx = -rx; dx <= rx; ++dx)
+						{
+							const long cx = clamp(dx, nx);
+							for(unsigned int r = 0; r < column_rows.size(); ++r)
+								++histogram[column_rows[r][cx]];
+						}
+
+						FeatureType *out = output + row * nx * bins;
+						for(long x = 0; x < nx; ++x)
+						{
+							if(x > 0)
+							{
+								const long entering = clamp(x + rx, nx), leaving = clamp(x - rx - 1, nx);
+								for(unsigned int r = 0; r < column_rows.size(); ++r)
+								{
+									++histogram[column_rows[r][entering]];
+									--histogram[column_rows[r][leaving]];
+								}
+							}
+
+							for(unsigned int b = 0; b < bins; ++b)
+								out[x * bins + b] = histogram[b] * normalization;
+						}
+					}
+				}
+			});
+		}
+	}
+};
+
+FEATURES_COMPUTER_PLUGIN(LBP)
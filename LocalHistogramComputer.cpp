@@ -0,0 +1,298 @@
+#include "FeaturesComputer.hpp"
+#include "cli_offset.h"
+
+#include <boost/program_options.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace po = boost::program_options;
+
+typedef OutputImageType::PixelType::ValueType FeatureType;
+
+namespace
+{
+
+const unsigned int number_of_bins = 256;
+
+typedef unsigned int CountType;
+
+inline long clamp(const long v, const long size)
+{
+	return std::min(std::max(v, 0L), size - 1);
+}
+
+inline void add_histogram(CountType *__restrict__ kernel, const CountType *__restrict__ column)
+{
+	for(unsigned int b = 0; b < number_of_bins; ++b)
+		kernel[b] += column[b];
+}
+
+inline void slide_histogram(CountType *__restrict__ kernel, const CountType *__restrict__ entering, const CountType *__restrict__ leaving)
+{
+	for(unsigned int b = 0; b < number_of_bins; ++b)
+		kernel[b] += entering[b] - leaving[b];
+}
+
+/**
+ * Features from a sliding histogram of the window.
+ *
+ * Each column of the window (along y and z) has its own histogram. When the
+ * window moves along y, each column histogram is updated by removing the
+ * leaving voxels and adding the entering ones, and when it moves along x,
+ * the histogram of the window is updated by adding the entering column
+ * histogram and subtracting the leaving one. The cost per voxel therefore
+ * depends on the depth of the window, not on its volume.
+ * Borders are handled by replicating the edge voxels.
+ */
+class LocalHistogramKernel : public NeighborhoodKernel
+{
+public:
+	LocalHistogramKernel(const cli_offset &window, const std::vector< double > &percentiles, const bool entropy) :
+		rx(window[0]), ry(window[1]), rz(window[2]),
+		N((2 * rx + 1) * (2 * ry + 1) * (2 * rz + 1)),
+		number_of_percentiles(percentiles.size()), entropy(entropy),
+		order(percentiles.size()), ranks(percentiles.size())
+	{
+		// Ranks of the percentiles in the sorted window, in increasing order
+		for(unsigned int i = 0; i < this->number_of_percentiles; ++i)
+			this->order[i] = i;
+		std::sort(this->order.begin(), this->order.end(), PercentileLess(percentiles));
+		for(unsigned int i = 0; i < this->number_of_percentiles; ++i)
+			this->ranks[i] = static_cast< CountType >(percentiles[this->order[i]] / 100.0 * (this->N - 1) + 0.5);
+
+		// c * log2(c) for each possible count
+		if(this->entropy)
+		{
+			this->c_log_c.resize(this->N + 1);
+			this->c_log_c[0] = 0;
+			for(CountType c = 1; c <= this->N; ++c)
+				this->c_log_c[c] = c * std::log(static_cast< double >(c)) / std::log(2.0);
+		}
+		this->log_N = std::log(static_cast< double >(this->N)) / std::log(2.0);
+	}
+
+	virtual unsigned int get_number_of_channels() const
+	{
+		return this->number_of_percentiles + (this->entropy ? 1 : 0);
+	}
+
+	// Slabs of whole rows high enough for the initialization of the column
+	// histograms to be amortized
+	virtual unsigned long get_minimum_tile_rows() const
+	{
+		return 8 * (2 * this->ry + 1);
+	}
+
+	virtual Workspace* create_workspace(const InputImageType::SizeType &size) const
+	{
+		return new Histograms(size[0]);
+	}
+
+	virtual void compute(const unsigned char *input, const InputImageType::SizeType &size, const Tile &tile, Workspace *workspace, FeatureType *output, const unsigned int stride) const
+	{
+		const long nx = size[0], ny = size[1], nz = size[2];
+		const long rx = this->rx, ry = this->ry, rz = this->rz;
+		const CountType N = this->N;
+		const unsigned int number_of_percentiles = this->number_of_percentiles;
+
+		std::vector< CountType > &columns = static_cast< Histograms * >(workspace)->columns;
+		std::vector< CountType > &kernel = static_cast< Histograms * >(workspace)->kernel;
+
+		const long z = tile.begin[2];
+		std::fill(columns.begin(), columns.end(), 0);
+
+		for(long y = tile.begin[1]; y < tile.end[1]; ++y)
+		{
+			// Update the column histograms
+			for(long dz = -rz; dz <= rz; ++dz)
+			{
+				const unsigned char *plane = input + clamp(z + dz, nz) * nx * ny;
+
+				if(y == tile.begin[1]) {
+					for(long dy = -ry; dy <= ry; ++dy)
+					{
+						const unsigned char *row = plane + clamp(y + dy, ny) * nx;
+						for(long x = 0; x < nx; ++x)
+							++columns[x * number_of_bins + row[x]];
+					}
+				} else {
+					const unsigned char *entering = plane + clamp(y + ry, ny) * nx;
+					const unsigned char *leaving = plane + clamp(y - ry - 1, ny) * nx;
+					for(long x = 0; x < nx; ++x)
+					{
+						++columns[x * number_of_bins + entering[x]];
+						--columns[x * number_of_bins + leaving[x]];
+					}
+				}
+			}
+
+			std::fill(kernel.begin(), kernel.end(), 0);
+			for(long dx = -rx; dx <= rx; ++dx)
+				add_histogram(&kernel[0], &columns[clamp(dx, nx) * number_of_bins]);
+
+			FeatureType *out = output + (z * ny + y) * nx * stride;
+
+			for(long x = 0; x < nx; ++x)
+			{
+				if(x > 0)
+					slide_histogram(&kernel[0], &columns[clamp(x + rx, nx) * number_of_bins], &columns[clamp(x - rx - 1, nx) * number_of_bins]);
+
+				// All the percentiles in a single scan of the cumulative histogram
+				CountType cumulative = 0;
+				unsigned int bin = 0;
+				for(unsigned int i = 0; i < number_of_percentiles; ++i)
+				{
+					while(cumulative + kernel[bin] <= this->ranks[i])
+						cumulative += kernel[bin++];
+					out[x * stride + this->order[i]] = bin;
+				}
+
+				if(this->entropy)
+				{
+					double sum = 0;
+					for(unsigned int b = 0; b < number_of_bins; ++b)
+						sum += this->c_log_c[kernel[b]];
+					out[x * stride + number_of_percentiles] = this->log_N - sum / N;
+				}
+			}
+		}
+	}
+
+private:
+	// Histograms of the columns of the window along a row, and of the window
+	struct Histograms : public Workspace
+	{
+		Histograms(const long nx) : columns(nx * number_of_bins), kernel(number_of_bins) {}
+		std::vector< CountType > columns;
+		std::vector< CountType > kernel;
+	};
+
+	struct PercentileLess
+	{
+		PercentileLess(const std::vector< double > &percentiles) : percentiles(percentiles) {}
+		bool operator()(const unsigned int a, const unsigned int b) const { return percentiles[a] < percentiles[b]; }
+		const std::vector< double > &percentiles;
+	};
+
+	const long rx, ry, rz;
+	const CountType N;
+	const unsigned int number_of_percentiles;
+	const bool entropy;
+	std::vector< unsigned int > order;
+	std::vector< CountType > ranks;
+	std::vector< double > c_log_c;
+	double log_N;
+};
+
+}
+
+class LocalHistogramComputer : public FeaturesComputer
+{
+private:
+	boost::program_options::options_description options;
+	cli_offset window;
+	std::vector< double > percentiles;
+	bool entropy;
+
+public:
+	LocalHistogramComputer():
+		options("LocalHistogramComputer")
+	{
+		options.add_options()
+			("window,w",
+			 po::value< cli_offset >(&this->window)->required(),
+			 "Window radius (required)")
+			("percentile,p",
+			 po::value< std::vector< double > >(&this->percentiles)->multitoken(),
+			 "Percentiles computed in the window, in [0, 100] (50 for the median)")
+			("entropy,e",
+			 "Computes the entropy of the histogram of the window")
+			;
+	}
+
+	virtual void print_usage(std::ostream &os)
+	{
+		os << this->options;
+	}
+
+	virtual std::vector< std::string > normalize_options(std::vector< std::string > params)
+	{
+		return FeaturesComputer::normalized_options(this->options, params);
+	}
+
+	virtual OutputImageType::Pointer compute( InputImageType::Pointer input_image, std::vector< std::string > params )
+	{
+		boost::scoped_ptr< NeighborhoodKernel > kernel(this->create_kernel(params));
+		OutputImageType::Pointer output_image = NeighborhoodKernel::run(*kernel, input_image, this->tile_voxels);
+
+#ifdef USE_LOG4CXX
+		LOG4CXX_INFO(m_Logger, "Computation of local histogram features done.");
+#endif
+
+		return output_image;
+	}
+
+	virtual NeighborhoodKernel* create_kernel(const std::vector< std::string > &params)
+	{
+		this->parse(params);
+
+		return new LocalHistogramKernel(this->window, this->percentiles, this->entropy);
+	}
+
+	FeaturesEstimate estimate(const std::vector< std::string > &params, const InputImageType::SizeType &size)
+	{
+		this->parse(params);
+
+		const double number_of_pixels = static_cast< double >(size[0]) * size[1] * size[2];
+
+		FeaturesEstimate estimate;
+		estimate.channels = this->percentiles.size() + (this->entropy ? 1 : 0);
+		for(unsigned int i = 0; i < InputImageType::ImageDimension; ++i)
+			estimate.halo[i] = this->window[i];
+		// Output and column histograms (of one thread)
+		estimate.bytes = number_of_pixels * estimate.channels * sizeof(FeatureType)
+			+ static_cast< double >(size[0]) * number_of_bins * sizeof(CountType);
+		// Column updates, sliding of the window histogram and scans of the histogram
+		estimate.cost = number_of_pixels * (2.0 * (2 * this->window[2] + 1) + 2 * number_of_bins + (this->entropy ? number_of_bins : 0) + number_of_bins / 2);
+		estimate.tileable = true;
+
+		return estimate;
+	}
+
+private:
+	void parse(const std::vector< std::string > &params)
+	{
+		po::variables_map vm;
+
+		this->percentiles.clear();
+
+		po::store(po::command_line_parser(params).options(this->options).run(), vm);
+		vm.notify();
+
+		this->entropy = vm.count("entropy") > 0;
+
+		if(this->percentiles.empty() && !this->entropy)
+			this->percentiles.push_back(50);
+
+		std::vector< double >::const_iterator it;
+		for(it = this->percentiles.begin(); it != this->percentiles.end(); ++it)
+		{
+			if((*it < 0) || (*it > 100))
+			{
+				boost::program_options::validation_error err =
+					po::validation_error(
+						po::validation_error::invalid_option_value,
+						boost::lexical_cast< std::string >(*it),
+						"percentile");
+				throw err;
+			}
+		}
+	}
+};
+
+FEATURES_COMPUTER_PLUGIN(LocalHistogram)
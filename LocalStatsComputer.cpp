@@ -0,0 +1,432 @@
+#include "FeaturesComputer.hpp"
+
+#include <boost/program_options.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace po = boost::program_options;
+
+typedef OutputImageType::PixelType::ValueType FeatureType;
+
+namespace
+{
+
+enum Statistic { Mean, Variance, Skewness, Kurtosis, Minimum, Maximum };
+
+// Width of the blocks of columns processed by each thread when summing along y
+const long column_block_size = 64;
+
+inline long clamp(const long v, const long size)
+{
+	return std::min(std::max(v, 0L), size - 1);
+}
+
+/**
+ * Sliding minimum (or maximum) of a line, in a window clipped to the line,
+ * using a monotonic deque of candidate positions.
+ */
+template< typename TCompare >
+void sliding_extremum(const unsigned char *input, unsigned char *output, const long stride, const long size, const long radius, std::deque< long > &candidates, TCompare better)
+{
+	candidates.clear();
+
+	long next = 0;
+	for(long i = 0; i < size; ++i)
+	{
+		// Push the positions entering the window
+		for( ; next <= std::min(i + radius, size - 1); ++next)
+		{
+			while(!candidates.empty() && !better(input[candidates.back() * stride], input[next * stride]))
+				candidates.pop_back();
+			candidates.push_back(next);
+		}
+
+		// Pop the positions leaving the window
+		while(candidates.front() < i - radius)
+			candidates.pop_front();
+
+		output[i * stride] = input[candidates.front() * stride];
+	}
+}
+
+}
+
+class LocalStatsComputer : public FeaturesComputer
+{
+private:
+	boost::program_options::options_description options;
+	unsigned int radius;
+	std::vector< std::string > statistics_names;
+	std::vector< Statistic > statistics;
+
+	// Powers (1 to 4) of the intensities
+	double powers[4][256];
+
+public:
+	LocalStatsComputer():
+		options("LocalStatsComputer")
+	{
+		std::vector< std::string > default_statistics;
+		default_statistics.push_back("mean");
+		default_statistics.push_back("variance");
+		default_statistics.push_back("skewness");
+		default_statistics.push_back("kurtosis");
+		default_statistics.push_back("min");
+		default_statistics.push_back("max");
+
+		options.add_options()
+			("radius,r",
+			 po::value< unsigned int >(&this->radius)->default_value(2),
+			 "Radius of the window")
+			("statistics,s",
+			 po::value< std::vector< std::string > >(&this->statistics_names)->multitoken()->default_value(default_statistics, "mean variance skewness kurtosis min max"),
+			 "Statistics computed in the window, one channel each: mean, variance, skewness, kurtosis (excess kurtosis), min, max")
+			;
+
+		for(unsigned int v = 0; v < 256; ++v)
+		{
+			this->powers[0][v] = v;
+			for(unsigned int k = 1; k < 4; ++k)
+				this->powers[k][v] = this->powers[k - 1][v] * v;
+		}
+	}
+
+	virtual void print_usage(std::ostream &os)
+	{
+		os << this->options;
+	}
+
+	virtual std::vector< std::string > normalize_options(std::vector< std::string > params)
+	{
+		return FeaturesComputer::normalized_options(this->options, params);
+	}
+
+	virtual OutputImageType::Pointer compute( InputImageType::Pointer input_image, std::vector< std::string > params )
+	{
+		unsigned int number_of_powers;
+		bool extrema;
+		this->parse(params, number_of_powers, extrema);
+
+		const InputImageType::SizeType size = input_image->GetBufferedRegion().GetSize();
+		const unsigned int number_of_channels = this->statistics.size();
+
+		OutputImageType::Pointer output_image = OutputImageType::New();
+		output_image->CopyInformation(input_image);
+		output_image->SetRegions( input_image->GetBufferedRegion() );
+		output_image->SetVectorLength(number_of_channels);
+		output_image->Allocate();
+
+		const size_t number_of_pixels = size[0] * size[1] * size[2];
+
+		BufferPool::Buffer minimum, maximum;
+		if(extrema)
+		{
+			minimum = this->scratch< unsigned char >(number_of_pixels);
+			maximum = this->scratch< unsigned char >(number_of_pixels);
+
+			BufferPool::Buffer tmp = this->scratch< unsigned char >(number_of_pixels);
+			this->compute_extremum(input_image->GetBufferPointer(), size, minimum.get< unsigned char >(), tmp.get< unsigned char >(), std::less< unsigned char >());
+			this->compute_extremum(input_image->GetBufferPointer(), size, maximum.get< unsigned char >(), tmp.get< unsigned char >(), std::greater< unsigned char >());
+		}
+
+		this->compute_statistics(input_image->GetBufferPointer(), size, number_of_powers, minimum.get< unsigned char >(), maximum.get< unsigned char >(), output_image->GetBufferPointer());
+
+#ifdef USE_LOG4CXX
+		LOG4CXX_INFO(m_Logger, "Computation of local statistics done.");
+#endif
+
+		return output_image;
+	}
+
+	FeaturesEstimate estimate(const std::vector< std::string > &params, const InputImageType::SizeType &size)
+	{
+		unsigned int number_of_powers;
+		bool extrema;
+		this->parse(params, number_of_powers, extrema);
+
+		const double plane_size = static_cast< double >(size[0]) * size[1];
+		const double number_of_pixels = plane_size * size[2];
+
+		FeaturesEstimate estimate;
+		estimate.channels = this->statistics.size();
+		estimate.halo.Fill(this->radius);
+		// Output, extrema and their temporary, ring of the summed planes, rows and window sums
+		estimate.bytes = number_of_pixels * estimate.channels * sizeof(FeatureType)
+			+ (extrema ? 3 * number_of_pixels : 0)
+			+ (2.0 * this->radius + 4) * number_of_powers * plane_size * sizeof(double);
+		estimate.cost = number_of_pixels * (6.0 * number_of_powers + (extrema ? 12 : 0) + estimate.channels);
+		estimate.tileable = true;
+
+		return estimate;
+	}
+
+private:
+	/**
+	 * Parse and check the options.
+	 * @param[out] number_of_powers The number of powers of the intensities to sum.
+	 * @param[out] extrema Whether the minimum or the maximum are needed.
+	 */
+	void parse(const std::vector< std::string > &params, unsigned int &number_of_powers, bool &extrema)
+	{
+		po::variables_map vm;
+
+		po::store(po::command_line_parser(params).options(this->options).run(), vm);
+		vm.notify();
+
+		this->statistics.clear();
+		number_of_powers = 0;
+		extrema = false;
+
+		std::vector< std::string >::const_iterator it;
+		for(it = this->statistics_names.begin(); it != this->statistics_names.end(); ++it)
+		{
+			if(*it == "mean") {
+				this->statistics.push_back(Mean);
+				number_of_powers = std::max(number_of_powers, 1u);
+			} else if(*it == "variance") {
+				this->statistics.push_back(Variance);
+				number_of_powers = std::max(number_of_powers, 2u);
+			} else if(*it == "skewness") {
+				this->statistics.push_back(Skewness);
+				number_of_powers = std::max(number_of_powers, 3u);
+			} else if(*it == "kurtosis") {
+				this->statistics.push_back(Kurtosis);
+				number_of_powers = std::max(number_of_powers, 4u);
+			} else if(*it == "min") {
+				this->statistics.push_back(Minimum);
+				extrema = true;
+			} else if(*it == "max") {
+				this->statistics.push_back(Maximum);
+				extrema = true;
+			} else {
+				boost::program_options::validation_error err =
+					po::validation_error(
+						po::validation_error::invalid_option_value,
+						*it,
+						"statistics");
+				throw err;
+			}
+		}
+	}
+
+	/**
+	 * Sliding minimum or maximum, computed separably along x, y and z.
+	 * @param[out] tmp A buffer of the size of the image.
+	 */
+	template< typename TCompare >
+	void compute_extremum(const unsigned char *input, const InputImageType::SizeType &size, unsigned char *output, unsigned char *tmp, TCompare better) const
+	{
+		const long nx = size[0], ny = size[1], nz = size[2];
+		const long r = this->radius;
+
+		// Lines along x in whole rows, lines along y and z in blocks of columns
+		InputImageType::SizeType y_lines = size, z_lines = size;
+		y_lines[0] = column_block_size;
+		y_lines[2] = 1;
+		z_lines[0] = column_block_size;
+		z_lines[1] = std::max< long >(this->tile_voxels / (column_block_size * nz), 1);
+
+		TileScheduler x_tiles(size, TileScheduler::row_tiles(size, this->tile_voxels)), y_tiles(size, y_lines), z_tiles(size, z_lines);
+
+#pragma omp parallel
+		{
+			std::deque< long > candidates;
+
+			x_tiles.run([&](const Tile &tile) {
+				for(long z = tile.begin[2]; z < tile.end[2]; ++z)
+					for(long y = tile.begin[1]; y < tile.end[1]; ++y)
+					{
+						const long line = z * ny + y;
+						sliding_extremum(input + line * nx, output + line * nx, 1, nx, r, candidates, better);
+					}
+			});
+
+			y_tiles.run([&](const Tile &tile) {
+				for(long x = tile.begin[0]; x < tile.end[0]; ++x)
+				{
+					const long offset = tile.begin[2] * nx * ny + x;
+					sliding_extremum(output + offset, tmp + offset, nx, ny, r, candidates, better);
+				}
+			});
+
+			z_tiles.run([&](const Tile &tile) {
+				for(long y = tile.begin[1]; y < tile.end[1]; ++y)
+					for(long x = tile.begin[0]; x < tile.end[0]; ++x)
+						sliding_extremum(tmp + y * nx + x, output + y * nx + x, nx * ny, nz, r, candidates, better);
+			});
+		}
+	}
+
+	/**
+	 * Box sums of the powers of the intensities over a plane (clamped at the borders).
+	 * @param[out] sums The sums of each power, one plane after the other.
+	 */
+	void sum_plane(const unsigned char *plane, const long nx, const long ny, const unsigned int number_of_powers, double *rows, double *sums) const
+	{
+		const long r = this->radius;
+		const long plane_size = nx * ny;
+
+		InputImageType::SizeType plane_size_3d;
+		plane_size_3d[0] = nx;
+		plane_size_3d[1] = ny;
+		plane_size_3d[2] = 1;
+
+		// Sums along x
+		TileScheduler::parallel_for(plane_size_3d, TileScheduler::row_tiles(plane_size_3d, this->tile_voxels), [&](const Tile &tile) {
+			for(long y = tile.begin[1]; y < tile.end[1]; ++y)
+			{
+				const unsigned char *in = plane + y * nx;
+
+				for(unsigned int k = 0; k < number_of_powers; ++k)
+				{
+					double *out = &rows[k * plane_size + y * nx];
+
+					const double *power = this->powers[k];
+
+					double s = 0;
+					for(long dx = -r; dx <= r; ++dx)
+						s += power[in[clamp(dx, nx)]];
+					out[0] = s;
+
+					for(long x = 1; x < nx; ++x)
+					{
+						s += power[in[clamp(x + r, nx)]] - power[in[clamp(x - r - 1, nx)]];
+						out[x] = s;
+					}
+				}
+			}
+		});
+
+		// Sums along y, each tile sliding a block of columns
+		InputImageType::SizeType column_block = plane_size_3d;
+		column_block[0] = column_block_size;
+
+		TileScheduler::parallel_for(plane_size_3d, column_block, [&](const Tile &tile) {
+			const long x0 = tile.begin[0], x1 = tile.end[0];
+
+			for(unsigned int k = 0; k < number_of_powers; ++k)
+			{
+				const double *in = &rows[k * plane_size];
+				double *out = sums + k * plane_size;
+
+				for(long x = x0; x < x1; ++x)
+				{
+					double s = 0;
+					for(long dy = -r; dy <= r; ++dy)
+						s += in[clamp(dy, ny) * nx + x];
+					out[x] = s;
+				}
+
+				for(long y = 1; y < ny; ++y)
+					for(long x = x0; x < x1; ++x)
+						out[y * nx + x] = out[(y - 1) * nx + x] + in[clamp(y + r, ny) * nx + x] - in[clamp(y - r - 1, ny) * nx + x];
+			}
+		});
+	}
+
+	/**
+	 * Compute the statistics of each window. The sums of the powers of the
+	 * intensities are computed by sliding the window along each axis: each
+	 * plane is summed along x and y, and the window sums are updated along z
+	 * by adding the entering plane and removing the leaving one.
+	 * The sums are exact, as they are sums of integers below 2^53.
+	 */
+	void compute_statistics(const unsigned char *input, const InputImageType::SizeType &size, const unsigned int number_of_powers, const unsigned char *minimum, const unsigned char *maximum, FeatureType *output) const
+	{
+		const long nx = size[0], ny = size[1], nz = size[2];
+		const long r = this->radius;
+		const long plane_size = nx * ny;
+		const unsigned int number_of_channels = this->statistics.size();
+		const double N = std::pow(2.0 * r + 1, 3);
+
+		// Ring of the summed planes (the leaving and the entering planes are at most 2r + 1 apart)
+		const long ring_size = 2 * r + 2;
+		BufferPool::Buffer ring_buffer = this->scratch< double >(ring_size * number_of_powers * plane_size);
+		BufferPool::Buffer rows_buffer = this->scratch< double >(number_of_powers * plane_size);
+		BufferPool::Buffer window_buffer = this->scratch< double >(number_of_powers * plane_size);
+		double *ring = ring_buffer.get< double >(), *rows = rows_buffer.get< double >(), *window = window_buffer.get< double >();
+		std::vector< long > ring_planes(ring_size, -1);
+		std::fill(window, window + number_of_powers * plane_size, 0.0);
+
+		for(long z = 0; z < nz; ++z)
+		{
+			if(number_of_powers > 0)
+			{
+				// Sum the planes needed by this slice
+				for(long dz = (z == 0 ? -r : r); dz <= r; ++dz)
+				{
+					const long q = clamp(z + dz, nz);
+					double *slot = &ring[(q % ring_size) * number_of_powers * plane_size];
+					if(ring_planes[q % ring_size] != q)
+					{
+						this->sum_plane(input + q * plane_size, nx, ny, number_of_powers, rows, slot);
+						ring_planes[q % ring_size] = q;
+					}
+				}
+
+				const long entering = clamp(z + r, nz), leaving = clamp(z - r - 1, nz);
+				const double *entering_sums = &ring[(entering % ring_size) * number_of_powers * plane_size];
+				const double *leaving_sums = &ring[(leaving % ring_size) * number_of_powers * plane_size];
+
+				if(z == 0)
+				{
+					for(long dz = -r; dz <= r; ++dz)
+					{
+						const double *sums = &ring[(clamp(dz, nz) % ring_size) * number_of_powers * plane_size];
+
+#pragma omp parallel for
+						for(long i = 0; i < number_of_powers * plane_size; ++i)
+							window[i] += sums[i];
+					}
+				} else {
+#pragma omp parallel for
+					for(long i = 0; i < number_of_powers * plane_size; ++i)
+						window[i] += entering_sums[i] - leaving_sums[i];
+				}
+			}
+
+			FeatureType *out = output + z * plane_size * number_of_channels;
+
+#pragma omp parallel for
+			for(long i = 0; i < plane_size; ++i)
+			{
+				double m = 0, variance = 0, mu3 = 0, mu4 = 0;
+				if(number_of_powers > 0)
+				{
+					const double m1 = window[i] / N;
+					const double m2 = number_of_powers > 1 ? window[plane_size + i] / N : 0;
+					const double m3 = number_of_powers > 2 ? window[2 * plane_size + i] / N : 0;
+					const double m4 = number_of_powers > 3 ? window[3 * plane_size + i] / N : 0;
+
+					m = m1;
+					variance = std::max(m2 - m * m, 0.0);
+					mu3 = m3 - 3 * m * m2 + 2 * m * m * m;
+					mu4 = m4 - 4 * m * m3 + 6 * m * m * m2 - 3 * m * m * m * m;
+				}
+
+				for(unsigned int c = 0; c < number_of_channels; ++c)
+				{
+					FeatureType value = 0;
+					switch(this->statistics[c])
+					{
+						case Mean: value = m; break;
+						case Variance: value = variance; break;
+						case Skewness: value = variance > 0 ? mu3 / std::pow(variance, 1.5) : 0; break;
+						case Kurtosis: value = variance > 0 ? mu4 / (variance * variance) - 3 : 0; break;
+						case Minimum: value = minimum[z * plane_size + i]; break;
+						case Maximum: value = maximum[z * plane_size + i]; break;
+					}
+					out[i * number_of_channels + c] = value;
+				}
+			}
+		}
+	}
+};
+
+FEATURES_COMPUTER_PLUGIN(LocalStats)
@@ -1,19 +1,98 @@
 #include "FeaturesComputer.hpp"
 
-#include <itkMeanImageFilter.h>
-#include <itkDivideImageFilter.h>
-#include <itkComposeImageFilter.h>
-
 #include <boost/program_options.hpp>
+#include <boost/scoped_ptr.hpp>
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <string>
+#include <vector>
 
 namespace po = boost::program_options;
 
-typedef typename itk::Image< typename OutputImageType::PixelType::ValueType, 3 > FloatingPointImageType;
-typedef typename itk::DivideImageFilter< FloatingPointImageType, FloatingPointImageType, FloatingPointImageType > RescaleImageFilterType;
-typedef typename itk::ComposeImageFilter< FloatingPointImageType, OutputImageType > ComposeVectorImageFilterType;
+typedef OutputImageType::PixelType::ValueType FeatureType;
+
+namespace
+{
+
+inline long clamp(const long v, const long size)
+{
+	return std::min(std::max(v, 0L), size - 1);
+}
+
+/**
+ * Mean of the cubic window of each voxel (borders replicate the edge
+ * voxels, as the ITK mean filter does). For each row, the rows of the
+ * window are summed column by column, then the window slides along x.
+ */
+class MeanValueKernel : public NeighborhoodKernel
+{
+public:
+	MeanValueKernel(const unsigned int radius, const bool normalization) :
+		radius(radius)
+	{
+		const double N = std::pow(2.0 * radius + 1, 3);
+		this->scale = normalization ? 1.0 / (N * 255.0) : 1.0 / N;
+	}
+
+	virtual unsigned int get_number_of_channels() const
+	{
+		return 1;
+	}
+
+	virtual Workspace* create_workspace(const InputImageType::SizeType &size) const
+	{
+		return new Columns(size[0]);
+	}
+
+	virtual void compute(const unsigned char *input, const InputImageType::SizeType &size, const Tile &tile, Workspace *workspace, FeatureType *output, const unsigned int stride) const
+	{
+		const long nx = size[0], ny = size[1], nz = size[2];
+		const long r = this->radius;
+		std::vector< unsigned long > &columns = static_cast< Columns * >(workspace)->sums;
+
+		for(long z = tile.begin[2]; z < tile.end[2]; ++z)
+		{
+			for(long y = tile.begin[1]; y < tile.end[1]; ++y)
+			{
+				std::fill(columns.begin(), columns.end(), 0);
+				for(long dz = -r; dz <= r; ++dz)
+					for(long dy = -r; dy <= r; ++dy)
+					{
+						const unsigned char *row = input + (clamp(z + dz, nz) * ny + clamp(y + dy, ny)) * nx;
+						for(long x = 0; x < nx; ++x)
+							columns[x] += row[x];
+					}
+
+				unsigned long sum = 0;
+				for(long dx = -r; dx <= r; ++dx)
+					sum += columns[clamp(dx, nx)];
+
+				FeatureType *out = output + (z * ny + y) * nx * stride;
+				for(long x = 0; x < nx; ++x)
+				{
+					if(x > 0)
+						sum += columns[clamp(x + r, nx)] - columns[clamp(x - r - 1, nx)];
+					out[x * stride] = sum * this->scale;
+				}
+			}
+		}
+	}
+
+private:
+	// Sums of the rows of the window, column by column
+	struct Columns : public Workspace
+	{
+		Columns(const long nx) : sums(nx) {}
+		std::vector< unsigned long > sums;
+	};
+
+	const long radius;
+	double scale;
+};
+
+}
 
 class MeanValueComputer : public FeaturesComputer
 {
@@ -40,48 +119,58 @@ public:
 		os << this->options;
 	}
 
-	virtual OutputImageType::Pointer compute( InputImageType::Pointer input_image, std::vector< std::string > params )
+	virtual std::vector< std::string > normalize_options(std::vector< std::string > params)
 	{
-		po::variables_map vm;
-
-		po::store(po::command_line_parser(params).options(this->options).run(), vm);
-		vm.notify();
+		return FeaturesComputer::normalized_options(this->options, params);
+	}
 
-		this->normalization = vm.count("normalize") > 0;
+	virtual OutputImageType::Pointer compute( InputImageType::Pointer input_image, std::vector< std::string > params )
+	{
+		boost::scoped_ptr< NeighborhoodKernel > kernel(this->create_kernel(params));
+		OutputImageType::Pointer output_image = NeighborhoodKernel::run(*kernel, input_image, this->tile_voxels);
 
-		typedef itk::MeanImageFilter< InputImageType, FloatingPointImageType >  MeanFilterType;
+#ifdef USE_LOG4CXX
+		LOG4CXX_INFO(m_Logger, "Computation of mean values done.");
+#endif
 
-		MeanFilterType::Pointer meanFilter = MeanFilterType::New();
+		return output_image;
+	}
 
-		meanFilter->SetInput(input_image);
+	virtual NeighborhoodKernel* create_kernel(const std::vector< std::string > &params)
+	{
+		this->parse(params);
 
-		InputImageType::SizeType indexRadius;
-		indexRadius.Fill(this->radius);
-		meanFilter->SetRadius( indexRadius );
+		return new MeanValueKernel(this->radius, this->normalization);
+	}
 
-		meanFilter->Update();
+	FeaturesEstimate estimate(const std::vector< std::string > &params, const InputImageType::SizeType &size)
+	{
+		this->parse(params);
 
-		FloatingPointImageType::Pointer fp_output_image = meanFilter->GetOutput();
+		const double number_of_pixels = static_cast< double >(size[0]) * size[1] * size[2];
 
-		if(this->normalization) {
-			RescaleImageFilterType::Pointer rescaler = RescaleImageFilterType::New();
-			rescaler->SetInput(meanFilter->GetOutput());
-			rescaler->SetConstant(255.0);
-			rescaler->Update();
+		FeaturesEstimate estimate;
+		estimate.channels = 1;
+		estimate.halo.Fill(this->radius);
+		// The output, and a row of window sums per thread
+		estimate.bytes = number_of_pixels * sizeof(FeatureType);
+		estimate.cost = number_of_pixels * (std::pow(2.0 * this->radius + 1, 2) + 2);
+		estimate.tileable = true;
 
-			fp_output_image = rescaler->GetOutput();
-		}
+		return estimate;
+	}
 
-		ComposeVectorImageFilterType::Pointer vectorComposer = ComposeVectorImageFilterType::New();
-		vectorComposer->SetInput(0, fp_output_image);
+private:
+	void parse(const std::vector< std::string > &params)
+	{
+		po::variables_map vm;
 
-		vectorComposer->Update();
+		po::store(po::command_line_parser(params).options(this->options).run(), vm);
+		vm.notify();
 
-		return vectorComposer->GetOutput();
+		this->normalization = vm.count("normalize") > 0;
 	}
 };
 
-extern "C" FeaturesComputer* create() {
-	return new MeanValueComputer;
-}
+FEATURES_COMPUTER_PLUGIN(MeanValue)
 
@@ -0,0 +1,412 @@
+#include "FeaturesComputer.hpp"
+#include "posterization.h"
+#include "cli_offset.h"
+#include "texture_matrix.h"
+
+#include <boost/program_options.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace po = boost::program_options;
+
+typedef OutputImageType::PixelType::ValueType FeatureType;
+
+namespace
+{
+
+const unsigned int number_of_features = SizeMatrixFeatures::number_of_features;
+
+struct Direction
+{
+	long x, y, z;
+};
+
+/**
+ * Box of the voxels of a window, clipped to the image: [x0, x1] along x...
+ */
+struct Box
+{
+	long x0, x1, y0, y1, z0, z1;
+
+	inline bool contains(const long x, const long y, const long z) const
+	{
+		return (x >= x0) && (x <= x1) && (y >= y0) && (y <= y1) && (z >= z0) && (z <= z1);
+	}
+};
+
+/**
+ * Gray level run length matrix of a window, counting the runs of all the
+ * directions together.
+ */
+class GLRLM
+{
+public:
+	GLRLM(const unsigned int levels, const unsigned int max_length) :
+		max_length(max_length), counts(levels * (max_length + 1), 0), accumulator(levels, max_length)
+	{
+	}
+
+	void clear()
+	{
+		std::fill(this->counts.begin(), this->counts.end(), 0);
+	}
+
+	inline void add(const unsigned char level, const long length)
+	{
+		++this->counts[level * (this->max_length + 1) + length];
+	}
+
+	inline void remove(const unsigned char level, const long length)
+	{
+		--this->counts[level * (this->max_length + 1) + length];
+	}
+
+	void features(FeatureType *output)
+	{
+		this->accumulator.clear();
+
+		const unsigned int levels = this->counts.size() / (this->max_length + 1);
+		const boost::uint32_t *row = &this->counts[0];
+		for(unsigned int i = 0; i < levels; ++i, row += this->max_length + 1)
+			for(unsigned int j = 1; j <= this->max_length; ++j)
+				if(row[j] != 0)
+					this->accumulator.add(i, j, row[j]);
+
+		this->accumulator.features(output);
+	}
+
+private:
+	const unsigned int max_length;
+	std::vector< boost::uint32_t > counts;
+	SizeMatrixFeatures accumulator;
+};
+
+/**
+ * Features of the run length matrix of the window around each voxel, windows
+ * being clipped to the image (the runs being cut by their borders). Along
+ * each row, the matrix is updated as the window slides: the runs lying in
+ * the leaving column are removed and the ones lying in the entering column
+ * added, the runs crossing the columns are shortened or extended. The voxels
+ * are posterized as they are read, through the lookup table of the image.
+ */
+class RunLengthKernel : public NeighborhoodKernel
+{
+public:
+	RunLengthKernel(const unsigned int levels, const cli_offset &window, const std::vector< Direction > &directions, const unsigned int max_length) :
+		levels(levels), rx(window[0]), ry(window[1]), rz(window[2]), max_length(max_length)
+	{
+		// The directions have a null or positive x component
+		std::vector< Direction >::const_iterator d;
+		for(d = directions.begin(); d != directions.end(); ++d)
+			(d->x == 0 ? this->along : this->across).push_back(*d);
+	}
+
+	virtual unsigned int get_number_of_channels() const
+	{
+		return number_of_features;
+	}
+
+	virtual void prepare(const InputImageType *image)
+	{
+		this->posterization.Build(image, this->levels);
+	}
+
+	virtual Workspace* create_workspace(const InputImageType::SizeType &size) const
+	{
+		return new Matrix(this->levels, this->max_length);
+	}
+
+	virtual void compute(const unsigned char *input, const InputImageType::SizeType &size, const Tile &tile, Workspace *workspace, FeatureType *output, const unsigned int stride) const
+	{
+		const long nx = size[0], ny = size[1], nz = size[2];
+		const long rx = this->rx, ry = this->ry, rz = this->rz;
+		GLRLM &glrlm = static_cast< Matrix * >(workspace)->glrlm;
+
+		for(long z = tile.begin[2]; z < tile.end[2]; ++z)
+		{
+			for(long y = tile.begin[1]; y < tile.end[1]; ++y)
+			{
+				Box box;
+				box.y0 = std::max(y - ry, 0L); box.y1 = std::min(y + ry, ny - 1);
+				box.z0 = std::max(z - rz, 0L); box.z1 = std::min(z + rz, nz - 1);
+				box.x0 = 0;
+
+				glrlm.clear();
+				for(long x = 0; x <= std::min(rx, nx - 1); ++x)
+				{
+					box.x1 = x - 1;
+					this->enter_column(glrlm, input, nx, ny, x, box, this->across);
+					box.x1 = x;
+					this->update_column_runs< true >(glrlm, input, nx, ny, x, box, this->along);
+				}
+
+				FeatureType *out = output + (z * ny + y) * nx * stride;
+
+				for(long x = 0; x < nx; ++x)
+				{
+					if(x > 0)
+					{
+						if(x - rx - 1 >= 0)
+						{
+							this->leave_column(glrlm, input, nx, ny, x - rx - 1, box, this->across);
+							this->update_column_runs< false >(glrlm, input, nx, ny, x - rx - 1, box, this->along);
+							box.x0 = x - rx;
+						}
+
+						if(x + rx < nx)
+						{
+							this->enter_column(glrlm, input, nx, ny, x + rx, box, this->across);
+							box.x1 = x + rx;
+							this->update_column_runs< true >(glrlm, input, nx, ny, x + rx, box, this->along);
+						}
+					}
+
+					glrlm.features(out + x * stride);
+				}
+			}
+		}
+	}
+
+private:
+	struct Matrix : public Workspace
+	{
+		Matrix(const unsigned int levels, const unsigned int max_length) : glrlm(levels, max_length) {}
+		GLRLM glrlm;
+	};
+
+	/**
+	 * Posterized level of a voxel.
+	 */
+	inline unsigned char level(const unsigned char *input, const long nx, const long ny, const long x, const long y, const long z) const
+	{
+		return this->posterization.Get(input[(z * ny + y) * nx + x]);
+	}
+
+	/**
+	 * Length of the run of a voxel along a direction (or against it), from
+	 * the voxel on, within a box.
+	 */
+	inline long follow_run(const unsigned char *input, const long nx, const long ny, long x, long y, long z, const long dx, const long dy, const long dz, const Box &box) const
+	{
+		const unsigned char run_level = this->level(input, nx, ny, x, y, z);
+
+		long length = 1;
+		for(x += dx, y += dy, z += dz; box.contains(x, y, z) && (this->level(input, nx, ny, x, y, z) == run_level); x += dx, y += dy, z += dz)
+			++length;
+
+		return length;
+	}
+
+	/**
+	 * Add (or remove) the runs lying in a column (x) of a window, along the
+	 * directions without x component.
+	 */
+	template< bool Add >
+	void update_column_runs(GLRLM &glrlm, const unsigned char *input, const long nx, const long ny, const long x, const Box &box, const std::vector< Direction > &along) const
+	{
+		for(long z = box.z0; z <= box.z1; ++z)
+		{
+			for(long y = box.y0; y <= box.y1; ++y)
+			{
+				const unsigned char a = this->level(input, nx, ny, x, y, z);
+
+				std::vector< Direction >::const_iterator d;
+				for(d = along.begin(); d != along.end(); ++d)
+				{
+					// Each run is counted from its first voxel
+					if(box.contains(x, y - d->y, z - d->z) && (this->level(input, nx, ny, x, y - d->y, z - d->z) == a))
+						continue;
+
+					const long length = this->follow_run(input, nx, ny, x, y, z, 0, d->y, d->z, box);
+					if(Add) glrlm.add(a, length); else glrlm.remove(a, length);
+				}
+			}
+		}
+	}
+
+	/**
+	 * Update the runs crossing the columns when a column enters the window on
+	 * the right (box.x1 being the column before): each voxel of the column
+	 * extends the run of the previous voxel, or starts a run.
+	 */
+	void enter_column(GLRLM &glrlm, const unsigned char *input, const long nx, const long ny, const long x, const Box &box, const std::vector< Direction > &across) const
+	{
+		for(long z = box.z0; z <= box.z1; ++z)
+		{
+			for(long y = box.y0; y <= box.y1; ++y)
+			{
+				const unsigned char a = this->level(input, nx, ny, x, y, z);
+
+				std::vector< Direction >::const_iterator d;
+				for(d = across.begin(); d != across.end(); ++d)
+				{
+					const long px = x - 1, py = y - d->y, pz = z - d->z;
+					if(box.contains(px, py, pz) && (this->level(input, nx, ny, px, py, pz) == a)) {
+						const long length = this->follow_run(input, nx, ny, px, py, pz, -1, -d->y, -d->z, box);
+						glrlm.remove(a, length);
+						glrlm.add(a, length + 1);
+					} else {
+						glrlm.add(a, 1);
+					}
+				}
+			}
+		}
+	}
+
+	/**
+	 * Update the runs crossing the columns when the column box.x0 leaves the
+	 * window: each voxel of the column starts a run, which gets shorter.
+	 */
+	void leave_column(GLRLM &glrlm, const unsigned char *input, const long nx, const long ny, const long x, const Box &box, const std::vector< Direction > &across) const
+	{
+		for(long z = box.z0; z <= box.z1; ++z)
+		{
+			for(long y = box.y0; y <= box.y1; ++y)
+			{
+				const unsigned char a = this->level(input, nx, ny, x, y, z);
+
+				std::vector< Direction >::const_iterator d;
+				for(d = across.begin(); d != across.end(); ++d)
+				{
+					const long length = this->follow_run(input, nx, ny, x, y, z, 1, d->y, d->z, box);
+					glrlm.remove(a, length);
+					if(length > 1)
+						glrlm.add(a, length - 1);
+				}
+			}
+		}
+	}
+
+	const unsigned int levels;
+	const long rx, ry, rz;
+	const unsigned int max_length;
+	std::vector< Direction > along, across;
+	PosterizationAccessor posterization;
+};
+
+}
+
+class RunLengthComputer : public FeaturesComputer
+{
+private:
+	boost::program_options::options_description options;
+	unsigned int posterization_level;
+	cli_offset window;
+	std::string directions;
+
+public:
+	RunLengthComputer():
+		options("RunLengthComputer")
+	{
+		options.add_options()
+			("posterization,p",
+				po::value< unsigned int >(&this->posterization_level)->required(), "Posterization level (required)")
+			("window,w",
+				po::value< cli_offset >(&this->window)->required(), "Window radius (required)")
+			("directions,d",
+				po::value< std::string >(&this->directions)->default_value("3d13"), "Directions of the runs: 3d13 (the 13 directions of the 26-neighborhood) or 2d4 (the 4 directions of the 8-neighborhood)")
+			;
+	}
+
+	virtual void print_usage(std::ostream &os)
+	{
+		os << this->options;
+	}
+
+	virtual std::vector< std::string > normalize_options(std::vector< std::string > params)
+	{
+		return FeaturesComputer::normalized_options(this->options, params);
+	}
+
+	virtual OutputImageType::Pointer compute( InputImageType::Pointer input_image, std::vector< std::string > params )
+	{
+		boost::scoped_ptr< NeighborhoodKernel > kernel(this->create_kernel(params));
+		OutputImageType::Pointer output_image = NeighborhoodKernel::run(*kernel, input_image, this->tile_voxels);
+
+#ifdef USE_LOG4CXX
+		LOG4CXX_INFO(m_Logger, "Computation of run length features done.");
+#endif
+
+		return output_image;
+	}
+
+	virtual NeighborhoodKernel* create_kernel(const std::vector< std::string > &params)
+	{
+		const std::vector< Direction > directions = this->parse(params);
+
+		return new RunLengthKernel(this->posterization_level, this->window, directions, this->max_length());
+	}
+
+	FeaturesEstimate estimate(const std::vector< std::string > &params, const InputImageType::SizeType &size)
+	{
+		const std::vector< Direction > directions = this->parse(params);
+
+		const double number_of_pixels = static_cast< double >(size[0]) * size[1] * size[2];
+
+		FeaturesEstimate estimate;
+		estimate.channels = number_of_features;
+		for(unsigned int i = 0; i < InputImageType::ImageDimension; ++i)
+			estimate.halo[i] = this->window[i];
+		estimate.bytes = number_of_pixels * number_of_features * sizeof(FeatureType);
+		// Runs of the columns entering and leaving the window (their length
+		// being found by following them), and features of the matrix
+		estimate.cost = number_of_pixels * (2.0 * (2 * this->window[1] + 1) * (2 * this->window[2] + 1) * directions.size() * (this->window[0] + 1)
+			+ 2.0 * this->posterization_level * this->max_length());
+		// The posterization depends on the intensity range of the whole image
+		estimate.tileable = false;
+
+		return estimate;
+	}
+
+private:
+	/**
+	 * Parse and check the options.
+	 * @return The directions of the runs.
+	 */
+	std::vector< Direction > parse(const std::vector< std::string > &params)
+	{
+		po::variables_map vm;
+
+		po::store(po::command_line_parser(params).options(this->options).run(), vm);
+		vm.notify();
+
+		if((this->posterization_level < 1) || (this->posterization_level > 256))
+			throw po::validation_error(po::validation_error::invalid_option_value, boost::lexical_cast< std::string >(this->posterization_level), "posterization");
+
+		const long (*preset)[3];
+		unsigned int preset_size;
+		if(this->directions == "3d13") {
+			preset = directions_3d13;
+			preset_size = 13;
+		} else if(this->directions == "2d4") {
+			preset = directions_2d4;
+			preset_size = 4;
+		} else {
+			throw po::validation_error(po::validation_error::invalid_option_value, this->directions, "directions");
+		}
+
+		std::vector< Direction > directions;
+		for(unsigned int i = 0; i < preset_size; ++i)
+		{
+			Direction direction = { preset[i][0], preset[i][1], preset[i][2] };
+			directions.push_back(direction);
+		}
+
+		return directions;
+	}
+
+	/**
+	 * Longest run of a window.
+	 */
+	unsigned int max_length() const
+	{
+		return 2 * std::max(this->window[0], std::max(this->window[1], this->window[2])) + 1;
+	}
+};
+
+FEATURES_COMPUTER_PLUGIN(RunLength)
@@ -0,0 +1,276 @@
+#include "FeaturesComputer.hpp"
+#include "posterization.h"
+#include "cli_offset.h"
+#include "texture_matrix.h"
+
+#include <boost/program_options.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace po = boost::program_options;
+
+typedef OutputImageType::PixelType::ValueType FeatureType;
+
+namespace
+{
+
+const unsigned int number_of_features = SizeMatrixFeatures::number_of_features;
+
+/**
+ * Zones of a window: the connected components (26-connectivity) of its voxels
+ * of the same gray level, labeled with a union-find pass over the window.
+ */
+class ZoneLabeling
+{
+public:
+	ZoneLabeling(const unsigned int levels, const unsigned long max_voxels) :
+		voxel_levels(max_voxels), parents(max_voxels), sizes(max_voxels), accumulator(levels, max_voxels)
+	{
+		// The 13 neighbors preceding a voxel in the window
+		unsigned int n = 0;
+		for(long k = -1; k <= 0; ++k)
+			for(long j = -1; j <= 1; ++j)
+				for(long i = -1; i <= 1; ++i)
+					if((k < 0) || (j < 0) || ((j == 0) && (i < 0)))
+					{
+						this->neighbors[n][0] = i;
+						this->neighbors[n][1] = j;
+						this->neighbors[n][2] = k;
+						++n;
+					}
+	}
+
+	/**
+	 * Compute the features of the size zone matrix of the window [x0, x1] ×
+	 * [y0, y1] × [z0, z1] of an image, posterized as it is read.
+	 */
+	void features(const unsigned char *input, const PosterizationAccessor &posterization, const long nx, const long ny, const long x0, const long x1, const long y0, const long y1, const long z0, const long z1, FeatureType *output)
+	{
+		const long wx = x1 - x0 + 1, wy = y1 - y0 + 1, wz = z1 - z0 + 1;
+		const unsigned long n = wx * wy * wz;
+
+		unsigned char *voxel_levels = &this->voxel_levels[0];
+		unsigned int *parents = &this->parents[0];
+		unsigned int *sizes = &this->sizes[0];
+
+		unsigned int v = 0;
+		for(long k = 0; k < wz; ++k)
+		{
+			for(long j = 0; j < wy; ++j)
+			{
+				const unsigned char *row = input + ((z0 + k) * ny + y0 + j) * nx + x0;
+				for(long i = 0; i < wx; ++i, ++v)
+				{
+					voxel_levels[v] = posterization.Get(row[i]);
+					parents[v] = v;
+
+					for(unsigned int neighbor = 0; neighbor < 13; ++neighbor)
+					{
+						const long ni = i + this->neighbors[neighbor][0], nj = j + this->neighbors[neighbor][1], nk = k + this->neighbors[neighbor][2];
+						if((ni < 0) || (ni >= wx) || (nj < 0) || (nj >= wy) || (nk < 0))
+							continue;
+
+						const unsigned int u = (nk * wy + nj) * wx + ni;
+						if(voxel_levels[u] == voxel_levels[v])
+							unite(parents, u, v);
+					}
+				}
+			}
+		}
+
+		std::fill(sizes, sizes + n, 0);
+		for(v = 0; v < n; ++v)
+			++sizes[find(parents, v)];
+
+		// The roots stand for their zones
+		this->accumulator.clear();
+		for(v = 0; v < n; ++v)
+			if(parents[v] == v)
+				this->accumulator.add(voxel_levels[v], sizes[v], 1);
+
+		this->accumulator.features(output);
+	}
+
+private:
+	static inline unsigned int find(unsigned int *parents, unsigned int v)
+	{
+		// Path halving
+		while(parents[v] != v)
+		{
+			parents[v] = parents[parents[v]];
+			v = parents[v];
+		}
+		return v;
+	}
+
+	static inline void unite(unsigned int *parents, const unsigned int u, const unsigned int v)
+	{
+		const unsigned int ru = find(parents, u), rv = find(parents, v);
+		if(ru < rv)
+			parents[rv] = ru;
+		else if(rv < ru)
+			parents[ru] = rv;
+	}
+
+	long neighbors[13][3];
+	std::vector< unsigned char > voxel_levels;  // The posterized level of each voxel of the window
+	std::vector< unsigned int > parents, sizes;
+	SizeMatrixFeatures accumulator;
+};
+
+/**
+ * Features of the size zone matrix of the window around each voxel, windows
+ * being clipped to the image (the zones being cut by their borders). The
+ * zones of each window are labeled anew.
+ */
+class SizeZoneKernel : public NeighborhoodKernel
+{
+public:
+	SizeZoneKernel(const unsigned int levels, const cli_offset &window) :
+		levels(levels), rx(window[0]), ry(window[1]), rz(window[2])
+	{
+	}
+
+	virtual unsigned int get_number_of_channels() const
+	{
+		return number_of_features;
+	}
+
+	virtual void prepare(const InputImageType *image)
+	{
+		this->posterization.Build(image, this->levels);
+	}
+
+	virtual Workspace* create_workspace(const InputImageType::SizeType &size) const
+	{
+		return new Zones(this->levels, (2 * this->rx + 1) * (2 * this->ry + 1) * (2 * this->rz + 1));
+	}
+
+	virtual void compute(const unsigned char *input, const InputImageType::SizeType &size, const Tile &tile, Workspace *workspace, FeatureType *output, const unsigned int stride) const
+	{
+		const long nx = size[0], ny = size[1], nz = size[2];
+		const long rx = this->rx, ry = this->ry, rz = this->rz;
+		ZoneLabeling &zones = static_cast< Zones * >(workspace)->zones;
+
+		for(long z = tile.begin[2]; z < tile.end[2]; ++z)
+		{
+			for(long y = tile.begin[1]; y < tile.end[1]; ++y)
+			{
+				const long y0 = std::max(y - ry, 0L), y1 = std::min(y + ry, ny - 1);
+				const long z0 = std::max(z - rz, 0L), z1 = std::min(z + rz, nz - 1);
+
+				FeatureType *out = output + (z * ny + y) * nx * stride;
+
+				for(long x = 0; x < nx; ++x)
+					zones.features(input, this->posterization, nx, ny, std::max(x - rx, 0L), std::min(x + rx, nx - 1), y0, y1, z0, z1, out + x * stride);
+			}
+		}
+	}
+
+private:
+	struct Zones : public Workspace
+	{
+		Zones(const unsigned int levels, const unsigned long max_voxels) : zones(levels, max_voxels) {}
+		ZoneLabeling zones;
+	};
+
+	const unsigned int levels;
+	const long rx, ry, rz;
+	PosterizationAccessor posterization;
+};
+
+}
+
+class SizeZoneComputer : public FeaturesComputer
+{
+private:
+	boost::program_options::options_description options;
+	unsigned int posterization_level;
+	cli_offset window;
+
+public:
+	SizeZoneComputer():
+		options("SizeZoneComputer")
+	{
+		options.add_options()
+			("posterization,p",
+				po::value< unsigned int >(&this->posterization_level)->required(), "Posterization level (required)")
+			("window,w",
+				po::value< cli_offset >(&this->window)->required(), "Window radius (required)")
+			;
+	}
+
+	virtual void print_usage(std::ostream &os)
+	{
+		os << this->options;
+	}
+
+	virtual std::vector< std::string > normalize_options(std::vector< std::string > params)
+	{
+		return FeaturesComputer::normalized_options(this->options, params);
+	}
+
+	virtual OutputImageType::Pointer compute( InputImageType::Pointer input_image, std::vector< std::string > params )
+	{
+		boost::scoped_ptr< NeighborhoodKernel > kernel(this->create_kernel(params));
+		OutputImageType::Pointer output_image = NeighborhoodKernel::run(*kernel, input_image, this->tile_voxels);
+
+#ifdef USE_LOG4CXX
+		LOG4CXX_INFO(m_Logger, "Computation of size zone features done.");
+#endif
+
+		return output_image;
+	}
+
+	virtual NeighborhoodKernel* create_kernel(const std::vector< std::string > &params)
+	{
+		this->parse(params);
+
+		return new SizeZoneKernel(this->posterization_level, this->window);
+	}
+
+	FeaturesEstimate estimate(const std::vector< std::string > &params, const InputImageType::SizeType &size)
+	{
+		this->parse(params);
+
+		const double number_of_pixels = static_cast< double >(size[0]) * size[1] * size[2];
+
+		FeaturesEstimate estimate;
+		estimate.channels = number_of_features;
+		for(unsigned int i = 0; i < InputImageType::ImageDimension; ++i)
+			estimate.halo[i] = this->window[i];
+		estimate.bytes = number_of_pixels * number_of_features * sizeof(FeatureType);
+		// Labeling of each window, with its 13 preceding neighbors per voxel
+		estimate.cost = number_of_pixels * this->window_voxels() * 16.0;
+		// The posterization depends on the intensity range of the whole image
+		estimate.tileable = false;
+
+		return estimate;
+	}
+
+private:
+	/**
+	 * Parse and check the options.
+	 */
+	void parse(const std::vector< std::string > &params)
+	{
+		po::variables_map vm;
+
+		po::store(po::command_line_parser(params).options(this->options).run(), vm);
+		vm.notify();
+
+		if((this->posterization_level < 1) || (this->posterization_level > 256))
+			throw po::validation_error(po::validation_error::invalid_option_value, boost::lexical_cast< std::string >(this->posterization_level), "posterization");
+	}
+
+	unsigned long window_voxels() const
+	{
+		return (2UL * this->window[0] + 1) * (2UL * this->window[1] + 1) * (2UL * this->window[2] + 1);
+	}
+};
+
+FEATURES_COMPUTER_PLUGIN(SizeZone)
@@ -0,0 +1,125 @@
+#include "async_writer.h"
+
+AsyncWriter::AsyncWriter(const size_t max_pending_size) :
+	max_pending_size(max_pending_size),
+	pending_size(0),
+	stopping(false),
+	running_job(false)
+{
+	this->thread = std::thread(&AsyncWriter::run, this);
+}
+
+AsyncWriter::~AsyncWriter()
+{
+	{
+		std::unique_lock< std::mutex > lock(this->mutex);
+		this->stopping = true;
+	}
+	this->job_available.notify_one();
+	this->thread.join();
+
+	while(!this->jobs.empty())
+	{
+		delete this->jobs.front();
+		this->jobs.pop_front();
+	}
+}
+
+void AsyncWriter::submit(Job *job)
+{
+	std::unique_lock< std::mutex > lock(this->mutex);
+
+	while((this->pending_size > 0) && (this->pending_size + job->size() > this->max_pending_size) && !this->error)
+		this->job_done.wait(lock);
+
+	if(this->error)
+	{
+		delete job;
+		this->rethrow();
+	}
+
+	this->pending_size += job->size();
+	this->jobs.push_back(job);
+
+	lock.unlock();
+	this->job_available.notify_one();
+}
+
+void AsyncWriter::finish()
+{
+	std::unique_lock< std::mutex > lock(this->mutex);
+
+	while((!this->jobs.empty() || this->running_job) && !this->error)
+		this->job_done.wait(lock);
+
+	this->rethrow();
+}
+
+void AsyncWriter::rethrow()
+{
+	if(this->error)
+	{
+		std::exception_ptr error = this->error;
+		this->error = std::exception_ptr();
+		std::rethrow_exception(error);
+	}
+}
+
+void AsyncWriter::run()
+{
+	std::unique_lock< std::mutex > lock(this->mutex);
+
+	for(;;)
+	{
+		while(this->jobs.empty() && !this->stopping)
+			this->job_available.wait(lock);
+
+		// Once stopping, remaining jobs are dropped by the destructor
+		if(this->stopping)
+			return;
+
+		Job *job = this->jobs.front();
+		this->jobs.pop_front();
+		this->running_job = true;
+
+		lock.unlock();
+
+		std::exception_ptr job_error;
+		try {
+			job->run();
+		} catch(...) {
+			job_error = std::current_exception();
+		}
+
+		// Freed without the lock (the job may hold the last reference to a
+		// large image), not to block submit() meanwhile
+		const size_t job_size = job->size();
+		delete job;
+
+		lock.lock();
+
+		this->pending_size -= job_size;
+		this->running_job = false;
+
+		std::deque< Job* > dropped;
+		if(job_error)
+		{
+			this->error = job_error;
+
+			// Jobs queued after a failed one are not run
+			dropped.swap(this->jobs);
+			for(std::deque< Job* >::const_iterator it = dropped.begin(); it != dropped.end(); ++it)
+				this->pending_size -= (*it)->size();
+		}
+
+		this->job_done.notify_all();
+
+		if(!dropped.empty())
+		{
+			lock.unlock();
+			for(std::deque< Job* >::const_iterator it = dropped.begin(); it != dropped.end(); ++it)
+				delete *it;
+			lock.lock();
+		}
+	}
+}
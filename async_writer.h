@@ -0,0 +1,78 @@
+#ifndef ASYNC_WRITER_H
+#define ASYNC_WRITER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+/**
+ * Runs output jobs (writing images to disk) on a dedicated thread, so that
+ * they overlap with the computation of the next features.
+ *
+ * The total size of the pending jobs is bounded: submitting a job blocks
+ * until the jobs already queued fit in the limit (a job larger than the limit
+ * is accepted once the queue is empty).
+ */
+class AsyncWriter
+{
+public:
+	class Job
+	{
+	public:
+		virtual ~Job() {}
+
+		virtual void run() = 0;
+
+		/**
+		 * Memory held by the job until it is run, in bytes.
+		 */
+		virtual size_t size() const = 0;
+	};
+
+	/**
+	 * @param[in] max_pending_size The maximum size of the pending jobs, in bytes.
+	 */
+	AsyncWriter(const size_t max_pending_size);
+
+	/**
+	 * Stop the writer: the running job is completed, the queued ones are dropped.
+	 */
+	~AsyncWriter();
+
+	/**
+	 * Queue a job (the writer takes its ownership).
+	 * Rethrows the error of a previous job, if any.
+	 */
+	void submit(Job *job);
+
+	/**
+	 * Wait for all the submitted jobs to be done.
+	 * Rethrows the error of a job, if any.
+	 */
+	void finish();
+
+private:
+	AsyncWriter(const AsyncWriter &); //purposely not implemented
+	void operator=(const AsyncWriter &); //purposely not implemented
+
+	void run();
+
+	void rethrow();
+
+	const size_t max_pending_size;
+	size_t pending_size;
+	bool stopping;
+	bool running_job;
+	std::deque< Job* > jobs;
+	std::exception_ptr error;
+
+	std::mutex mutex;
+	std::condition_variable job_available;
+	std::condition_variable job_done;
+	std::thread thread;
+};
+
+#endif /* ASYNC_WRITER_H */
@@ -0,0 +1,211 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <new>
+
+/**
+ * Pool of the large scratch buffers of the computers (posterized copies,
+ * labels, intermediate volumes...).
+ *
+ * A released buffer is kept, and given again to the next request of the same
+ * size (or slightly smaller), so that the computers run one after the other,
+ * or on one image after the other, do not allocate and fault in fresh
+ * multi-gigabyte buffers each time. The buffers are not initialized.
+ *
+ * The size of the released buffers kept may be bounded: past it, the largest
+ * ones are freed first.
+ */
+class BufferPool
+{
+public:
+	/**
+	 * A buffer taken from a pool, given back when destroyed. A buffer without
+	 * a pool is simply freed.
+	 */
+	class Buffer
+	{
+	public:
+		Buffer() : pool(NULL), data(NULL), size(0) {}
+
+		Buffer(Buffer &&other) : pool(other.pool), data(other.data), size(other.size)
+		{
+			other.data = NULL;
+		}
+
+		Buffer& operator=(Buffer &&other)
+		{
+			if(this != &other)
+			{
+				this->release();
+				this->pool = other.pool;
+				this->data = other.data;
+				this->size = other.size;
+				other.data = NULL;
+			}
+			return *this;
+		}
+
+		~Buffer()
+		{
+			this->release();
+		}
+
+		template< typename T >
+		T* get() const
+		{
+			return static_cast< T* >(this->data);
+		}
+
+		size_t get_size() const
+		{
+			return this->size;
+		}
+
+	private:
+		friend class BufferPool;
+
+		Buffer(BufferPool *pool, void *data, const size_t size) : pool(pool), data(data), size(size) {}
+
+		Buffer(const Buffer &); //purposely not implemented
+		void operator=(const Buffer &); //purposely not implemented
+
+		void release()
+		{
+			if(!this->data)
+				return;
+
+			if(this->pool)
+				this->pool->give_back(this->data, this->size);
+			else
+				std::free(this->data);
+
+			this->data = NULL;
+		}
+
+		BufferPool *pool;
+		void *data;
+		size_t size;
+	};
+
+	/**
+	 * @param[in] max_cached_size The maximum size of the released buffers kept, in bytes (0: unlimited).
+	 */
+	BufferPool(const size_t max_cached_size = 0) : cached_size(0), max_cached_size(max_cached_size) {}
+
+	~BufferPool()
+	{
+		this->trim();
+	}
+
+	/**
+	 * Take a buffer of at least size bytes from the pool, allocating it if no
+	 * released buffer fits.
+	 */
+	Buffer acquire(const size_t size)
+	{
+		{
+			std::lock_guard< std::mutex > lock(this->mutex);
+
+			// The smallest released buffer that fits, unless it wastes more than a quarter of itself
+			std::multimap< size_t, void* >::iterator it = this->released.lower_bound(size);
+			if((it != this->released.end()) && (size >= it->first - it->first / 4))
+			{
+				Buffer buffer(this, it->second, it->first);
+				this->cached_size -= it->first;
+				this->released.erase(it);
+				return buffer;
+			}
+		}
+
+		return Buffer(this, BufferPool::allocate(size), size);
+	}
+
+	/**
+	 * Allocate a buffer outside of any pool (freed when destroyed).
+	 */
+	static Buffer unpooled(const size_t size)
+	{
+		return Buffer(NULL, BufferPool::allocate(size), size);
+	}
+
+	/**
+	 * Free the released buffers.
+	 */
+	void trim()
+	{
+		std::lock_guard< std::mutex > lock(this->mutex);
+
+		std::multimap< size_t, void* >::const_iterator it;
+		for(it = this->released.begin(); it != this->released.end(); ++it)
+			std::free(it->second);
+
+		this->released.clear();
+		this->cached_size = 0;
+	}
+
+	/**
+	 * Bound the size of the released buffers kept (0: unlimited), freeing the
+	 * largest ones past it.
+	 */
+	void set_max_cached_size(const size_t max_cached_size)
+	{
+		std::lock_guard< std::mutex > lock(this->mutex);
+		this->max_cached_size = max_cached_size;
+		this->evict();
+	}
+
+	/**
+	 * Size of the released buffers kept by the pool, in bytes.
+	 */
+	size_t get_cached_size()
+	{
+		std::lock_guard< std::mutex > lock(this->mutex);
+		return this->cached_size;
+	}
+
+private:
+	BufferPool(const BufferPool &); //purposely not implemented
+	void operator=(const BufferPool &); //purposely not implemented
+
+	static void* allocate(const size_t size)
+	{
+		// Aligned on cache lines
+		void *data = NULL;
+		if(posix_memalign(&data, 64, size > 0 ? size : 1) != 0)
+			throw std::bad_alloc();
+		return data;
+	}
+
+	void give_back(void *data, const size_t size)
+	{
+		std::lock_guard< std::mutex > lock(this->mutex);
+		this->released.insert(std::make_pair(size, data));
+		this->cached_size += size;
+		this->evict();
+	}
+
+	/**
+	 * Free the largest released buffers until the cached size fits (the mutex being held).
+	 */
+	void evict()
+	{
+		while((this->max_cached_size > 0) && (this->cached_size > this->max_cached_size))
+		{
+			std::multimap< size_t, void* >::iterator largest = --this->released.end();
+			std::free(largest->second);
+			this->cached_size -= largest->first;
+			this->released.erase(largest);
+		}
+	}
+
+	std::multimap< size_t, void* > released;
+	size_t cached_size;
+	size_t max_cached_size;
+	std::mutex mutex;
+};
+
+#endif /* BUFFER_POOL_H */
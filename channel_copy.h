@@ -0,0 +1,253 @@
+#ifndef CHANNEL_COPY_H
+#define CHANNEL_COPY_H
+
+#include "datatypes.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
+/**
+ * Block-wise copies of channels between buffers whose channels are
+ * interleaved (the channels of a voxel are contiguous), used to interleave
+ * images into a vector image, and to deinterleave or gather some of its
+ * channels.
+ *
+ * The channels are copied by runs of consecutive channels. Runs of 1, 2, 3, 4
+ * and 8 channels have their own kernels (with SSE2 for the floats), the other
+ * runs are copied voxel by voxel. The runs of 1 and 3 channels gathered into
+ * a buffer holding only them (deinterleaving a channel, or a 3-channel image)
+ * are transposed by blocks of 4 voxels with shuffles, into whole vectors;
+ * written to the voxels of a larger image, they are stored voxel by voxel
+ * (SSE2 has no scatter).
+ */
+namespace channel_copy
+{
+
+/**
+ * A source channel and the destination channel receiving it.
+ */
+typedef std::pair< unsigned int, unsigned int > ChannelPair;
+
+/**
+ * Copy Width consecutive channels of n voxels.
+ */
+template< unsigned int Width, typename TSource, typename TDestination >
+struct Run
+{
+	static inline void copy(const TSource *__restrict__ source, const size_t source_stride, TDestination *__restrict__ destination, const size_t destination_stride, const size_t n)
+	{
+		for(size_t p = 0; p < n; ++p, source += source_stride, destination += destination_stride)
+			for(unsigned int c = 0; c < Width; ++c)
+				destination[c] = static_cast< TDestination >(source[c]);
+	}
+};
+
+#ifdef __SSE2__
+/**
+ * Load the 3 floats at p (the last lane is 0), without reading past them.
+ */
+inline __m128 load3(const float *p)
+{
+	return _mm_movelh_ps(_mm_loadl_pi(_mm_setzero_ps(), reinterpret_cast< const __m64 * >(p)), _mm_load_ss(p + 2));
+}
+
+/**
+ * Store the first 3 lanes at p, without writing past them.
+ */
+inline void store3(float *p, const __m128 v)
+{
+	_mm_storel_pi(reinterpret_cast< __m64 * >(p), v);
+	_mm_store_ss(p + 2, _mm_movehl_ps(v, v));
+}
+
+template<>
+struct Run< 1, float, float >
+{
+	static inline void copy(const float *__restrict__ source, const size_t source_stride, float *__restrict__ destination, const size_t destination_stride, const size_t n)
+	{
+		size_t p = 0;
+		if(destination_stride == 1)
+		{
+			// 4 voxels of the source gathered in a vector
+			for(; p + 4 <= n; p += 4, source += 4 * source_stride, destination += 4)
+			{
+				const __m128 low = _mm_unpacklo_ps(_mm_load_ss(source), _mm_load_ss(source + source_stride));
+				const __m128 high = _mm_unpacklo_ps(_mm_load_ss(source + 2 * source_stride), _mm_load_ss(source + 3 * source_stride));
+				_mm_storeu_ps(destination, _mm_movelh_ps(low, high));
+			}
+		}
+
+		for(; p < n; ++p, source += source_stride, destination += destination_stride)
+			*destination = *source;
+	}
+};
+
+template<>
+struct Run< 2, float, float >
+{
+	static inline void copy(const float *__restrict__ source, const size_t source_stride, float *__restrict__ destination, const size_t destination_stride, const size_t n)
+	{
+		for(size_t p = 0; p < n; ++p, source += source_stride, destination += destination_stride)
+			_mm_storel_pi(reinterpret_cast< __m64 * >(destination), _mm_loadl_pi(_mm_setzero_ps(), reinterpret_cast< const __m64 * >(source)));
+	}
+};
+
+template<>
+struct Run< 3, float, float >
+{
+	static inline void copy(const float *__restrict__ source, const size_t source_stride, float *__restrict__ destination, const size_t destination_stride, const size_t n)
+	{
+		size_t p = 0;
+		if(destination_stride == 3)
+		{
+			// 4 voxels (a, b, c, d) of the source packed in 3 vectors: a0 a1 a2 b0, b1 b2 c0 c1, c2 d0 d1 d2
+			for(; p + 4 <= n; p += 4, source += 4 * source_stride, destination += 12)
+			{
+				const __m128 a = load3(source), b = load3(source + source_stride);
+				const __m128 c = load3(source + 2 * source_stride), d = load3(source + 3 * source_stride);
+
+				const __m128 a2b0 = _mm_shuffle_ps(b, a, _MM_SHUFFLE(2, 2, 0, 0));
+				const __m128 c2d0 = _mm_shuffle_ps(c, d, _MM_SHUFFLE(0, 0, 2, 2));
+				_mm_storeu_ps(destination, _mm_shuffle_ps(a, a2b0, _MM_SHUFFLE(0, 2, 1, 0)));
+				_mm_storeu_ps(destination + 4, _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 0, 2, 1)));
+				_mm_storeu_ps(destination + 8, _mm_shuffle_ps(c2d0, d, _MM_SHUFFLE(2, 1, 2, 0)));
+			}
+		}
+
+		for(; p < n; ++p, source += source_stride, destination += destination_stride)
+			store3(destination, load3(source));
+	}
+};
+
+template<>
+struct Run< 4, float, float >
+{
+	static inline void copy(const float *__restrict__ source, const size_t source_stride, float *__restrict__ destination, const size_t destination_stride, const size_t n)
+	{
+		for(size_t p = 0; p < n; ++p, source += source_stride, destination += destination_stride)
+			_mm_storeu_ps(destination, _mm_loadu_ps(source));
+	}
+};
+
+template<>
+struct Run< 8, float, float >
+{
+	static inline void copy(const float *__restrict__ source, const size_t source_stride, float *__restrict__ destination, const size_t destination_stride, const size_t n)
+	{
+		for(size_t p = 0; p < n; ++p, source += source_stride, destination += destination_stride)
+		{
+			const __m128 low = _mm_loadu_ps(source), high = _mm_loadu_ps(source + 4);
+			_mm_storeu_ps(destination, low);
+			_mm_storeu_ps(destination + 4, high);
+		}
+	}
+};
+#endif
+
+/**
+ * Copy a run of consecutive channels of n voxels.
+ * @param[in] source The first channel of the run in the first source voxel.
+ * @param[in] source_stride The number of channels of the source.
+ * @param[out] destination The channel receiving the run in the first destination voxel.
+ * @param[in] destination_stride The number of channels of the destination.
+ * @param[in] width The number of channels of the run.
+ */
+template< typename TSource, typename TDestination >
+inline void copy_run(const TSource *source, const size_t source_stride, TDestination *destination, const size_t destination_stride, const unsigned int width, const size_t n)
+{
+	// Whole voxels, contiguous on both sides
+	if((source_stride == width) && (destination_stride == width))
+	{
+		std::copy(source, source + n * width, destination);
+		return;
+	}
+
+	switch(width)
+	{
+		case 1: Run< 1, TSource, TDestination >::copy(source, source_stride, destination, destination_stride, n); break;
+		case 2: Run< 2, TSource, TDestination >::copy(source, source_stride, destination, destination_stride, n); break;
+		case 3: Run< 3, TSource, TDestination >::copy(source, source_stride, destination, destination_stride, n); break;
+		case 4: Run< 4, TSource, TDestination >::copy(source, source_stride, destination, destination_stride, n); break;
+		case 8: Run< 8, TSource, TDestination >::copy(source, source_stride, destination, destination_stride, n); break;
+		default:
+			for(size_t p = 0; p < n; ++p)
+				std::copy(source + p * source_stride, source + p * source_stride + width, destination + p * destination_stride);
+	}
+}
+
+/**
+ * Group channel pairs into runs of consecutive channels (on both sides).
+ * @return The first pair and the width of each run.
+ */
+inline std::vector< std::pair< ChannelPair, unsigned int > > runs(const std::vector< ChannelPair > &channels)
+{
+	std::vector< std::pair< ChannelPair, unsigned int > > runs;
+
+	std::vector< ChannelPair >::const_iterator it;
+	for(it = channels.begin(); it != channels.end(); ++it)
+	{
+		if(!runs.empty()
+			&& (it->first == runs.back().first.first + runs.back().second)
+			&& (it->second == runs.back().first.second + runs.back().second))
+			++runs.back().second;
+		else
+			runs.push_back(std::make_pair(*it, 1u));
+	}
+
+	return runs;
+}
+
+/**
+ * Copy some channels of n voxels, by blocks of voxels: the source voxels of a
+ * block are still in the cache when the next runs read them.
+ * @param[in] channels The channels to copy, as (source channel, destination channel) pairs.
+ */
+template< typename TSource, typename TDestination >
+inline void gather(const TSource *source, const unsigned int source_channels, const std::vector< ChannelPair > &channels, TDestination *destination, const unsigned int destination_channels, const size_t n)
+{
+	static const size_t block_size = 1024;
+
+	const std::vector< std::pair< ChannelPair, unsigned int > > channel_runs = runs(channels);
+
+	for(size_t first = 0; first < n; first += block_size)
+	{
+		const size_t block = std::min(block_size, n - first);
+
+		std::vector< std::pair< ChannelPair, unsigned int > >::const_iterator run;
+		for(run = channel_runs.begin(); run != channel_runs.end(); ++run)
+			copy_run(source + first * source_channels + run->first.first, source_channels,
+				destination + first * destination_channels + run->first.second, destination_channels,
+				run->second, block);
+	}
+}
+
+/**
+ * Copy some channels of a vector image into another one of the same size,
+ * plane by plane in parallel.
+ */
+inline void gather(const OutputImageType *source, const std::vector< ChannelPair > &channels, OutputImageType *destination)
+{
+	const unsigned int source_channels = source->GetNumberOfComponentsPerPixel();
+	const unsigned int destination_channels = destination->GetNumberOfComponentsPerPixel();
+	const OutputImageType::SizeType size = destination->GetBufferedRegion().GetSize();
+	const long plane_size = size[0] * size[1];
+	const long nz = size[2];
+
+	const OutputImageType::InternalPixelType *input = source->GetBufferPointer();
+	OutputImageType::InternalPixelType *output = destination->GetBufferPointer();
+
+#pragma omp parallel for
+	for(long z = 0; z < nz; ++z)
+		gather(input + z * plane_size * source_channels, source_channels, channels,
+			output + z * plane_size * destination_channels, destination_channels, plane_size);
+}
+
+}
+
+#endif /* CHANNEL_COPY_H */
@@ -6,6 +6,7 @@
 #endif
 
 #include <boost/program_options.hpp>
+#include <boost/scoped_ptr.hpp>
 
 #include <iostream>
 #include <sstream>
@@ -14,20 +15,18 @@
 #include <algorithm>
 
 #include "itkImageFileReader.h"
-#include "itkImageFileWriter.h"
-#include "itkVectorImageToImageAdaptor.h"
-#include "itkComposeImageFilter.h"
 
 #include "datatypes.h"
 
 #include "image_loader.h"
+#include "feature_set.h"
+#include "image_writer.h"
+#include "npy_writer.h"
+#include "channel_copy.h"
 
 namespace po = boost::program_options;
 
 typedef itk::ImageFileReader< OutputImageType > ImageReader;
-typedef itk::ImageFileWriter< OutputImageType > ImageWriter;
-typedef itk::VectorImageToImageAdaptor< typename OutputImageType::PixelType::ValueType, OutputImageType::ImageDimension > SingleChannelAdaptor;
-typedef itk::ComposeImageFilter< SingleChannelAdaptor, OutputImageType > ChannelComposer;
 
 std::ostream &operator<<(std::ostream &out, std::vector< int >& t)
 {
@@ -63,6 +62,10 @@ int main(int argc, char** argv)
 	std::string output_image_path;
 	std::vector< int > channels_to_keep;
 	std::vector< int > channels_to_remove;
+	bool compress;
+	std::string mask_path;
+	unsigned long long sample;
+	unsigned int seed;
 
 	po::options_description main_options("Main options");
 
@@ -81,6 +84,18 @@ int main(int argc, char** argv)
 		("remove,r",
 			po::value< std::vector< int > >(&channels_to_remove)->multitoken(),
 			"Channels to remove (1-based)")
+		("compress",
+			po::bool_switch(&compress),
+			"Compress the output image")
+		("mask",
+			po::value< std::string >(&mask_path),
+			"Only write the voxels where this image is not zero (.npy output only)")
+		("sample",
+			po::value< unsigned long long >(&sample)->default_value(0),
+			"Only write a random sample of this number of voxels (.npy output only, default: 0, all the voxels)")
+		("seed",
+			po::value< unsigned int >(&seed)->default_value(0),
+			"Seed of the random sample of voxels")
 		;
 
 	po::variables_map vm;
@@ -101,6 +116,9 @@ int main(int argc, char** argv)
 		}
 
 		vm.notify();
+
+		if((!mask_path.empty() || (sample > 0)) && !NpyWriter::is_npy(output_image_path))
+			throw po::error("--mask and --sample need a NumPy (.npy) output");
 	} catch(po::error &err) {
 #ifdef USE_LOG4CXX
 		LOG4CXX_FATAL(logger, err.what());
@@ -113,15 +131,37 @@ int main(int argc, char** argv)
 	LOG4CXX_INFO(logger, "Output image: " << output_image_path);
 #endif
 
+	// Feature sets are not read now, in order to only read the parts holding the kept channels
+	boost::scoped_ptr< FeatureSet > input_set;
 	ImageReader::Pointer reader = ImageReader::New();
-	reader->SetFileName(input_image_path);
-	try {
-		reader->Update();
-	} catch ( itk::ExceptionObject & err ) {
+	unsigned int number_of_channels;
+
+	if(FeatureSet::is_feature_set(input_image_path)) {
+		try {
+			if(!boost::filesystem::exists(input_image_path))
+				throw FeatureSetException("The feature set located at \"" + input_image_path + "\" does not exists");
+
+			input_set.reset(new FeatureSet(input_image_path, true));
+		} catch ( FeatureSetException & err ) {
 #ifdef USE_LOG4CXX
-		LOG4CXX_FATAL(logger, "The image located at \"" << input_image_path << "\" is not readable");
+			LOG4CXX_FATAL(logger, err.what());
 #endif
-		return -1;
+			return -1;
+		}
+
+		number_of_channels = input_set->get_number_of_channels();
+	} else {
+		reader->SetFileName(input_image_path);
+		try {
+			reader->Update();
+		} catch ( itk::ExceptionObject & err ) {
+#ifdef USE_LOG4CXX
+			LOG4CXX_FATAL(logger, "The image located at \"" << input_image_path << "\" is not readable");
+#endif
+			return -1;
+		}
+
+		number_of_channels = reader->GetOutput()->GetNumberOfComponentsPerPixel();
 	}
 
 	if(channels_to_keep.empty() == channels_to_remove.empty()) { // XOR trick
@@ -139,7 +179,7 @@ int main(int argc, char** argv)
 		LOG4CXX_INFO(logger, "Channels to remove: " << list.str());
 #endif
 
-		std::vector< int >::iterator it = std::find_if(channels_to_remove.begin(), channels_to_remove.end(), out_of_range_predicate(1, reader->GetOutput()->GetNumberOfComponentsPerPixel() + 1));
+		std::vector< int >::iterator it = std::find_if(channels_to_remove.begin(), channels_to_remove.end(), out_of_range_predicate(1, number_of_channels + 1));
 		if(it != channels_to_remove.end()) {
 #ifdef USE_LOG4CXX
 			LOG4CXX_FATAL(logger, "Channel #" << *it << " does not exists");
@@ -148,7 +188,7 @@ int main(int argc, char** argv)
 		}
 		*/
 
-		for(int i = 1; i <= reader->GetOutput()->GetNumberOfComponentsPerPixel(); ++i) {
+		for(int i = 1; i <= number_of_channels; ++i) {
 			if(std::find(channels_to_remove.begin(), channels_to_remove.end(), i) == channels_to_remove.end()) { // i is not in the list of the channels to be removed
 				channels_to_keep.push_back(i);
 			}
@@ -162,7 +202,7 @@ int main(int argc, char** argv)
 		LOG4CXX_INFO(logger, "Channels to keep: " << list.str());
 #endif
 
-		std::vector< int >::iterator it = std::find_if(channels_to_keep.begin(), channels_to_keep.end(), out_of_range_predicate(1, reader->GetOutput()->GetNumberOfComponentsPerPixel() + 1));
+		std::vector< int >::iterator it = std::find_if(channels_to_keep.begin(), channels_to_keep.end(), out_of_range_predicate(1, number_of_channels + 1));
 		if(it != channels_to_keep.end()) {
 #ifdef USE_LOG4CXX
 			LOG4CXX_FATAL(logger, "Channel #" << *it << " does not exists");
@@ -171,23 +211,59 @@ int main(int argc, char** argv)
 		}
 	}
 
-	
-	ChannelComposer::Pointer channelComposer = ChannelComposer::New();
-	int i = 0;
-	std::vector< int >::iterator it = channels_to_keep.begin();
-	for ( ; it != channels_to_keep.end(); ++i, ++it)
-	{
-		SingleChannelAdaptor::Pointer singleChannelAdaptor = SingleChannelAdaptor::New();
-		singleChannelAdaptor->SetExtractComponentIndex(*it -  1);
-		singleChannelAdaptor->SetImage(reader->GetOutput());
+	OutputImageType::Pointer output_image;
 
-		channelComposer->SetInput(i, singleChannelAdaptor);
-	}
+	if(input_set) {
+		std::vector< unsigned int > channels;
+		std::vector< int >::iterator it = channels_to_keep.begin();
+		for ( ; it != channels_to_keep.end(); ++it)
+			channels.push_back(*it - 1);
+
+		try {
+			output_image = input_set->read_channels(channels);
+		} catch ( FeatureSetException & err ) {
+#ifdef USE_LOG4CXX
+			LOG4CXX_FATAL(logger, err.what());
+#endif
+			return -1;
+		}
+	} else {
+		const OutputImageType *input_image = reader->GetOutput();
 
-	channelComposer->Update();
+		std::vector< channel_copy::ChannelPair > channels;
+		for (unsigned int i = 0; i < channels_to_keep.size(); ++i)
+			channels.push_back(channel_copy::ChannelPair(channels_to_keep[i] - 1, i));
 
-	ImageWriter::Pointer writer = ImageWriter::New();
-	writer->SetInput(channelComposer->GetOutput());
-	writer->SetFileName(output_image_path);
-	writer->Update();
+		output_image = OutputImageType::New();
+		output_image->CopyInformation(input_image);
+		output_image->SetRegions(input_image->GetBufferedRegion());
+		output_image->SetVectorLength(channels.size());
+		output_image->Allocate();
+
+		channel_copy::gather(input_image, channels, output_image);
+	}
+
+	try {
+		if(!mask_path.empty() || (sample > 0)) {
+			InputImageType::Pointer mask;
+			if(!mask_path.empty())
+				mask = ImageLoader::load(mask_path);
+
+			const std::vector< boost::uint64_t > voxels = NpyWriter::select_voxels(mask, output_image->GetBufferedRegion().GetSize(), sample, seed);
+			NpyWriter::write(output_image, output_image_path, voxels);
+			NpyWriter::write_indices(voxels, NpyWriter::indices_filename(output_image_path));
+		} else {
+			ImageWriter::write(output_image, output_image_path, compress);
+		}
+	} catch ( ImageLoadingException & err ) {
+#ifdef USE_LOG4CXX
+		LOG4CXX_FATAL(logger, err.what());
+#endif
+		return -1;
+	} catch ( ImageWritingException & err ) {
+#ifdef USE_LOG4CXX
+		LOG4CXX_FATAL(logger, err.what());
+#endif
+		return -1;
+	}
 }
@@ -0,0 +1,127 @@
+#include "channel_statistics.h"
+
+#include "itkMetaDataObject.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <sstream>
+
+const char * const ChannelStatistics::normalization_key = "ChannelNormalization";
+const char * const ChannelStatistics::offsets_key = "ChannelNormalizationOffsets";
+const char * const ChannelStatistics::scales_key = "ChannelNormalizationScales";
+
+ChannelStatistics::Normalization ChannelStatistics::normalization(const std::string name)
+{
+	if(name == "minmax")
+		return MinMax;
+	if(name == "zscore")
+		return ZScore;
+	return NoNormalization;
+}
+
+void ChannelStatistics::gather(const OutputImageType *image, const unsigned int first_channel, const unsigned int number_of_channels)
+{
+	const unsigned int channels = image->GetNumberOfComponentsPerPixel();
+	const OutputImageType::SizeType size = image->GetBufferedRegion().GetSize();
+	const long plane_size = size[0] * size[1];
+	const float *data = image->GetBufferPointer() + first_channel;
+
+#pragma omp parallel
+	{
+		ChannelStatistics statistics(number_of_channels);
+
+#pragma omp for
+		for(long z = 0; z < static_cast< long >(size[2]); ++z)
+		{
+			const float *plane = data + z * plane_size * channels;
+			if(number_of_channels == channels) {
+				statistics.add(plane, channels, plane_size);
+			} else {
+				// Only some of the channels of each voxel, added voxel by voxel
+				for(long p = 0; p < plane_size; ++p)
+					statistics.add(plane + p * channels, number_of_channels, 1);
+			}
+		}
+
+#pragma omp critical
+		this->merge(statistics, first_channel);
+	}
+}
+
+void ChannelStatistics::parameters(const unsigned int channel, const Normalization normalization, double &offset, double &scale) const
+{
+	offset = 0;
+	scale = 1;
+	if(this->count[channel] > 0)
+	{
+		if(normalization == MinMax) {
+			offset = this->minimum[channel];
+			scale = this->maximum[channel] - this->minimum[channel];
+		} else {
+			offset = this->sum[channel] / this->count[channel];
+			scale = std::sqrt(std::max(this->sum_of_squares[channel] / this->count[channel] - offset * offset, 0.0));
+		}
+	}
+
+	if(!(scale > 0))
+		scale = 1;
+}
+
+ChannelRescale ChannelStatistics::rescale(const Normalization normalization) const
+{
+	const unsigned int channels = this->get_number_of_channels();
+
+	ChannelRescale rescale;
+	rescale.offsets.resize(channels);
+	rescale.inverse_scales.resize(channels);
+
+	for(unsigned int c = 0; c < channels; ++c)
+	{
+		double offset, scale;
+		this->parameters(c, normalization, offset, scale);
+		rescale.offsets[c] = offset;
+		rescale.inverse_scales[c] = 1 / scale;
+	}
+
+	return rescale;
+}
+
+void ChannelStatistics::record(OutputImageType *image, const Normalization normalization) const
+{
+	std::ostringstream offsets_value, scales_value;
+	offsets_value.precision(9);
+	scales_value.precision(9);
+
+	for(unsigned int c = 0; c < this->get_number_of_channels(); ++c)
+	{
+		double offset, scale;
+		this->parameters(c, normalization, offset, scale);
+		offsets_value << (c > 0 ? " " : "") << offset;
+		scales_value << (c > 0 ? " " : "") << scale;
+	}
+
+	itk::MetaDataDictionary &dictionary = image->GetMetaDataDictionary();
+	itk::EncapsulateMetaData< std::string >(dictionary, normalization_key, normalization == MinMax ? "minmax" : "zscore");
+	itk::EncapsulateMetaData< std::string >(dictionary, offsets_key, offsets_value.str());
+	itk::EncapsulateMetaData< std::string >(dictionary, scales_key, scales_value.str());
+}
+
+void ChannelStatistics::normalize(OutputImageType *image, const Normalization normalization) const
+{
+	const unsigned int channels = this->get_number_of_channels();
+	const ChannelRescale rescale = this->rescale(normalization);
+
+	const OutputImageType::SizeType size = image->GetBufferedRegion().GetSize();
+	const long plane_size = size[0] * size[1];
+	float *data = image->GetBufferPointer();
+
+#pragma omp parallel for
+	for(long z = 0; z < static_cast< long >(size[2]); ++z)
+	{
+		float *plane = data + z * plane_size * channels;
+		rescale.apply(plane, plane, plane_size * channels);
+	}
+
+	this->record(image, normalization);
+}
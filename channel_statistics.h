@@ -0,0 +1,163 @@
+#ifndef CHANNEL_STATISTICS_H
+#define CHANNEL_STATISTICS_H
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "datatypes.h"
+
+/**
+ * Rescaling of the channels of a normalization: each value becomes
+ * (value - offset) * inverse scale, the offset and the inverse scale being
+ * those of its channel.
+ */
+struct ChannelRescale
+{
+	std::vector< float > offsets, inverse_scales;
+
+	/**
+	 * Rescale n values of interleaved channels (e.g. a chunk of an image).
+	 * @param[in] channel The channel of the first value.
+	 */
+	inline void apply(const float *source, float *destination, const size_t n, unsigned int channel = 0) const
+	{
+		const unsigned int channels = this->offsets.size();
+		for(size_t i = 0; i < n; ++i)
+		{
+			destination[i] = (source[i] - this->offsets[channel]) * this->inverse_scales[channel];
+			if(++channel == channels)
+				channel = 0;
+		}
+	}
+};
+
+/**
+ * Minimum, maximum, sum and sum of squares of each channel of the features,
+ * gathered while the channels are copied in the final image, to normalize
+ * them without reading the whole image again.
+ *
+ * Gathering is not thread-safe: each thread gathers the voxels it copies (or
+ * computes, see NeighborhoodKernel::sweep()) in its own statistics, merged
+ * once it is done. Adding and merging are inline, for the kernels of the
+ * plugins.
+ */
+class ChannelStatistics
+{
+public:
+	enum Normalization { NoNormalization, MinMax, ZScore };
+
+	// Keys of the normalization in the metadata of the normalized images
+	static const char * const normalization_key;
+	static const char * const offsets_key;
+	static const char * const scales_key;
+
+	/**
+	 * The normalization named on the command line ("minmax" or "zscore", no
+	 * normalization otherwise).
+	 */
+	static Normalization normalization(const std::string name);
+
+	ChannelStatistics(const unsigned int number_of_channels = 0) :
+		minimum(number_of_channels, std::numeric_limits< double >::max()),
+		maximum(number_of_channels, -std::numeric_limits< double >::max()),
+		sum(number_of_channels, 0),
+		sum_of_squares(number_of_channels, 0),
+		count(number_of_channels, 0)
+	{
+	}
+
+	unsigned int get_number_of_channels() const
+	{
+		return this->count.size();
+	}
+
+	/**
+	 * Add n voxels of interleaved channels.
+	 * @param[in] data The first channel of the first voxel.
+	 * @param[in] number_of_channels The number of channels added.
+	 * @param[in] first_channel The statistics receiving the first channel added.
+	 * @param[in] stride The number of channels of the voxels (0: number_of_channels).
+	 */
+	inline void add(const float *data, const unsigned int number_of_channels, const size_t n, const unsigned int first_channel = 0, const unsigned int stride = 0)
+	{
+		const unsigned int step = stride > 0 ? stride : number_of_channels;
+		double *minimum = &this->minimum[first_channel];
+		double *maximum = &this->maximum[first_channel];
+		double *sum = &this->sum[first_channel];
+		double *sum_of_squares = &this->sum_of_squares[first_channel];
+
+		for(size_t p = 0; p < n; ++p, data += step)
+		{
+			for(unsigned int c = 0; c < number_of_channels; ++c)
+			{
+				const double value = data[c];
+				minimum[c] = std::min(minimum[c], value);
+				maximum[c] = std::max(maximum[c], value);
+				sum[c] += value;
+				sum_of_squares[c] += value * value;
+			}
+		}
+
+		for(unsigned int c = 0; c < number_of_channels; ++c)
+			this->count[first_channel + c] += n;
+	}
+
+	/**
+	 * Merge the statistics gathered by another thread.
+	 * @param[in] first_channel The statistics receiving the first channel of the other ones.
+	 */
+	inline void merge(const ChannelStatistics &other, const unsigned int first_channel = 0)
+	{
+		for(unsigned int c = 0; c < other.get_number_of_channels(); ++c)
+		{
+			this->minimum[first_channel + c] = std::min(this->minimum[first_channel + c], other.minimum[c]);
+			this->maximum[first_channel + c] = std::max(this->maximum[first_channel + c], other.maximum[c]);
+			this->sum[first_channel + c] += other.sum[c];
+			this->sum_of_squares[first_channel + c] += other.sum_of_squares[c];
+			this->count[first_channel + c] += other.count[c];
+		}
+	}
+
+	/**
+	 * Gather some channels of an image (in parallel), for the channels that
+	 * were not gathered while copied.
+	 * @param[in] first_channel The first channel of the image gathered, into the statistics of the same channel.
+	 * @param[in] number_of_channels The number of channels gathered.
+	 */
+	void gather(const OutputImageType *image, const unsigned int first_channel, const unsigned int number_of_channels);
+
+	/**
+	 * Normalize the channels of an image in place, and record the
+	 * normalization in its metadata: each channel becomes (value - offset) /
+	 * scale, the offset and the scale being the minimum and the range
+	 * (minmax), or the mean and the standard deviation (zscore) of the
+	 * channel. A constant channel becomes 0.
+	 * @param[in,out] image An image whose channels are those of the statistics.
+	 */
+	void normalize(OutputImageType *image, const Normalization normalization) const;
+
+	/**
+	 * The rescaling of a normalization (see normalize()), to apply it while
+	 * the image is written instead of in place.
+	 */
+	ChannelRescale rescale(const Normalization normalization) const;
+
+	/**
+	 * Record a normalization in the metadata of an image (see normalize()).
+	 */
+	void record(OutputImageType *image, const Normalization normalization) const;
+
+private:
+	/**
+	 * The offset and the scale of a channel.
+	 */
+	void parameters(const unsigned int channel, const Normalization normalization, double &offset, double &scale) const;
+
+	std::vector< double > minimum, maximum, sum, sum_of_squares;
+	std::vector< unsigned long long > count;
+};
+
+#endif /* CHANNEL_STATISTICS_H */
@@ -0,0 +1,241 @@
+#include "checkpoint.h"
+
+#include "itkImageFileReader.h"
+
+#include "file_sync.h"
+#include "image_writer.h"
+
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#ifdef USE_LOG4CXX
+	#include "log4cxx/logger.h"
+#endif
+
+typedef itk::ImageFileReader< OutputImageType > CheckpointReader;
+
+namespace
+{
+
+const char * const signature_filename = "signature";
+const char * const journal_filename = "journal";
+
+std::string read_file(const boost::filesystem::path &path)
+{
+	std::ifstream file(path.string().c_str());
+	std::ostringstream content;
+	content << file.rdbuf();
+	return content.str();
+}
+
+}
+
+Checkpoint::Checkpoint(const std::string directory, const std::string signature, const bool compress) :
+	directory(directory),
+	compress(compress),
+	has_set(false),
+	set_computers(0),
+	set_parts(0)
+{
+#ifdef USE_LOG4CXX
+	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+#endif
+
+	const boost::filesystem::path signature_path = this->directory / signature_filename;
+
+	try {
+		boost::filesystem::create_directories(this->directory);
+
+		if(boost::filesystem::exists(signature_path))
+		{
+			if(read_file(signature_path) == signature)
+			{
+				this->read_journal();
+				return;
+			}
+
+#ifdef USE_LOG4CXX
+			LOG4CXX_WARN(logger, "The checkpoint in " << this->directory << " was made by another run, starting over");
+#endif
+			this->clear();
+		}
+
+		{
+			std::ofstream signature_file(signature_path.string().c_str());
+			signature_file << signature;
+			if(!signature_file)
+				throw CheckpointException("Unable to write the checkpoint signature " + signature_path.string());
+		}
+
+		std::ofstream journal_file((this->directory / journal_filename).string().c_str(), std::ios::trunc);
+		if(!journal_file)
+			throw CheckpointException("Unable to write the checkpoint journal in " + this->directory.string());
+	} catch(boost::filesystem::filesystem_error &ex) {
+		throw CheckpointException(std::string("Unable to use the checkpoint directory (") + ex.what() + ")");
+	}
+}
+
+void Checkpoint::read_journal()
+{
+	std::ifstream journal_file((this->directory / journal_filename).string().c_str());
+
+	std::string line;
+	while(std::getline(journal_file, line))
+	{
+		std::istringstream fields(line);
+		std::string kind, filename;
+		unsigned int computers, parts;
+
+		// A line cut by an interruption is ignored, as well as the entries whose file is missing
+		fields >> kind >> computers;
+		if(!fields)
+			continue;
+
+		if((kind == "part") && (fields >> filename) && boost::filesystem::exists(this->directory / filename)) {
+			this->parts[computers] = filename;
+		} else if((kind == "set") && (fields >> parts)) {
+			this->has_set = true;
+			this->set_computers = computers;
+			this->set_parts = parts;
+		}
+	}
+}
+
+bool Checkpoint::write(const OutputImageType *image, const std::string filename) const
+{
+#ifdef USE_LOG4CXX
+	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+#endif
+
+	const boost::filesystem::path path = this->directory / filename;
+	const boost::filesystem::path tmp_path = this->directory / (boost::filesystem::path(filename).stem().string() + ".tmp.mha");
+
+	try {
+		ImageWriter::write(image, tmp_path.string(), this->compress);
+
+		if(!file_sync::replace(tmp_path, path))
+			throw CheckpointException("Unable to sync " + path.string());
+	} catch(std::exception &ex) {
+#ifdef USE_LOG4CXX
+		LOG4CXX_WARN(logger, "Unable to write the checkpoint image " << path << " (" << ex.what() << ")");
+#endif
+		boost::system::error_code ignored;
+		boost::filesystem::remove(tmp_path, ignored);
+		return false;
+	}
+
+	return true;
+}
+
+OutputImageType::Pointer Checkpoint::read(const std::string filename) const
+{
+#ifdef USE_LOG4CXX
+	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+#endif
+
+	const boost::filesystem::path path = this->directory / filename;
+
+	CheckpointReader::Pointer reader = CheckpointReader::New();
+	reader->SetFileName(path.string());
+
+	try {
+		reader->Update();
+	} catch( itk::ExceptionObject &ex ) {
+#ifdef USE_LOG4CXX
+		LOG4CXX_WARN(logger, "Unable to read the checkpoint image " << path << " (" << ex.what() << ")");
+#endif
+		return OutputImageType::Pointer();
+	}
+
+#ifdef USE_LOG4CXX
+	LOG4CXX_INFO(logger, "Resumed from the checkpoint: " << path);
+#endif
+
+	return reader->GetOutput();
+}
+
+void Checkpoint::record(const std::string line)
+{
+	const boost::filesystem::path journal_path = this->directory / journal_filename;
+
+	std::ofstream journal_file(journal_path.string().c_str(), std::ios::app);
+	journal_file << line << std::endl;
+	journal_file.close();
+
+	if(!journal_file || !file_sync::sync(journal_path, false))
+	{
+#ifdef USE_LOG4CXX
+		log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+		LOG4CXX_WARN(logger, "Unable to write the checkpoint journal in " << this->directory);
+#endif
+	}
+}
+
+OutputImageType::Pointer Checkpoint::load_part(const unsigned int computer) const
+{
+	std::map< unsigned int, std::string >::const_iterator it = this->parts.find(computer);
+	if(it == this->parts.end())
+		return OutputImageType::Pointer();
+
+	return this->read(it->second);
+}
+
+void Checkpoint::store_part(const unsigned int computer, const OutputImageType *image)
+{
+	std::ostringstream filename;
+	filename << "part." << computer << ".mha";
+
+	if(!this->write(image, filename.str()))
+		return;
+
+	std::ostringstream line;
+	line << "part " << computer << " " << filename.str();
+	this->record(line.str());
+}
+
+bool Checkpoint::get_set(unsigned int &computers, unsigned int &parts) const
+{
+	computers = this->set_computers;
+	parts = this->set_parts;
+	return this->has_set;
+}
+
+void Checkpoint::record_set(const unsigned int computers, const unsigned int parts)
+{
+	std::ostringstream line;
+	line << "set " << computers << " " << parts;
+	this->record(line.str());
+}
+
+void Checkpoint::clear()
+{
+#ifdef USE_LOG4CXX
+	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+#endif
+
+	try {
+		// Only the files written by the checkpoint (the directory may hold others)
+		std::vector< boost::filesystem::path > files;
+		boost::filesystem::directory_iterator end_itr;
+		for(boost::filesystem::directory_iterator i(this->directory); i != end_itr; ++i)
+		{
+			const std::string name = i->path().filename().string();
+			if((name == signature_filename) || (name == journal_filename)
+				|| (name.compare(0, 5, "part.") == 0))
+				files.push_back(i->path());
+		}
+
+		std::vector< boost::filesystem::path >::const_iterator it;
+		for(it = files.begin(); it != files.end(); ++it)
+			boost::filesystem::remove(*it);
+	} catch(boost::filesystem::filesystem_error &ex) {
+#ifdef USE_LOG4CXX
+		LOG4CXX_WARN(logger, "Unable to clear the checkpoint in " << this->directory << " (" << ex.what() << ")");
+#endif
+	}
+
+	this->parts.clear();
+	this->has_set = false;
+	this->set_computers = this->set_parts = 0;
+}
@@ -0,0 +1,97 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <map>
+#include <stdexcept>
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+#include "datatypes.h"
+
+class CheckpointException : public std::runtime_error
+{
+public:
+	CheckpointException ( const std::string &err ) : std::runtime_error (err) {}
+};
+
+/**
+ * Progress of a run kept on disk, so that a run interrupted (killed,
+ * preempted...) resumes after its last finished computer when started again
+ * with the same arguments.
+ *
+ * The directory holds the signature of the run (the content of the input
+ * image, the computers and their options, the output) and a journal, to
+ * which a line is appended once the data it refers to is safely written:
+ *
+ *     part <computer> <file>       the output of a computer, in its own image
+ *     set <computers> <parts>      the feature set output, whose first parts hold the first computers
+ *
+ * An image is written to a temporary file, synced, renamed and its
+ * directory synced (see file_sync) before its line is appended (and synced),
+ * so that a line never refers to an image lost by a crash of the machine.
+ * The set lines are appended once the feature set has synced its new part
+ * and its description.
+ *
+ * A checkpoint made by another run is discarded. Failing to write the
+ * checkpoint only loses the ability to resume, it is logged and ignored.
+ *
+ * The loading methods return the progress found when the checkpoint was
+ * opened: the stores (which may run on the writer thread) only append to
+ * the journal.
+ */
+class Checkpoint
+{
+public:
+	/**
+	 * @param[in] directory The checkpoint directory. Created if needed.
+	 * @param[in] signature The description of the run.
+	 * @param[in] compress Compress the images stored.
+	 */
+	Checkpoint(const std::string directory, const std::string signature, const bool compress = false);
+
+	/**
+	 * Load the output of a computer.
+	 * @return The output, or a null pointer if it is not in the checkpoint.
+	 */
+	OutputImageType::Pointer load_part(const unsigned int computer) const;
+
+	/**
+	 * Store the output of a computer.
+	 */
+	void store_part(const unsigned int computer, const OutputImageType *image);
+
+	/**
+	 * Progress of a feature set output.
+	 * @return false if it is not in the checkpoint.
+	 */
+	bool get_set(unsigned int &computers, unsigned int &parts) const;
+
+	/**
+	 * Record that the first parts of the feature set output hold the channels
+	 * of the first computers.
+	 */
+	void record_set(const unsigned int computers, const unsigned int parts);
+
+	/**
+	 * Remove the files of the checkpoint, once the run is done.
+	 */
+	void clear();
+
+private:
+	void read_journal();
+
+	bool write(const OutputImageType *image, const std::string filename) const;
+
+	OutputImageType::Pointer read(const std::string filename) const;
+
+	void record(const std::string line);
+
+	boost::filesystem::path directory;
+	bool compress;
+	std::map< unsigned int, std::string > parts;
+	bool has_set;
+	unsigned int set_computers, set_parts;
+};
+
+#endif /* CHECKPOINT_H */
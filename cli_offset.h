@@ -0,0 +1,116 @@
+#ifndef CLI_OFFSET_H
+#define CLI_OFFSET_H
+
+#include <boost/program_options.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/regex.hpp>
+
+#include <algorithm>
+#include <iterator>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * 3D offset (or radius) given on the command line as "x,y,z".
+ */
+class cli_offset {
+public :
+	cli_offset() : m_offset(3)
+	{
+		m_offset[0] = 0; m_offset[1] = 0; m_offset[2] = 0;
+	}
+
+	cli_offset(unsigned int o1, unsigned int o2, unsigned int o3) : m_offset(3)
+	{
+		m_offset[0] = o1; m_offset[1] = o2; m_offset[2] = o3;
+	}
+
+	std::vector< unsigned int > getOffset() { return m_offset; }
+
+	const unsigned int operator[](int i) const { return m_offset[i]; }
+
+private:
+	std::vector< unsigned int > m_offset;
+};
+
+inline void validate(boost::any& v, const std::vector<std::string>& values, cli_offset* target_type, int)
+{
+	static boost::regex r("(\\d+),(\\d+),(\\d+)");
+
+	using namespace boost::program_options;
+
+	// Make sure no previous assignment to 'v' was made.
+	validators::check_first_occurrence(v);
+	// Extract the first string from 'values'. If there is more than
+	// one string, it's an error, and exception will be thrown.
+	const std::string& s = validators::get_single_string(values);
+
+	// Do regex match and convert the interesting part to int.
+	boost::smatch match;
+	if (boost::regex_match(s, match, r)) {
+		v = boost::any(cli_offset(boost::lexical_cast<unsigned int>(match[1]), boost::lexical_cast<unsigned int>(match[2]), boost::lexical_cast<unsigned int>(match[3])));
+	} else {
+		throw invalid_option_value(s);
+	}
+}
+
+inline std::ostream &operator<<(std::ostream &out, cli_offset& t)
+{
+	std::vector<unsigned int> vec = t.getOffset();
+
+	std::copy(vec.begin(), vec.end(), std::ostream_iterator<unsigned int>(out, ", ") );
+
+	return out;
+}
+
+/**
+ * 3D offset given on the command line as "x,y,z", whose components may be negative.
+ */
+class cli_signed_offset {
+public :
+	cli_signed_offset() : m_offset(3)
+	{
+		m_offset[0] = 0; m_offset[1] = 0; m_offset[2] = 0;
+	}
+
+	cli_signed_offset(int o1, int o2, int o3) : m_offset(3)
+	{
+		m_offset[0] = o1; m_offset[1] = o2; m_offset[2] = o3;
+	}
+
+	std::vector< int > getOffset() { return m_offset; }
+
+	const int operator[](int i) const { return m_offset[i]; }
+
+private:
+	std::vector< int > m_offset;
+};
+
+inline void validate(boost::any& v, const std::vector<std::string>& values, cli_signed_offset* target_type, int)
+{
+	static boost::regex r("(-?\\d+),(-?\\d+),(-?\\d+)");
+
+	using namespace boost::program_options;
+
+	validators::check_first_occurrence(v);
+	const std::string& s = validators::get_single_string(values);
+
+	boost::smatch match;
+	if (boost::regex_match(s, match, r)) {
+		v = boost::any(cli_signed_offset(boost::lexical_cast<int>(match[1]), boost::lexical_cast<int>(match[2]), boost::lexical_cast<int>(match[3])));
+	} else {
+		throw invalid_option_value(s);
+	}
+}
+
+inline std::ostream &operator<<(std::ostream &out, cli_signed_offset& t)
+{
+	std::vector<int> vec = t.getOffset();
+
+	std::copy(vec.begin(), vec.end(), std::ostream_iterator<int>(out, ", ") );
+
+	return out;
+}
+
+#endif /* CLI_OFFSET_H */
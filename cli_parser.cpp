@@ -4,8 +4,12 @@
 #include <ostream>
 #include <vector>
 
+#include <boost/lexical_cast.hpp>
 #include <boost/regex.hpp>
 
+#include "feature_set.h"
+#include "npy_writer.h"
+
 #ifdef USE_LOG4CXX
 #  include "log4cxx/logger.h"
 #endif
@@ -14,7 +18,9 @@ namespace po = boost::program_options;
 
 CliParser::CliParser() :
 	main_options_descriptions("Main options"),
-	computer_options_descriptions("Computer options")
+	computer_options_descriptions("Computer options"),
+	shard_index(0),
+	shard_count(0)
 {
 	this->main_options_descriptions.add_options()
 		("help,h",
@@ -24,8 +30,56 @@ CliParser::CliParser() :
 			po::value< std::string >(&(this->input_image))->required(),
 			"Input image (required)")
 		("output-image,o",
-			po::value< std::string >(&(this->output_image))->required(),
-			"Ouput image (required)")
+			po::value< std::string >(&(this->output_image)),
+			"Ouput image (required, except with --autotune)")
+		("append,a",
+			po::bool_switch(&(this->append)),
+			"Add the computed channels to an existing feature set (.fset) output")
+		("compress",
+			po::bool_switch(&(this->compress)),
+			"Compress the output image")
+		("cache-dir",
+			po::value< std::string >(&(this->cache_dir)),
+			"Directory where computed features are cached")
+		("cache-size",
+			po::value< unsigned long >(&(this->cache_size))->default_value(0),
+			"Maximum size of the cache, in MiB (default: 0, unlimited)")
+		("write-buffer",
+			po::value< unsigned long >(&(this->write_buffer_size))->default_value(2048),
+			"Maximum size of the computed features waiting to be written, in MiB")
+		("plan",
+			po::bool_switch(&(this->plan)),
+			"Validate the options and print the estimated channels, memory and cost of each computer, without loading the image")
+		("memory-limit",
+			po::value< unsigned long >(&(this->memory_limit))->default_value(0),
+			"Estimated memory the computation may use, in MiB: the image is computed by slabs when needed, and the computation is refused if it still does not fit (default: 0, unlimited)")
+		("checkpoint",
+			po::value< std::string >(&(this->checkpoint_dir)),
+			"Directory where the progress of the run is kept, so that an interrupted run resumes after its last finished computer")
+		("normalize-channels",
+			po::value< std::string >(&(this->normalize_channels)),
+			"Normalize each channel of the output: minmax (to [0,1]) or zscore (zero mean, unit variance)")
+		("mask",
+			po::value< std::string >(&(this->mask)),
+			"Only write the voxels where this image is not zero (.npy output only)")
+		("sample",
+			po::value< unsigned long long >(&(this->sample))->default_value(0),
+			"Only write a random sample of this number of voxels (.npy output only, default: 0, all the voxels)")
+		("seed",
+			po::value< unsigned int >(&(this->seed))->default_value(0),
+			"Seed of the random sample of voxels")
+		("autotune",
+			po::bool_switch(&(this->autotune)),
+			"Time the computers with several tile sizes and numbers of threads on a sub-volume of the input image, and save the fastest ones in the tuning profile, instead of computing the features")
+		("autotune-size",
+			po::value< unsigned int >(&(this->autotune_size))->default_value(64),
+			"Edge of the sub-volume (at the center of the input image) the computers are timed on by --autotune, in voxels")
+		("shard",
+			po::value< std::string >(&(this->shard)),
+			"Only compute the i-th of N slabs of planes of the image (i/N, i from 0), as a shard of a run spread over several processes, to be assembled by features_merge")
+		("tuning-file",
+			po::value< std::string >(&(this->tuning_file)),
+			"Tuning profile, read to run each computer as tuned by --autotune (default: ~/.features_computer/tuning-<hostname>)")
 		;
 
 	this->computer_options_descriptions.add_options()
@@ -61,6 +115,35 @@ int CliParser::parse_argv(int argc, char ** argv)
 
 		vm.notify();
 
+		if(this->output_image.empty() && !this->autotune)
+			throw po::required_option("output-image");
+
+		if(this->autotune_size == 0)
+			throw po::validation_error(po::validation_error::invalid_option_value, "autotune-size", "0");
+
+		if(!this->normalize_channels.empty() && (this->normalize_channels != "minmax") && (this->normalize_channels != "zscore"))
+			throw po::validation_error(po::validation_error::invalid_option_value, "normalize-channels", this->normalize_channels);
+
+		if((!this->mask.empty() || (this->sample > 0)) && (boost::filesystem::path(this->output_image).extension() != ".npy"))
+			throw po::error("--mask and --sample need a NumPy (.npy) output");
+
+		if(!this->shard.empty())
+		{
+			boost::smatch shard_match;
+			if(!boost::regex_match(this->shard, shard_match, boost::regex("([0-9]+)/([0-9]+)")))
+				throw po::validation_error(po::validation_error::invalid_option_value, "shard", this->shard);
+
+			this->shard_index = boost::lexical_cast< unsigned int >(shard_match[1]);
+			this->shard_count = boost::lexical_cast< unsigned int >(shard_match[2]);
+			if(this->shard_index >= this->shard_count)
+				throw po::validation_error(po::validation_error::invalid_option_value, "shard", this->shard);
+
+			// The output of a shard is a plain image of its planes, assembled and normalized by features_merge
+			if(FeatureSet::is_feature_set(this->output_image) || NpyWriter::is_npy(this->output_image) || this->append || !this->cache_dir.empty()
+				|| !this->checkpoint_dir.empty() || (this->memory_limit > 0) || !this->normalize_channels.empty() || this->autotune)
+				throw po::error("--shard needs an image output, and cannot be combined with --append, --cache-dir, --checkpoint, --memory-limit, --normalize-channels nor --autotune");
+		}
+
 		std::vector<std::string> unrecognized_options = po::collect_unrecognized(recognized_main_options.options, po::include_positional);
 
 		po::parsed_options recognized_plugin_options = 
@@ -123,6 +206,91 @@ const std::string CliParser::get_output_image() const
 	return this->output_image;
 }
 
+bool CliParser::get_append() const
+{
+	return this->append;
+}
+
+bool CliParser::get_compress() const
+{
+	return this->compress;
+}
+
+const std::string CliParser::get_cache_dir() const
+{
+	return this->cache_dir;
+}
+
+unsigned long CliParser::get_cache_size() const
+{
+	return this->cache_size;
+}
+
+unsigned long CliParser::get_write_buffer_size() const
+{
+	return this->write_buffer_size;
+}
+
+bool CliParser::get_plan() const
+{
+	return this->plan;
+}
+
+unsigned long CliParser::get_memory_limit() const
+{
+	return this->memory_limit;
+}
+
+const std::string CliParser::get_checkpoint_dir() const
+{
+	return this->checkpoint_dir;
+}
+
+const std::string CliParser::get_normalize_channels() const
+{
+	return this->normalize_channels;
+}
+
+const std::string CliParser::get_mask() const
+{
+	return this->mask;
+}
+
+unsigned long long CliParser::get_sample() const
+{
+	return this->sample;
+}
+
+unsigned int CliParser::get_seed() const
+{
+	return this->seed;
+}
+
+bool CliParser::get_autotune() const
+{
+	return this->autotune;
+}
+
+unsigned int CliParser::get_autotune_size() const
+{
+	return this->autotune_size;
+}
+
+unsigned int CliParser::get_shard_index() const
+{
+	return this->shard_index;
+}
+
+unsigned int CliParser::get_shard_count() const
+{
+	return this->shard_count;
+}
+
+const std::string CliParser::get_tuning_file() const
+{
+	return this->tuning_file;
+}
+
 const std::vector<std::string> CliParser::get_computers() const
 {
 	return this->computers;
@@ -14,6 +14,23 @@ public:
 	const std::vector<std::string> get_modules_needing_help() const;
 	const std::string get_input_image() const;
 	const std::string get_output_image() const;
+	bool get_append() const;
+	bool get_compress() const;
+	const std::string get_cache_dir() const;
+	unsigned long get_cache_size() const;
+	unsigned long get_write_buffer_size() const;
+	bool get_plan() const;
+	unsigned long get_memory_limit() const;
+	const std::string get_checkpoint_dir() const;
+	const std::string get_normalize_channels() const;
+	const std::string get_mask() const;
+	unsigned long long get_sample() const;
+	unsigned int get_seed() const;
+	bool get_autotune() const;
+	unsigned int get_autotune_size() const;
+	const std::string get_tuning_file() const;
+	unsigned int get_shard_index() const;
+	unsigned int get_shard_count() const; // 0 without --shard
 	const std::vector<std::string> get_computers() const;
 	const std::vector< std::vector< std::string > > get_computers_options() const;
 
@@ -25,6 +42,23 @@ private:
 	std::vector< std::string > need_help;
 	std::string input_image;
 	std::string output_image;
+	bool append;
+	bool compress;
+	std::string cache_dir;
+	unsigned long cache_size;
+	unsigned long write_buffer_size;
+	bool plan;
+	unsigned long memory_limit;
+	std::string checkpoint_dir;
+	std::string normalize_channels;
+	std::string mask;
+	unsigned long long sample;
+	unsigned int seed;
+	bool autotune;
+	unsigned int autotune_size;
+	std::string tuning_file;
+	std::string shard;
+	unsigned int shard_index, shard_count;
 	std::vector< std::string > computers;
 	std::vector< std::vector< std::string > > computers_options;
 };
@@ -0,0 +1,282 @@
+#include "feature_cache.h"
+
+#include "itkImageFileReader.h"
+
+#include "image_writer.h"
+
+#include <algorithm>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include <unistd.h>
+
+#ifdef USE_LOG4CXX
+	#include "log4cxx/logger.h"
+#endif
+
+typedef itk::ImageFileReader< OutputImageType > CacheReader;
+
+namespace
+{
+
+const boost::uint64_t fnv_offset_basis = 14695981039346656037ULL;
+const boost::uint64_t fnv_prime = 1099511628211ULL;
+
+// Size of the blocks hashed independently (and in parallel) by FeatureCache::hash()
+const size_t hash_block_size = 1 << 20;
+
+boost::uint64_t fnv1a(const void *data, const size_t size, boost::uint64_t h = fnv_offset_basis)
+{
+	const unsigned char *bytes = static_cast< const unsigned char * >(data);
+	for(size_t i = 0; i < size; ++i)
+	{
+		h ^= bytes[i];
+		h *= fnv_prime;
+	}
+	return h;
+}
+
+std::string hex(const boost::uint64_t value)
+{
+	std::ostringstream s;
+	s << std::hex << std::setw(16) << std::setfill('0') << value;
+	return s.str();
+}
+
+struct CacheEntry
+{
+	boost::filesystem::path path;
+	std::time_t last_use;
+	boost::uintmax_t size;
+
+	bool operator<(const CacheEntry &other) const { return last_use < other.last_use; }
+};
+
+}
+
+FeatureCache::FeatureCache(const std::string directory, const boost::uintmax_t max_size, const bool compress) :
+	directory(directory),
+	max_size(max_size),
+	compress(compress)
+{
+	boost::filesystem::create_directories(this->directory);
+}
+
+boost::uint64_t FeatureCache::hash(const InputImageType *image)
+{
+	const InputImageType::RegionType region = image->GetBufferedRegion();
+	const unsigned char *buffer = reinterpret_cast< const unsigned char * >(image->GetBufferPointer());
+	const size_t buffer_size = region.GetNumberOfPixels() * sizeof(InputImageType::PixelType);
+
+	const long nb_blocks = (buffer_size + hash_block_size - 1) / hash_block_size;
+	std::vector< boost::uint64_t > block_hashes(nb_blocks);
+
+#pragma omp parallel for
+	for(long i = 0; i < nb_blocks; ++i)
+	{
+		const size_t begin = i * hash_block_size;
+		block_hashes[i] = fnv1a(buffer + begin, std::min(hash_block_size, buffer_size - begin));
+	}
+
+	boost::uint64_t h = fnv_offset_basis;
+	for(unsigned int i = 0; i < InputImageType::ImageDimension; ++i)
+	{
+		const boost::uint64_t size = region.GetSize(i);
+		const double spacing = image->GetSpacing()[i], origin = image->GetOrigin()[i];
+		h = fnv1a(&size, sizeof(size), h);
+		h = fnv1a(&spacing, sizeof(spacing), h);
+		h = fnv1a(&origin, sizeof(origin), h);
+	}
+
+	// A reoriented image has other features (and another geometry in the outputs)
+	for(unsigned int i = 0; i < InputImageType::ImageDimension; ++i)
+		for(unsigned int j = 0; j < InputImageType::ImageDimension; ++j)
+		{
+			const double direction = image->GetDirection()(i, j);
+			h = fnv1a(&direction, sizeof(direction), h);
+		}
+
+	if(!block_hashes.empty())
+		h = fnv1a(&block_hashes[0], block_hashes.size() * sizeof(boost::uint64_t), h);
+
+	return h;
+}
+
+std::string FeatureCache::key(const boost::uint64_t input_hash, const std::string computer, const std::string version, const std::vector< std::string > options)
+{
+	std::ostringstream k;
+	k << hex(input_hash) << std::endl << computer << " " << version << std::endl;
+
+	std::vector< std::string >::const_iterator it;
+	for(it = options.begin(); it != options.end(); ++it)
+		k << *it << std::endl;
+
+	return k.str();
+}
+
+std::string FeatureCache::digest(const std::string keys)
+{
+	return hex(fnv1a(keys.data(), keys.size()));
+}
+
+boost::filesystem::path FeatureCache::entry(const std::string key, const std::string extension) const
+{
+	return this->directory / (FeatureCache::digest(key) + extension);
+}
+
+OutputImageType::Pointer FeatureCache::load(const std::string key)
+{
+#ifdef USE_LOG4CXX
+	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+#endif
+
+	const boost::filesystem::path image_path = this->entry(key, ".mha");
+	const boost::filesystem::path key_path = this->entry(key, ".key");
+
+	if(!boost::filesystem::exists(image_path) || !boost::filesystem::exists(key_path))
+		return OutputImageType::Pointer();
+
+	// Protect against collisions of the hashed file names
+	{
+		std::ifstream key_file(key_path.string().c_str());
+		std::ostringstream stored_key;
+		stored_key << key_file.rdbuf();
+
+		if(stored_key.str() != key)
+			return OutputImageType::Pointer();
+	}
+
+	CacheReader::Pointer reader = CacheReader::New();
+	reader->SetFileName(image_path.string());
+
+	try {
+		reader->Update();
+	} catch( itk::ExceptionObject &ex ) {
+#ifdef USE_LOG4CXX
+		LOG4CXX_WARN(logger, "Unable to read the cached image " << image_path << " (" << ex.what() << ")");
+#endif
+		return OutputImageType::Pointer();
+	}
+
+	try {
+		boost::filesystem::last_write_time(image_path, std::time(NULL));
+	} catch(boost::filesystem::filesystem_error &ex) {
+#ifdef USE_LOG4CXX
+		LOG4CXX_WARN(logger, "Unable to touch the cached image " << image_path << " (" << ex.what() << ")");
+#endif
+	}
+
+#ifdef USE_LOG4CXX
+	LOG4CXX_INFO(logger, "Cache hit: " << image_path);
+#endif
+
+	return reader->GetOutput();
+}
+
+void FeatureCache::store(const std::string key, const OutputImageType *image)
+{
+#ifdef USE_LOG4CXX
+	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+#endif
+
+	std::ostringstream tmp_suffix;
+	tmp_suffix << ".tmp" << getpid();
+
+	const boost::filesystem::path image_path = this->entry(key, ".mha");
+	const boost::filesystem::path key_path = this->entry(key, ".key");
+	const boost::filesystem::path tmp_image_path = this->entry(key, tmp_suffix.str() + ".mha");
+	const boost::filesystem::path tmp_key_path = this->entry(key, tmp_suffix.str() + ".key");
+
+	try {
+		ImageWriter::write(image, tmp_image_path.string(), this->compress);
+
+		{
+			std::ofstream key_file(tmp_key_path.string().c_str());
+			key_file << key;
+		}
+
+		// The image is renamed last, entries without it being ignored
+		boost::filesystem::rename(tmp_key_path, key_path);
+		boost::filesystem::rename(tmp_image_path, image_path);
+	} catch( ImageWritingException &ex ) {
+#ifdef USE_LOG4CXX
+		LOG4CXX_WARN(logger, "Unable to write the cached image " << image_path << " (" << ex.what() << ")");
+#endif
+		boost::system::error_code ignored;
+		boost::filesystem::remove(tmp_image_path, ignored);
+		boost::filesystem::remove(tmp_key_path, ignored);
+		return;
+	} catch(boost::filesystem::filesystem_error &ex) {
+#ifdef USE_LOG4CXX
+		LOG4CXX_WARN(logger, "Unable to store " << image_path << " in the cache (" << ex.what() << ")");
+#endif
+		return;
+	}
+
+#ifdef USE_LOG4CXX
+	LOG4CXX_INFO(logger, "Cached: " << image_path);
+#endif
+
+	this->evict();
+}
+
+void FeatureCache::evict()
+{
+	if(this->max_size == 0)
+		return;
+
+#ifdef USE_LOG4CXX
+	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+#endif
+
+	try {
+		std::vector< CacheEntry > entries;
+		boost::uintmax_t total_size = 0;
+
+		boost::filesystem::directory_iterator end_itr;
+		for(boost::filesystem::directory_iterator i(this->directory); i != end_itr; ++i)
+		{
+			const boost::filesystem::path path = i->path();
+
+			// Skip the entries being written by other processes
+			if(!boost::filesystem::is_regular_file(i->status()) || (path.extension() != ".mha") || (path.stem().extension() != ""))
+				continue;
+
+			CacheEntry entry;
+			entry.path = path;
+			entry.last_use = boost::filesystem::last_write_time(path);
+			entry.size = boost::filesystem::file_size(path);
+
+			boost::filesystem::path key_path = path;
+			key_path.replace_extension(".key");
+			if(boost::filesystem::exists(key_path))
+				entry.size += boost::filesystem::file_size(key_path);
+
+			total_size += entry.size;
+			entries.push_back(entry);
+		}
+
+		std::sort(entries.begin(), entries.end());
+
+		std::vector< CacheEntry >::const_iterator it;
+		for(it = entries.begin(); (it != entries.end()) && (total_size > this->max_size); ++it)
+		{
+			boost::filesystem::path key_path = it->path;
+			key_path.replace_extension(".key");
+
+			boost::filesystem::remove(it->path);
+			boost::filesystem::remove(key_path);
+			total_size -= it->size;
+
+#ifdef USE_LOG4CXX
+			LOG4CXX_INFO(logger, "Evicted from the cache: " << it->path);
+#endif
+		}
+	} catch(boost::filesystem::filesystem_error &ex) {
+#ifdef USE_LOG4CXX
+		LOG4CXX_WARN(logger, "Unable to evict cache entries (" << ex.what() << ")");
+#endif
+	}
+}
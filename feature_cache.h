@@ -0,0 +1,67 @@
+#ifndef FEATURE_CACHE_H
+#define FEATURE_CACHE_H
+
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/filesystem.hpp>
+
+#include "datatypes.h"
+
+/**
+ * On-disk cache of the images produced by the features computers.
+ *
+ * Entries are addressed by a key built from the content of the input image,
+ * the name of the computer, the version of its features and its normalized
+ * options. The least recently used entries are evicted when the cache grows
+ * over its size limit.
+ */
+class FeatureCache
+{
+public:
+	/**
+	 * @param[in] directory The cache directory. Created if needed.
+	 * @param[in] max_size The maximum size of the cache, in bytes (0 means unlimited).
+	 * @param[in] compress Compress the images stored.
+	 */
+	FeatureCache(const std::string directory, const boost::uintmax_t max_size, const bool compress = false);
+
+	/**
+	 * Hash the content of an image (pixels and geometry, direction included).
+	 */
+	static boost::uint64_t hash(const InputImageType *image);
+
+	/**
+	 * Build the key identifying the output of a computer.
+	 */
+	static std::string key(const boost::uint64_t input_hash, const std::string computer, const std::string version, const std::vector< std::string > options);
+
+	/**
+	 * Digest of some keys (e.g. of all the computers of a run), in hexadecimal.
+	 */
+	static std::string digest(const std::string keys);
+
+	/**
+	 * Load a cached image.
+	 * @return The cached image, or a null pointer if there is no such entry.
+	 */
+	OutputImageType::Pointer load(const std::string key);
+
+	/**
+	 * Store an image in the cache and evict the least recently used entries if needed.
+	 * Failures are logged, the cache being only an optimization.
+	 */
+	void store(const std::string key, const OutputImageType *image);
+
+private:
+	boost::filesystem::path entry(const std::string key, const std::string extension) const;
+
+	void evict();
+
+	boost::filesystem::path directory;
+	boost::uintmax_t max_size;
+	bool compress;
+};
+
+#endif /* FEATURE_CACHE_H */
@@ -0,0 +1,239 @@
+#include "feature_set.h"
+
+#include "itkImageFileReader.h"
+#include "itkImageIOFactory.h"
+
+#include "channel_copy.h"
+#include "file_sync.h"
+#include "image_writer.h"
+
+#include <fstream>
+#include <map>
+#include <sstream>
+
+#include <boost/lexical_cast.hpp>
+#include <boost/regex.hpp>
+
+#ifdef USE_LOG4CXX
+	#include "log4cxx/logger.h"
+#endif
+
+typedef itk::ImageFileReader< OutputImageType > PartReader;
+
+bool FeatureSet::is_feature_set(const std::string filename)
+{
+	return boost::filesystem::path(filename).extension() == ".fset";
+}
+
+FeatureSet::FeatureSet(const std::string filename, const bool load, const bool compress) :
+	filename(filename),
+	compress(compress)
+{
+	if(!load || !boost::filesystem::exists(this->filename))
+		return;
+
+	std::ifstream description(filename.c_str());
+	if(!description)
+		throw FeatureSetException("Unable to read the feature set \"" + filename + "\"");
+
+	static const boost::regex part_line("^\\s*(.+?)\\s+(\\d+)\\s*$");
+	static const boost::regex ignored_line("^\\s*(#.*)?$");
+
+	std::string line;
+	while(std::getline(description, line))
+	{
+		boost::smatch match;
+		if(boost::regex_match(line, match, ignored_line))
+			continue;
+
+		if(!boost::regex_match(line, match, part_line))
+			throw FeatureSetException("Invalid line in the feature set \"" + filename + "\": " + line);
+
+		Part part;
+		part.filename = match[1];
+		part.channels = boost::lexical_cast< unsigned int >(match[2]);
+		this->parts.push_back(part);
+	}
+}
+
+const std::vector< FeatureSet::Part >& FeatureSet::get_parts() const
+{
+	return this->parts;
+}
+
+unsigned int FeatureSet::get_number_of_channels() const
+{
+	unsigned int channels = 0;
+	std::vector< Part >::const_iterator it;
+	for(it = this->parts.begin(); it != this->parts.end(); ++it)
+		channels += it->channels;
+	return channels;
+}
+
+boost::filesystem::path FeatureSet::part_path(const Part &part) const
+{
+	return this->filename.parent_path() / part.filename;
+}
+
+void FeatureSet::check_size(const OutputImageType::SizeType &size) const
+{
+	std::vector< Part >::const_iterator it;
+	for(it = this->parts.begin(); it != this->parts.end(); ++it)
+	{
+		const std::string path = this->part_path(*it).string();
+
+		itk::ImageIOBase::Pointer io = itk::ImageIOFactory::CreateImageIO(path.c_str(), itk::ImageIOFactory::ReadMode);
+		if(io.IsNull())
+			throw FeatureSetException("Unable to read the part \"" + path + "\"");
+
+		try {
+			io->SetFileName(path);
+			io->ReadImageInformation();
+		} catch( itk::ExceptionObject &ex ) {
+			throw FeatureSetException("Unable to read the part \"" + path + "\" (" + ex.what() + ")");
+		}
+
+		for(unsigned int i = 0; i < OutputImageType::ImageDimension; ++i)
+		{
+			const itk::SizeValueType dimension = i < io->GetNumberOfDimensions() ? io->GetDimensions(i) : 1;
+			if(dimension != size[i])
+				throw FeatureSetException("The size of the part \"" + path + "\" does not match the size of the image");
+		}
+
+		if(io->GetNumberOfComponents() != it->channels)
+			throw FeatureSetException("The number of channels of the part \"" + path + "\" does not match the feature set");
+	}
+}
+
+void FeatureSet::append(const OutputImageType *image)
+{
+	// Name the part after the description, without overwriting any existing file
+	Part part;
+	part.channels = image->GetNumberOfComponentsPerPixel();
+	for(unsigned int i = this->parts.size(); ; ++i)
+	{
+		std::ostringstream part_filename;
+		part_filename << this->filename.stem().string() << "." << i << ".mha";
+		part.filename = part_filename.str();
+
+		if(!boost::filesystem::exists(this->part_path(part)))
+			break;
+	}
+
+#ifdef USE_LOG4CXX
+	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+	LOG4CXX_INFO(logger, "Writing part \"" << this->part_path(part).string() << "\" (" << part.channels << " channels)");
+#endif
+
+	// Written under a temporary name, so that a part listed by the description is always whole on the disk
+	const boost::filesystem::path path = this->part_path(part);
+	const boost::filesystem::path tmp_path = this->filename.parent_path() / (path.stem().string() + ".tmp.mha");
+
+	try {
+		ImageWriter::write(image, tmp_path.string(), this->compress);
+
+		if(!file_sync::replace(tmp_path, path))
+			throw FeatureSetException("Unable to sync the part \"" + path.string() + "\"");
+	} catch(...) {
+		boost::system::error_code ignored;
+		boost::filesystem::remove(tmp_path, ignored);
+		throw;
+	}
+
+	this->parts.push_back(part);
+	this->save();
+}
+
+void FeatureSet::truncate(const unsigned int number_of_parts)
+{
+	if(number_of_parts >= this->parts.size())
+		return;
+
+	std::vector< Part >::const_iterator it;
+	for(it = this->parts.begin() + number_of_parts; it != this->parts.end(); ++it)
+	{
+		boost::system::error_code ignored;
+		boost::filesystem::remove(this->part_path(*it), ignored);
+	}
+
+	this->parts.resize(number_of_parts);
+	this->save();
+}
+
+void FeatureSet::save() const
+{
+	boost::filesystem::path tmp_filename = this->filename;
+	tmp_filename += ".tmp";
+
+	{
+		std::ofstream description(tmp_filename.string().c_str());
+		description << "# ImageFeaturesComputer feature set: <part> <number of channels>" << std::endl;
+
+		std::vector< Part >::const_iterator it;
+		for(it = this->parts.begin(); it != this->parts.end(); ++it)
+			description << it->filename << " " << it->channels << std::endl;
+
+		if(!description)
+			throw FeatureSetException("Unable to write the feature set \"" + this->filename.string() + "\"");
+	}
+
+	if(!file_sync::replace(tmp_filename, this->filename))
+		throw FeatureSetException("Unable to sync the feature set \"" + this->filename.string() + "\"");
+}
+
+OutputImageType::Pointer FeatureSet::read_channels(const std::vector< unsigned int > channels) const
+{
+	std::map< unsigned int, OutputImageType::Pointer > read_parts;
+	std::map< unsigned int, std::vector< channel_copy::ChannelPair > > part_channels;
+
+	for(unsigned int i = 0; i < channels.size(); ++i)
+	{
+		// Locate the part holding the channel
+		unsigned int part = 0, first_channel = 0;
+		while((part < this->parts.size()) && (channels[i] >= first_channel + this->parts[part].channels))
+			first_channel += this->parts[part++].channels;
+
+		if(part == this->parts.size())
+		{
+			std::ostringstream err;
+			err << "Channel #" << channels[i] + 1 << " does not exists";
+			throw FeatureSetException(err.str());
+		}
+
+		if(read_parts.find(part) == read_parts.end())
+		{
+			PartReader::Pointer reader = PartReader::New();
+			reader->SetFileName(this->part_path(this->parts[part]).string());
+
+			try {
+				reader->Update();
+			} catch( itk::ExceptionObject &ex ) {
+				throw FeatureSetException("Unable to read the part \"" + this->part_path(this->parts[part]).string() + "\" (" + ex.what() + ")");
+			}
+
+			if(!read_parts.empty() && (reader->GetOutput()->GetBufferedRegion() != read_parts.begin()->second->GetBufferedRegion()))
+				throw FeatureSetException("The part \"" + this->part_path(this->parts[part]).string() + "\" does not have the size of the other parts");
+
+			read_parts[part] = reader->GetOutput();
+		}
+
+		part_channels[part].push_back(channel_copy::ChannelPair(channels[i] - first_channel, i));
+	}
+
+	if(read_parts.empty())
+		throw FeatureSetException("No channels to read");
+
+	const OutputImageType *reference = read_parts.begin()->second;
+
+	OutputImageType::Pointer output_image = OutputImageType::New();
+	output_image->CopyInformation(reference);
+	output_image->SetRegions(reference->GetBufferedRegion());
+	output_image->SetVectorLength(channels.size());
+	output_image->Allocate();
+
+	std::map< unsigned int, OutputImageType::Pointer >::const_iterator it;
+	for(it = read_parts.begin(); it != read_parts.end(); ++it)
+		channel_copy::gather(it->second, part_channels[it->first], output_image);
+
+	return output_image;
+}
@@ -0,0 +1,93 @@
+#ifndef FEATURE_SET_H
+#define FEATURE_SET_H
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "datatypes.h"
+
+class FeatureSetException : public std::runtime_error
+{
+public:
+	FeatureSetException ( const std::string &err ) : std::runtime_error (err) {}
+};
+
+/**
+ * Features image stored as a set of images (the parts), each one holding some
+ * of the channels.
+ *
+ * The set is described by a text file (with the .fset extension) listing
+ * its parts, in channel order, one per line:
+ *
+ *     # comment
+ *     features.0.mha 8
+ *     features.1.mha 1
+ *
+ * where each line gives the file of the part (relative to the directory of
+ * the description) and its number of channels. Adding channels to a set only
+ * writes the new part, the existing ones are left untouched.
+ */
+class FeatureSet
+{
+public:
+	struct Part
+	{
+		std::string filename;
+		unsigned int channels;
+	};
+
+	/**
+	 * Tell whether a file describes a feature set (based on its extension).
+	 */
+	static bool is_feature_set(const std::string filename);
+
+	/**
+	 * @param[in] filename The description of the set.
+	 * @param[in] load Load the existing description (if any) instead of starting an empty set.
+	 * @param[in] compress Compress the parts written.
+	 */
+	FeatureSet(const std::string filename, const bool load, const bool compress = false);
+
+	const std::vector< Part >& get_parts() const;
+
+	unsigned int get_number_of_channels() const;
+
+	/**
+	 * Check that the parts of the set have a given size, by reading their headers.
+	 */
+	void check_size(const OutputImageType::SizeType &size) const;
+
+	/**
+	 * Write an image as a new part of the set (a MetaImage, see
+	 * ImageStreamWriter), and update the description. The part and then the
+	 * description are synced to the disk (see file_sync) before returning.
+	 * @throw ImageWritingException If the part cannot be written.
+	 * @throw FeatureSetException If the part or the description cannot be synced.
+	 */
+	void append(const OutputImageType *image);
+
+	/**
+	 * Remove the last parts of the set (and their files), keeping the first ones.
+	 */
+	void truncate(const unsigned int number_of_parts);
+
+	/**
+	 * Read some channels of the set. Only the parts holding these channels are read.
+	 * @param[in] channels The channels to read (0-based).
+	 */
+	OutputImageType::Pointer read_channels(const std::vector< unsigned int > channels) const;
+
+private:
+	boost::filesystem::path part_path(const Part &part) const;
+
+	void save() const;
+
+	boost::filesystem::path filename;
+	std::vector< Part > parts;
+	bool compress;
+};
+
+#endif /* FEATURE_SET_H */
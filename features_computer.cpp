@@ -12,17 +12,362 @@
 
 #include <string>
 #include <vector>
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
 #include <iostream>
+#include <limits>
 #include <sstream>
 
+#include <boost/scoped_ptr.hpp>
+
+#ifdef _OPENMP
+#  include <omp.h>
+#endif
+
 #include "FeaturesComputerLoader.h"
+#include "features_pipeline.h"
+#include "feature_cache.h"
+#include "feature_set.h"
+#include "checkpoint.h"
+#include "channel_copy.h"
+#include "channel_statistics.h"
+#include "async_writer.h"
+#include "image_writer.h"
+#include "npy_writer.h"
+#include "tuning_profile.h"
+#include "shard.h"
+
+/**
+ * Writes an image as a new part of a feature set, normalizing its channels
+ * first if needed (once it is cached, the jobs running in order). With a
+ * checkpoint, records the parts of the set once the part and the description
+ * are synced, so that the journal never lists a part which is not on the disk.
+ */
+class PartWritingJob : public AsyncWriter::Job
+{
+public:
+	PartWritingJob(FeatureSet &feature_set, OutputImageType::Pointer image, const ChannelStatistics::Normalization normalization,
+			Checkpoint *checkpoint = NULL, const unsigned int computers = 0) :
+		feature_set(feature_set), image(image), normalization(normalization), checkpoint(checkpoint), computers(computers) {}
+
+	virtual void run()
+	{
+		if(this->normalization != ChannelStatistics::NoNormalization)
+		{
+			ChannelStatistics statistics(this->image->GetNumberOfComponentsPerPixel());
+			statistics.gather(this->image, 0, statistics.get_number_of_channels());
+			statistics.normalize(this->image, this->normalization);
+		}
+
+		this->feature_set.append(this->image);
+
+		if(this->checkpoint)
+			this->checkpoint->record_set(this->computers, this->feature_set.get_parts().size());
+	}
+
+	virtual size_t size() const { return this->image->GetPixelContainer()->Size() * sizeof(OutputImageType::InternalPixelType); }
+
+private:
+	FeatureSet &feature_set;
+	OutputImageType::Pointer image;
+	const ChannelStatistics::Normalization normalization;
+	Checkpoint *checkpoint;
+	const unsigned int computers;
+};
+
+/**
+ * Stores an image in the cache.
+ */
+class CacheStoringJob : public AsyncWriter::Job
+{
+public:
+	CacheStoringJob(FeatureCache &cache, const std::string key, OutputImageType::Pointer image) :
+		cache(cache), key(key), image(image) {}
+
+	virtual void run() { this->cache.store(this->key, this->image); }
+
+	virtual size_t size() const { return this->image->GetPixelContainer()->Size() * sizeof(OutputImageType::InternalPixelType); }
+
+private:
+	FeatureCache &cache;
+	const std::string key;
+	OutputImageType::Pointer image;
+};
+
+/**
+ * Stores the output of a computer in the checkpoint.
+ */
+class PartCheckpointJob : public AsyncWriter::Job
+{
+public:
+	PartCheckpointJob(Checkpoint &checkpoint, const unsigned int computer, OutputImageType::Pointer image) :
+		checkpoint(checkpoint), computer(computer), image(image) {}
 
-#include "itkComposeVectorImageFilter.h"
+	virtual void run() { this->checkpoint.store_part(this->computer, this->image); }
 
-#include "itkImageFileWriter.h"
+	virtual size_t size() const { return this->image->GetPixelContainer()->Size() * sizeof(OutputImageType::InternalPixelType); }
 
-typedef itk::ComposeVectorImageFilter< OutputImageType, OutputImageType> JoinImageFilterType;
-typedef itk::ImageFileWriter< OutputImageType > OutputImageWriter;
+private:
+	Checkpoint &checkpoint;
+	const unsigned int computer;
+	OutputImageType::Pointer image;
+};
+
+/**
+ * Stores in the checkpoint the channels of a computer in the final image,
+ * computed by slabs, while the next computers write their own channels.
+ */
+class ChannelsCheckpointJob : public AsyncWriter::Job
+{
+public:
+	ChannelsCheckpointJob(Checkpoint &checkpoint, const unsigned int computer, OutputImageType::Pointer image, const unsigned int first_channel, const unsigned int number_of_channels) :
+		checkpoint(checkpoint), computer(computer), image(image), first_channel(first_channel), number_of_channels(number_of_channels) {}
+
+	virtual void run()
+	{
+		OutputImageType::Pointer part = OutputImageType::New();
+		part->CopyInformation(this->image);
+		part->SetRegions(this->image->GetBufferedRegion());
+		part->SetVectorLength(this->number_of_channels);
+		part->Allocate();
+
+		std::vector< channel_copy::ChannelPair > channels;
+		for(unsigned int c = 0; c < this->number_of_channels; ++c)
+			channels.push_back(channel_copy::ChannelPair(this->first_channel + c, c));
+		channel_copy::gather(this->image, channels, part);
+
+		this->checkpoint.store_part(this->computer, part);
+	}
+
+	virtual size_t size() const { return this->image->GetBufferedRegion().GetNumberOfPixels() * this->number_of_channels * sizeof(OutputImageType::InternalPixelType); }
+
+private:
+	Checkpoint &checkpoint;
+	const unsigned int computer;
+	OutputImageType::Pointer image;
+	const unsigned int first_channel;
+	const unsigned int number_of_channels;
+};
+
+/**
+ * Writes planes of the final image, already computed, to its file (the
+ * image itself holding them until the job is run).
+ */
+class SlabWritingJob : public AsyncWriter::Job
+{
+public:
+	SlabWritingJob(ImageStreamWriter &stream, const unsigned int first_plane, const unsigned int number_of_planes, const size_t plane_size) :
+		stream(stream), first_plane(first_plane), number_of_planes(number_of_planes), plane_size(plane_size) {}
+
+	virtual void run() { this->stream.write_planes(this->first_plane, this->number_of_planes); }
+
+	virtual size_t size() const { return this->number_of_planes * this->plane_size; }
+
+private:
+	ImageStreamWriter &stream;
+	const unsigned int first_plane;
+	const unsigned int number_of_planes;
+	const size_t plane_size;
+};
+
+const unsigned long long MiB = 1024 * 1024;
+
+/**
+ * Estimated peak memory of a run, in bytes.
+ * @param[in] slab_depth The number of planes the tileable computers run on at
+ *            once, the outputs being written directly in the final image (0 to
+ *            run them on the whole image).
+ */
+unsigned long long estimate_peak(const FeaturesPipeline &pipeline, const std::vector< FeaturesEstimate > &estimates, const InputImageType::SizeType &size, const unsigned int slab_depth, const bool to_feature_set, const unsigned long long write_buffer)
+{
+	const unsigned long long number_of_pixels = static_cast< unsigned long long >(size[0]) * size[1] * size[2];
+
+	unsigned long long total_output = 0;
+	for(unsigned int i = 0; i < estimates.size(); ++i)
+		total_output += number_of_pixels * estimates[i].channels * sizeof(OutputImageType::InternalPixelType);
+
+	// The input, and the final image when it is allocated first (the outputs
+	// being copied in it as soon as they are computed)
+	const bool preallocated = !to_feature_set && ((slab_depth > 0) || (estimates.size() > 1));
+	const unsigned long long base = number_of_pixels + (preallocated ? total_output : 0);
+
+	// Outputs kept while the next computers run (waiting to be written)
+	unsigned long long kept = 0, peak = 0;
+	for(unsigned int i = 0; i < estimates.size(); ++i)
+	{
+		const unsigned long long output = number_of_pixels * estimates[i].channels * sizeof(OutputImageType::InternalPixelType);
+
+		unsigned long long working = estimates[i].bytes;
+		if((slab_depth > 0) && estimates[i].tileable && (slab_depth < size[2]))
+		{
+			InputImageType::SizeType slab_size = size;
+			slab_size[2] = std::min< unsigned long long >(slab_depth + 2 * estimates[i].halo[2], size[2]);
+			working = pipeline.estimate(i, slab_size).bytes + (to_feature_set ? output : 0);
+		}
+
+		peak = std::max(peak, kept + working);
+
+		if(to_feature_set)
+			kept = std::min(kept + output, write_buffer);
+	}
+
+	return base + peak;
+}
+
+/**
+ * Print the estimates of the computers and of the whole run.
+ */
+void print_plan(std::ostream &os, const FeaturesPipeline &pipeline, const std::vector< FeaturesEstimate > &estimates, const InputImageType::SizeType &size, const unsigned int slab_depth, const unsigned long long peak)
+{
+	const unsigned long long number_of_pixels = static_cast< unsigned long long >(size[0]) * size[1] * size[2];
+
+	os << "Image: " << size[0] << "x" << size[1] << "x" << size[2] << " voxels" << std::endl;
+	os << std::left << std::setw(20) << "Computer" << std::setw(10) << "Channels" << std::setw(12) << "Halo"
+		<< std::setw(14) << "Memory (MiB)" << std::setw(14) << "Cost (Gop)" << "Tileable" << std::endl;
+
+	unsigned int channels = 0;
+	double cost = 0;
+	for(unsigned int i = 0; i < estimates.size(); ++i)
+	{
+		std::ostringstream halo;
+		halo << estimates[i].halo[0] << "," << estimates[i].halo[1] << "," << estimates[i].halo[2];
+
+		os << std::left << std::setw(20) << pipeline.get_computer_name(i) << std::setw(10) << estimates[i].channels << std::setw(12) << halo.str()
+			<< std::setw(14) << std::fixed << std::setprecision(1) << estimates[i].bytes / static_cast< double >(MiB)
+			<< std::setw(14) << std::setprecision(3) << estimates[i].cost / 1e9
+			<< (estimates[i].tileable ? "yes" : "no") << std::endl;
+
+		channels += estimates[i].channels;
+		cost += estimates[i].cost;
+	}
+
+	os << "Output: " << channels << " channels, " << std::setprecision(1)
+		<< number_of_pixels * channels * sizeof(OutputImageType::InternalPixelType) / static_cast< double >(MiB) << " MiB" << std::endl;
+	os << "Cost: " << std::setprecision(3) << cost / 1e9 << " Gop" << std::endl;
+	os << "Peak memory: " << std::setprecision(1) << peak / static_cast< double >(MiB) << " MiB";
+	if(slab_depth > 0)
+		os << " (slabs of " << slab_depth << " planes)";
+	os << std::endl;
+}
+
+typedef std::chrono::steady_clock Clock;
+
+// Runs of a setting timed by the autotuning, the fastest one counting
+const unsigned int autotune_runs = 2;
+
+// Tile sizes tried by the autotuning, by halving or doubling the default ones
+const int autotune_tile_shifts = 4;
+
+/**
+ * Sub-volume at the center of an image, of at most edge voxels along each
+ * axis, read without loading the whole image when its format allows it.
+ */
+InputImageType::Pointer central_subvolume(const std::string filename, const unsigned int edge)
+{
+	const InputImageType::SizeType size = ImageLoader::size(filename);
+
+	InputImageType::RegionType region;
+	for(unsigned int i = 0; i < InputImageType::ImageDimension; ++i)
+	{
+		const itk::SizeValueType subvolume_size = std::min< itk::SizeValueType >(size[i], edge);
+		region.SetIndex(i, (size[i] - subvolume_size) / 2);
+		region.SetSize(i, subvolume_size);
+	}
+
+	return ImageLoader::load(filename, region);
+}
+
+/**
+ * Time of the fastest of a few runs of a computer, as tuned, in seconds
+ * (infinite if it fails).
+ */
+double time_computer(FeaturesPipeline &pipeline, const unsigned int computer, const Tuning &tuning, InputImageType::Pointer image)
+{
+	pipeline.set_tuning(computer, tuning);
+
+	double fastest = std::numeric_limits< double >::infinity();
+	for(unsigned int run = 0; run < autotune_runs; ++run)
+	{
+		const Clock::time_point started = Clock::now();
+		try {
+			pipeline.compute(computer, image);
+		} catch(std::exception &ex) {
+#ifdef USE_LOG4CXX
+			log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+			LOG4CXX_WARN(logger, "Tuning of " << pipeline.get_computer_name(computer) << " discarded (" << ex.what() << ")");
+#endif
+			return std::numeric_limits< double >::infinity();
+		}
+		fastest = std::min(fastest, std::chrono::duration< double >(Clock::now() - started).count());
+	}
+
+	return fastest;
+}
+
+/**
+ * Tune a computer on an image: the size of its tiles (when it computes by
+ * tiles), then its number of threads, each setting being the fastest with the
+ * ones already chosen. Its options are left as they are, other options (e.g.
+ * another engine) not computing exactly the same features.
+ */
+Tuning autotune(FeaturesPipeline &pipeline, const unsigned int computer, InputImageType::Pointer image)
+{
+#ifdef _OPENMP
+	const unsigned int max_threads = omp_get_max_threads();
+#else
+	const unsigned int max_threads = 1;
+#endif
+
+	// The tiles of a computer ignoring them would time the same setting again
+	const bool tiled = !pipeline.has_estimate(computer) || pipeline.estimate(computer, image->GetLargestPossibleRegion().GetSize()).tiled;
+
+	Tuning best;
+	const double untuned = time_computer(pipeline, computer, best, image);
+	double fastest = untuned;
+
+	std::vector< Tuning > candidates;
+	for(unsigned int stage = 0; stage < 2; ++stage)
+	{
+		candidates.clear();
+		if(stage == 0) {
+			// The powers of 2 from 1/16 to 16 times the default tiles
+			for(int shift = -autotune_tile_shifts; tiled && (shift <= autotune_tile_shifts); ++shift)
+			{
+				if(shift == 0)
+					continue;
+
+				candidates.push_back(best);
+				candidates.back().tile_voxels = shift < 0 ? TileScheduler::default_tile_voxels >> -shift : TileScheduler::default_tile_voxels << shift;
+			}
+		} else {
+			for(unsigned int threads = 1; threads < max_threads; threads *= 2)
+			{
+				candidates.push_back(best);
+				candidates.back().threads = threads;
+			}
+		}
+
+		for(unsigned int i = 0; i < candidates.size(); ++i)
+		{
+			const double time = time_computer(pipeline, computer, candidates[i], image);
+			if(time < fastest)
+			{
+				fastest = time;
+				best = candidates[i];
+			}
+		}
+	}
+
+	pipeline.set_tuning(computer, best);
+
+	std::cout << "Tuned: " << pipeline.get_computer_name(computer) << ", " << std::fixed << std::setprecision(3)
+		<< fastest << " s (untuned: " << untuned << " s), "
+		<< (best.threads > 0 ? best.threads : max_threads) << " threads, tiles of "
+		<< (best.tile_voxels > 0 ? best.tile_voxels : TileScheduler::default_tile_voxels) << " voxels" << std::endl;
+
+	return best;
+}
 
 int main(int argc, char** argv)
 {
@@ -73,6 +418,170 @@ int main(int argc, char** argv)
 		exit(parse_result);
 	}
 
+	boost::scoped_ptr< FeatureSet > feature_set;
+	if(FeatureSet::is_feature_set(cli_parser.get_output_image()))
+	{
+		try {
+			feature_set.reset(new FeatureSet(cli_parser.get_output_image(), cli_parser.get_append(), cli_parser.get_compress()));
+		} catch(FeatureSetException &ex) {
+#ifdef USE_LOG4CXX
+			LOG4CXX_FATAL(logger, ex.what());
+#endif
+			return -1;
+		}
+	} else if(cli_parser.get_append()) {
+#ifdef USE_LOG4CXX
+		LOG4CXX_FATAL(logger, "Channels can only be appended to a feature set (.fset) output");
+#endif
+		return -1;
+	}
+
+	const ChannelStatistics::Normalization normalization = ChannelStatistics::normalization(cli_parser.get_normalize_channels());
+
+	std::vector< std::string > computers = cli_parser.get_computers();
+	std::vector< std::vector< std::string > > computers_options = cli_parser.get_computers_options();
+
+	FeaturesPipeline pipeline;
+	try {
+		for (unsigned int i = 0; i < computers.size(); ++i)
+			pipeline.add_computer(computers.at(i), computers_options.at(i));
+	} catch (FeaturesComputerLoadingException &ex) {
+#ifdef USE_LOG4CXX
+		LOG4CXX_FATAL(logger, ex.what());
+#endif
+		return -1;
+	}
+
+	// The computers run as tuned on this host, unless they are being tuned
+	boost::scoped_ptr< TuningProfile > tuning_profile;
+	try {
+		tuning_profile.reset(new TuningProfile(cli_parser.get_tuning_file().empty() ? TuningProfile::default_filename() : cli_parser.get_tuning_file()));
+
+		for (unsigned int i = 0; (i < pipeline.get_number_of_computers()) && !cli_parser.get_autotune(); ++i)
+		{
+			Tuning tuning;
+			if(tuning_profile->find(TuningProfile::key(pipeline.get_computer_name(i), pipeline.get_normalized_options(i)), tuning))
+			{
+#ifdef USE_LOG4CXX
+				LOG4CXX_INFO(logger, "Tuned: " << pipeline.get_computer_name(i) << " (" << tuning.threads << " threads, tiles of " << tuning.tile_voxels << " voxels, 0 meaning the default)");
+#endif
+				pipeline.set_tuning(i, tuning);
+			}
+		}
+	} catch( std::exception &ex) {
+#ifdef USE_LOG4CXX
+		LOG4CXX_FATAL(logger, ex.what());
+#endif
+		return -1;
+	}
+
+	// The options are validated, and the run planned, before loading the image
+	const bool planning = cli_parser.get_plan() || (cli_parser.get_memory_limit() > 0);
+	InputImageType::SizeType input_size;
+	std::vector< FeaturesEstimate > estimates;
+	boost::scoped_ptr< Shard > shard;
+	try {
+		input_size = ImageLoader::size(cli_parser.get_input_image());
+
+		// A shard needs the halos of the computers
+		if(cli_parser.get_shard_count() > 0)
+			shard.reset(new Shard(cli_parser.get_shard_index(), cli_parser.get_shard_count(), input_size));
+
+		for (unsigned int i = 0; i < pipeline.get_number_of_computers(); ++i)
+		{
+			if(pipeline.has_estimate(i))
+				estimates.push_back(pipeline.estimate(i, input_size));
+			else if(planning || shard)
+				throw FeaturesComputerLoadingException(pipeline.get_computer_name(i) + " does not provide estimates");
+
+			// Each shard would compute the whole image
+			if(shard && !estimates[i].tileable && !estimates[i].planes && !pipeline.has_kernel(i))
+				throw ShardException(pipeline.get_computer_name(i) + " depends on the whole image and cannot run in a shard (with these options)");
+		}
+	} catch( std::exception &ex) {
+#ifdef USE_LOG4CXX
+		LOG4CXX_FATAL(logger, ex.what());
+#endif
+		return -1;
+	}
+
+	if(cli_parser.get_autotune())
+	{
+		try {
+			InputImageType::Pointer subvolume = central_subvolume(cli_parser.get_input_image(), cli_parser.get_autotune_size());
+
+			for (unsigned int i = 0; i < pipeline.get_number_of_computers(); ++i)
+			{
+				std::cout << "Tuning: " << pipeline.get_computer_name(i) << std::endl;
+				const Tuning tuning = autotune(pipeline, i, subvolume);
+				tuning_profile->set(TuningProfile::key(pipeline.get_computer_name(i), pipeline.get_normalized_options(i)), tuning);
+			}
+
+			tuning_profile->save();
+		} catch( std::exception &ex) {
+#ifdef USE_LOG4CXX
+			LOG4CXX_FATAL(logger, ex.what());
+#endif
+			return -1;
+		}
+
+		std::cout << "Tuning profile: " << tuning_profile->get_filename() << std::endl;
+		return 0;
+	}
+
+	unsigned int slab_depth = 0;
+	if(planning)
+	{
+		const unsigned long long limit = cli_parser.get_memory_limit() * MiB;
+		const unsigned long long write_buffer = cli_parser.get_write_buffer_size() * MiB;
+		const bool to_feature_set = feature_set.get() != NULL;
+
+		unsigned long long peak = estimate_peak(pipeline, estimates, input_size, 0, to_feature_set, write_buffer);
+		bool fits = (limit == 0) || (peak <= limit);
+
+		if(!fits)
+		{
+			// The deepest slabs that fit, the peak growing with their depth
+			unsigned int shallowest = 1, deepest = input_size[2];
+			peak = estimate_peak(pipeline, estimates, input_size, shallowest, to_feature_set, write_buffer);
+			fits = peak <= limit;
+
+			while(fits && (shallowest < deepest))
+			{
+				const unsigned int depth = (shallowest + deepest + 1) / 2;
+				if(estimate_peak(pipeline, estimates, input_size, depth, to_feature_set, write_buffer) <= limit)
+					shallowest = depth;
+				else
+					deepest = depth - 1;
+			}
+
+			if(fits)
+			{
+				slab_depth = shallowest;
+				peak = estimate_peak(pipeline, estimates, input_size, slab_depth, to_feature_set, write_buffer);
+			}
+		}
+
+		if(cli_parser.get_plan())
+			print_plan(std::cout, pipeline, estimates, input_size, slab_depth, peak);
+
+		if(!fits)
+		{
+#ifdef USE_LOG4CXX
+			LOG4CXX_FATAL(logger, "The estimated peak memory (" << peak / MiB << " MiB) exceeds the limit (" << limit / MiB << " MiB), even by slabs of one plane");
+#endif
+			return -1;
+		}
+
+		if(cli_parser.get_plan())
+			return 0;
+
+#ifdef USE_LOG4CXX
+		if(slab_depth > 0)
+			LOG4CXX_INFO(logger, "Computing by slabs of " << slab_depth << " planes to fit in " << limit / MiB << " MiB");
+#endif
+	}
+
 	InputImageType::Pointer input_image;
 	try {
 		input_image = ImageLoader::load(cli_parser.get_input_image());
@@ -80,52 +589,364 @@ int main(int argc, char** argv)
 #ifdef USE_LOG4CXX
 		LOG4CXX_FATAL(logger, ex.what());
 #endif
+		return -1;
 	}
 
-	std::vector< std::string > computers = cli_parser.get_computers();
-	std::vector< std::vector< std::string > > computers_options = cli_parser.get_computers_options();
+	// A shard only computes its planes, the shards being assembled by features_merge
+	if(shard)
+	{
+		std::cout << "Running: shard " << shard->get_index() << "/" << shard->get_count() << ", planes " << shard->get_first_plane()
+			<< " to " << shard->get_first_plane() + shard->get_number_of_planes() - 1 << std::endl;
+
+		try {
+			// The run is identified by its input and its computers, for features_merge to refuse the shards of another run
+			const boost::uint64_t input_hash = FeatureCache::hash(input_image);
+			std::ostringstream run;
+			for (unsigned int i = 0; i < pipeline.get_number_of_computers(); ++i)
+				run << FeatureCache::key(input_hash, pipeline.get_computer_name(i), pipeline.get_computer_version(i), pipeline.get_normalized_options(i));
+			shard->set_run(FeatureCache::digest(run.str()));
+
+			OutputImageType::Pointer output = pipeline.compute_planes(input_image, shard->get_first_plane(), shard->get_number_of_planes());
+			shard->record(output);
+			ImageWriter::write(output, cli_parser.get_output_image(), cli_parser.get_compress());
+		} catch( std::exception &ex) {
+#ifdef USE_LOG4CXX
+			LOG4CXX_FATAL(logger, ex.what());
+#endif
+			return -1;
+		}
+
+		std::cout << "Done" << std::endl;
+		return 0;
+	}
+
+	if(feature_set)
+	{
+		try {
+			feature_set->check_size(input_image->GetLargestPossibleRegion().GetSize());
+		} catch(FeatureSetException &ex) {
+#ifdef USE_LOG4CXX
+			LOG4CXX_FATAL(logger, ex.what());
+#endif
+			return -1;
+		}
+	}
+
+	// The voxels written to a .npy matrix, when not all of them
+	std::vector< boost::uint64_t > voxels;
+	const bool select_voxels = !cli_parser.get_mask().empty() || (cli_parser.get_sample() > 0);
+	if(select_voxels)
+	{
+		try {
+			InputImageType::Pointer mask;
+			if(!cli_parser.get_mask().empty())
+				mask = ImageLoader::load(cli_parser.get_mask());
+
+			voxels = NpyWriter::select_voxels(mask, input_image->GetBufferedRegion().GetSize(), cli_parser.get_sample(), cli_parser.get_seed());
+		} catch(std::exception &ex) {
+#ifdef USE_LOG4CXX
+			LOG4CXX_FATAL(logger, ex.what());
+#endif
+			return -1;
+		}
+	}
+
+	boost::scoped_ptr< FeatureCache > cache;
+	if(!cli_parser.get_cache_dir().empty())
+	{
+		try {
+			cache.reset(new FeatureCache(cli_parser.get_cache_dir(), cli_parser.get_cache_size() * 1024 * 1024, cli_parser.get_compress()));
+		} catch(boost::filesystem::filesystem_error &ex) {
+#ifdef USE_LOG4CXX
+			LOG4CXX_FATAL(logger, "Unable to use the cache directory (" << ex.what() << ")");
+#endif
+			return -1;
+		}
+	}
+
+	boost::uint64_t input_hash = 0;
+	if(cache || !cli_parser.get_checkpoint_dir().empty())
+		input_hash = FeatureCache::hash(input_image);
+
+	// Computers already done by an interrupted run
+	boost::scoped_ptr< Checkpoint > checkpoint;
+	unsigned int first_computer = 0;
+	if(!cli_parser.get_checkpoint_dir().empty())
+	{
+		// The run is identified by its input, its output and its computers
+		std::ostringstream signature;
+		signature << cli_parser.get_output_image() << std::endl
+			<< (cli_parser.get_append() ? "append" : "create") << std::endl
+			<< (slab_depth > 0 ? "slabs" : "whole") << std::endl
+			<< cli_parser.get_normalize_channels() << std::endl;
+		for (unsigned int i = 0; i < pipeline.get_number_of_computers(); ++i)
+			signature << FeatureCache::key(input_hash, pipeline.get_computer_name(i), pipeline.get_computer_version(i), pipeline.get_normalized_options(i));
+
+		try {
+			checkpoint.reset(new Checkpoint(cli_parser.get_checkpoint_dir(), signature.str(), cli_parser.get_compress()));
+
+			unsigned int parts;
+			if(feature_set && checkpoint->get_set(first_computer, parts))
+			{
+				// The set as it was after the last recorded part
+				feature_set.reset(new FeatureSet(cli_parser.get_output_image(), true, cli_parser.get_compress()));
+				feature_set->truncate(parts);
+			} else if(feature_set) {
+				checkpoint->record_set(0, feature_set->get_parts().size());
+			}
+		} catch(std::exception &ex) {
+#ifdef USE_LOG4CXX
+			LOG4CXX_FATAL(logger, ex.what());
+#endif
+			return -1;
+		}
+
+#ifdef USE_LOG4CXX
+		if(first_computer > 0)
+			LOG4CXX_INFO(logger, "Resuming after " << first_computer << " computers");
+#endif
+	}
 
+	// Streamed, the final image is written by slabs (declared first, the
+	// writer dropping the slabs queued before the stream is closed)
+	boost::scoped_ptr< ImageStreamWriter > stream;
+
+	// Outputs are written by another thread while the next features are computed
+	AsyncWriter async_writer(cli_parser.get_write_buffer_size() * 1024 * 1024);
+	std::vector< OutputImageType::Pointer > outputs;
+
+	// The final image is allocated first: computed by slabs, the features are
+	// written directly in it, otherwise each output is copied in it (and freed)
+	// as soon as it is computed
 	OutputImageType::Pointer output_image;
+	unsigned int first_channel = 0;
+
+	// The statistics of the channels to normalize are gathered as they are copied in the final image
+	boost::scoped_ptr< ChannelStatistics > statistics;
 
-	for (int i = 0; i < computers.size(); ++i)
+	// Without anything else to keep, the final image is written to its file by
+	// slabs while the next ones are computed (MetaImage and NRRD only)
+	const bool streaming = !feature_set && !cache && !checkpoint && !select_voxels
+		&& (normalization == ChannelStatistics::NoNormalization)
+		&& (estimates.size() == pipeline.get_number_of_computers())
+		&& ImageStreamWriter::can_stream(cli_parser.get_output_image());
+
+	if(!feature_set && (estimates.size() == pipeline.get_number_of_computers()) && (streaming || (slab_depth > 0) || (estimates.size() > 1)))
 	{
-		std::cout << "Running: " << computers.at(i) << std::endl;
+		unsigned int number_of_channels = 0;
+		for (unsigned int i = 0; i < estimates.size(); ++i)
+			number_of_channels += estimates[i].channels;
+
+		output_image = FeaturesPipeline::allocate(input_image, number_of_channels);
 
-		FeaturesComputerLoader p(computers.at(i));
+		if(normalization != ChannelStatistics::NoNormalization)
+			statistics.reset(new ChannelStatistics(number_of_channels));
+	}
 
+	if(streaming)
+	{
+		const InputImageType::SizeType size = input_image->GetBufferedRegion().GetSize();
+		const size_t plane_size = static_cast< size_t >(size[0]) * size[1] * output_image->GetNumberOfComponentsPerPixel() * sizeof(OutputImageType::InternalPixelType);
+
+		// Slabs small enough for several of them to be queued, deep enough for
+		// the halos of the tileable computers not to be computed too often
+		unsigned int depth = slab_depth;
+		if(depth == 0)
+		{
+			unsigned int halo = 0;
+			for (unsigned int i = 0; i < estimates.size(); ++i)
+				halo = std::max< unsigned int >(halo, estimates[i].halo[2]);
+
+			depth = std::min< unsigned long long >(size[2] / 16, cli_parser.get_write_buffer_size() * MiB / (4 * std::max< size_t >(plane_size, 1)));
+			depth = std::min< unsigned int >(std::max(depth, std::max(4 * halo, 1u)), std::max< unsigned int >(size[2], 1));
+		}
+
+		try {
+			stream.reset(new ImageStreamWriter(output_image, cli_parser.get_output_image(), cli_parser.get_compress()));
+
+			pipeline.compute_slabs(input_image, depth, output_image, [&](const unsigned int first_plane, const unsigned int number_of_planes) {
+				async_writer.submit(new SlabWritingJob(*stream, first_plane, number_of_planes, plane_size));
+			});
+
+			async_writer.finish();
+			stream->close();
+		} catch( std::exception &ex) {
 #ifdef USE_LOG4CXX
-		p->setLogger(logger);
+			LOG4CXX_FATAL(logger, ex.what());
 #endif
+			return -1;
+		}
 
-		OutputImageType::Pointer output;
+		for (unsigned int i = 0; i < pipeline.get_number_of_computers(); ++i)
+			std::cout << "Done: " << pipeline.get_computer_name(i) << " (streamed)" << std::endl;
+
+		return 0;
+	}
+
+	// Without a cache nor a checkpoint keeping the output of each computer,
+	// the computers providing a neighborhood kernel run together, in a single
+	// sweep of the input writing directly in the final image
+	std::vector< bool > fused(pipeline.get_number_of_computers(), false);
+	if(output_image.IsNotNull() && !cache && !checkpoint)
+	{
+		std::vector< unsigned int > computers, first_channels;
+		unsigned int channel = 0;
+		for (unsigned int i = 0; i < pipeline.get_number_of_computers(); ++i)
+		{
+			computers.push_back(i);
+			first_channels.push_back(channel);
+			channel += estimates[i].channels;
+		}
 
-		// use the class
 		try {
-			output = p->compute(input_image, computers_options.at(i));
+			// The statistics of the channels are gathered by the threads from the tiles they compute
+			const std::vector< unsigned int > swept = pipeline.compute_fused(computers, input_image, output_image->GetBufferPointer(), output_image->GetNumberOfComponentsPerPixel(), first_channels, statistics.get());
+
+			for (unsigned int i = 0; i < swept.size(); ++i)
+			{
+				std::cout << "Done: " << pipeline.get_computer_name(swept[i]) << " (single sweep)" << std::endl;
+				fused[swept[i]] = true;
+			}
 		} catch( std::exception &ex) {
 #ifdef USE_LOG4CXX
 			LOG4CXX_FATAL(logger, ex.what());
 #endif
 			return -1;
 		}
+	}
 
-		if(output_image.IsNull()) {
-			output_image = output;
-		} else {
-			JoinImageFilterType::Pointer joinFilter = JoinImageFilterType::New();
-			joinFilter->SetInput1(output_image);
-			joinFilter->SetInput2(output);
-			joinFilter->Update();
+	for (unsigned int i = first_computer; i < pipeline.get_number_of_computers(); ++i)
+	{
+		if(fused[i])
+		{
+			first_channel += estimates[i].channels;
+			continue;
+		}
+
+		std::cout << "Running: " << pipeline.get_computer_name(i) << std::endl;
+
+		OutputImageType::Pointer output;
+		bool computed = false;
+
+		try {
+			if(checkpoint && !feature_set)
+				output = checkpoint->load_part(i);
+
+			std::string cache_key;
+			if(cache && output.IsNull())
+			{
+				cache_key = FeatureCache::key(input_hash, pipeline.get_computer_name(i), pipeline.get_computer_version(i), pipeline.get_normalized_options(i));
+				output = cache->load(cache_key);
+			}
+
+			if(output.IsNull())
+			{
+				computed = true;
+
+				if(slab_depth == 0) {
+					output = pipeline.compute(i, input_image);
+				} else if(feature_set) {
+					output = FeaturesPipeline::allocate(input_image, estimates[i].channels);
+					pipeline.compute(i, input_image, slab_depth, output, 0);
+				} else {
+					// No output of the computer alone to cache
+					pipeline.compute(i, input_image, slab_depth, output_image, first_channel, statistics.get());
+				}
+
+				if(cache && output.IsNotNull())
+					async_writer.submit(new CacheStoringJob(*cache, cache_key, output));
+			}
 
-			output_image = joinFilter->GetOutput();
+			if(feature_set) {
+				async_writer.submit(new PartWritingJob(*feature_set, output, normalization, checkpoint.get(), i + 1));
+			} else {
+				if(checkpoint && computed && output.IsNotNull())
+					async_writer.submit(new PartCheckpointJob(*checkpoint, i, output));
+
+				if(output_image.IsNull()) {
+					outputs.push_back(output);
+				} else {
+					if(output.IsNotNull()) {
+						if(output->GetNumberOfComponentsPerPixel() != estimates[i].channels)
+							throw FeaturesPipelineException("The channels computed by " + pipeline.get_computer_name(i) + " differ from its estimate");
+						FeaturesPipeline::copy_channels(output, 0, output_image, 0, input_size[2], first_channel, statistics.get());
+					} else if(checkpoint && computed) {
+						// Computed by slabs in the final image: only the channels of this computer are stored
+						async_writer.submit(new ChannelsCheckpointJob(*checkpoint, i, output_image, first_channel, estimates[i].channels));
+					}
+
+					first_channel += estimates[i].channels;
+				}
+			}
+		} catch( std::exception &ex) {
+#ifdef USE_LOG4CXX
+			LOG4CXX_FATAL(logger, ex.what());
+#endif
+			return -1;
 		}
 
 		std::cout << "Done" << std::endl;
 	}
 
-	OutputImageWriter::Pointer writer = OutputImageWriter::New();
-	writer->SetInput(output_image);
-	writer->SetFileName(cli_parser.get_output_image());
-	writer->Update();
+	try {
+		async_writer.finish();
+	} catch( std::exception &ex) {
+#ifdef USE_LOG4CXX
+		LOG4CXX_FATAL(logger, ex.what());
+#endif
+		return -1;
+	}
+
+	if(feature_set)
+	{
+		if(checkpoint)
+			checkpoint->clear();
+		return 0;
+	}
+
+	// All the outputs are composed at once
+	if(output_image.IsNull())
+		output_image = FeaturesPipeline::compose(outputs);
+	outputs.clear();
+
+	// Written as a MetaImage or a NRRD file, the channels are rescaled chunk by
+	// chunk as they are written, instead of in a pass of their own
+	const bool rescale_while_writing = !select_voxels && ImageStreamWriter::can_stream(cli_parser.get_output_image());
+	ChannelRescale rescale;
+
+	if(normalization != ChannelStatistics::NoNormalization)
+	{
+		// The composed outputs were not copied: their statistics are gathered now
+		if(!statistics)
+		{
+			statistics.reset(new ChannelStatistics(output_image->GetNumberOfComponentsPerPixel()));
+			statistics->gather(output_image, 0, statistics->get_number_of_channels());
+		}
+
+		if(rescale_while_writing) {
+			rescale = statistics->rescale(normalization);
+			statistics->record(output_image, normalization);
+		} else {
+			statistics->normalize(output_image, normalization);
+		}
+	}
+
+	try {
+		if(select_voxels) {
+			NpyWriter::write(output_image, cli_parser.get_output_image(), voxels);
+			NpyWriter::write_indices(voxels, NpyWriter::indices_filename(cli_parser.get_output_image()));
+		} else {
+			const bool rescaled = rescale_while_writing && (normalization != ChannelStatistics::NoNormalization);
+			ImageWriter::write(output_image, cli_parser.get_output_image(), cli_parser.get_compress(), rescaled ? &rescale : NULL);
+		}
+	} catch( ImageWritingException &ex) {
+#ifdef USE_LOG4CXX
+		LOG4CXX_FATAL(logger, ex.what());
+#endif
+		return -1;
+	}
+
+	if(checkpoint)
+		checkpoint->clear();
 }
 
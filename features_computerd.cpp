@@ -0,0 +1,458 @@
+#ifdef USE_LOG4CXX
+#  include "log4cxx/logger.h"
+#  include "log4cxx/consoleappender.h"
+#  include "log4cxx/patternlayout.h"
+#  include "log4cxx/basicconfigurator.h"
+#endif
+
+#include <boost/program_options.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <csignal>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "features_pipeline.h"
+
+namespace po = boost::program_options;
+
+typedef std::chrono::steady_clock Clock;
+
+/**
+ * A computation requested by a client.
+ *
+ * The input and output volumes are shared memory file descriptors (memfd)
+ * received from the client: the input holds the voxels (unsigned char), and
+ * the output receives the features (float, the channels of each voxel being
+ * contiguous). The capacity of the output is the size of its file.
+ */
+struct Job
+{
+	std::string recipe;
+	std::vector< std::string > computers;
+	std::vector< std::vector< std::string > > computers_options;
+	unsigned int size[3];
+	double spacing[3];
+	int input_fd;
+	int output_fd;
+
+	Clock::time_point submitted;
+	bool done;
+	std::string response;
+};
+
+/**
+ * Queue of jobs processed by a pool of worker threads.
+ *
+ * Each worker keeps its own pipelines, one per recipe (computers and their
+ * options), so that the computers are loaded only once and are never shared
+ * between threads.
+ */
+class JobQueue
+{
+public:
+	/**
+	 * @param[in] max_pool_size The maximum size of the scratch buffers each worker keeps between its jobs, in bytes (0: unlimited).
+	 */
+	JobQueue(const unsigned int number_of_workers, const size_t max_pool_size) :
+		max_pool_size(max_pool_size), running(0), completed(0), total_latency(0), stopping(false)
+	{
+		for(unsigned int i = 0; i < number_of_workers; ++i)
+			this->workers.push_back(std::thread(&JobQueue::work, this));
+	}
+
+	~JobQueue()
+	{
+		{
+			std::lock_guard< std::mutex > lock(this->mutex);
+			this->stopping = true;
+		}
+		this->job_available.notify_all();
+
+		for(unsigned int i = 0; i < this->workers.size(); ++i)
+			this->workers[i].join();
+	}
+
+	/**
+	 * Queue a job and wait for its completion.
+	 */
+	void run(Job &job)
+	{
+		std::unique_lock< std::mutex > lock(this->mutex);
+
+		job.submitted = Clock::now();
+		job.done = false;
+		this->jobs.push_back(&job);
+		this->job_available.notify_one();
+
+		while(!job.done)
+			this->job_done.wait(lock);
+	}
+
+	std::string status()
+	{
+		std::lock_guard< std::mutex > lock(this->mutex);
+
+		std::ostringstream status;
+		status << "status " << this->jobs.size() << " " << this->running << " " << this->completed << " "
+			<< (this->completed > 0 ? this->total_latency / this->completed : 0);
+		return status.str();
+	}
+
+private:
+	void work()
+	{
+#ifdef USE_LOG4CXX
+		log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+#endif
+
+		std::map< std::string, boost::shared_ptr< FeaturesPipeline > > pipelines;
+
+		// The pipelines of a worker share their scratch buffers, the ones kept
+		// between the jobs being bounded for the memory of the daemon not to only grow
+		boost::shared_ptr< BufferPool > buffer_pool(new BufferPool(this->max_pool_size));
+
+		std::unique_lock< std::mutex > lock(this->mutex);
+
+		while(true)
+		{
+			while(this->jobs.empty() && !this->stopping)
+				this->job_available.wait(lock);
+
+			if(this->stopping)
+				return;
+
+			Job &job = *this->jobs.front();
+			this->jobs.pop_front();
+			++this->running;
+
+			lock.unlock();
+
+			const Clock::time_point started = Clock::now();
+			const std::string response = JobQueue::process(job, pipelines, buffer_pool);
+			const Clock::time_point finished = Clock::now();
+
+			const double wait_ms = std::chrono::duration< double, std::milli >(started - job.submitted).count();
+			const double compute_ms = std::chrono::duration< double, std::milli >(finished - started).count();
+
+#ifdef USE_LOG4CXX
+			LOG4CXX_INFO(logger, "Job \"" << job.recipe << "\": " << response << " (waited " << wait_ms << " ms, computed in " << compute_ms << " ms)");
+#endif
+
+			// Error messages may hold spaces, they are not followed by the timings
+			std::ostringstream timed_response;
+			timed_response << response;
+			if(response.compare(0, 6, "error ") != 0)
+				timed_response << " " << wait_ms << " " << compute_ms;
+
+			lock.lock();
+
+			--this->running;
+			++this->completed;
+			this->total_latency += wait_ms + compute_ms;
+
+			job.response = timed_response.str();
+			job.done = true;
+			this->job_done.notify_all();
+		}
+	}
+
+	static std::string process(const Job &job, std::map< std::string, boost::shared_ptr< FeaturesPipeline > > &pipelines, const boost::shared_ptr< BufferPool > &buffer_pool)
+	{
+		const size_t number_of_voxels = static_cast< size_t >(job.size[0]) * job.size[1] * job.size[2];
+
+		struct stat input_stat, output_stat;
+		if((fstat(job.input_fd, &input_stat) != 0) || (fstat(job.output_fd, &output_stat) != 0))
+			return "error Unable to read the size of the shared memory";
+
+		if(static_cast< size_t >(input_stat.st_size) < number_of_voxels)
+			return "error The input shared memory is smaller than the image";
+
+		const size_t output_length = output_stat.st_size / sizeof(float);
+
+		void *input = mmap(NULL, input_stat.st_size, PROT_READ, MAP_SHARED, job.input_fd, 0);
+		if(input == MAP_FAILED)
+			return "error Unable to map the input shared memory";
+
+		void *output = output_length > 0 ? mmap(NULL, output_stat.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, job.output_fd, 0) : NULL;
+		if(output == MAP_FAILED)
+		{
+			munmap(input, input_stat.st_size);
+			return "error Unable to map the output shared memory";
+		}
+
+		std::ostringstream response;
+		try {
+			boost::shared_ptr< FeaturesPipeline > &pipeline = pipelines[job.recipe];
+			if(!pipeline)
+			{
+				boost::shared_ptr< FeaturesPipeline > new_pipeline(new FeaturesPipeline);
+				new_pipeline->set_buffer_pool(buffer_pool);
+				for(unsigned int i = 0; i < job.computers.size(); ++i)
+					new_pipeline->add_computer(job.computers[i], job.computers_options[i]);
+				pipeline = new_pipeline;
+			}
+
+			const unsigned int channels = pipeline->compute(static_cast< const unsigned char * >(input), job.size, job.spacing, static_cast< float * >(output), output_length);
+
+			if(number_of_voxels * channels > output_length)
+				response << "too-small " << channels;
+			else
+				response << "ok " << channels;
+		} catch( std::exception &ex ) {
+			pipelines.erase(job.recipe);
+			response.str("");
+			response << "error " << ex.what();
+		}
+
+		munmap(input, input_stat.st_size);
+		if(output)
+			munmap(output, output_stat.st_size);
+
+		return response.str();
+	}
+
+	std::mutex mutex;
+	std::condition_variable job_available;
+	std::condition_variable job_done;
+	std::deque< Job* > jobs;
+	const size_t max_pool_size;
+	std::vector< std::thread > workers;
+	unsigned int running;
+	unsigned long completed;
+	double total_latency;
+	bool stopping;
+};
+
+/**
+ * Parse a compute request: "compute <x> <y> <z> <spacing x> <spacing y> <spacing z> -c <computer> <options>..."
+ */
+bool parse_job(const std::string request, Job &job)
+{
+	std::istringstream tokens(request);
+	std::string command;
+
+	tokens >> command;
+	for(unsigned int i = 0; i < 3; ++i)
+		tokens >> job.size[i];
+	for(unsigned int i = 0; i < 3; ++i)
+		tokens >> job.spacing[i];
+
+	if(!tokens || command != "compute")
+		return false;
+
+	std::string token;
+	while(tokens >> token)
+	{
+		if(token == "-c" || token == "--computer")
+		{
+			std::string computer;
+			if(!(tokens >> computer))
+				return false;
+
+			job.computers.push_back(computer);
+			job.computers_options.push_back(std::vector< std::string >());
+			token += " " + computer;
+		} else if(job.computers.empty()) {
+			return false;
+		} else {
+			job.computers_options.back().push_back(token);
+		}
+
+		job.recipe += (job.recipe.empty() ? "" : " ") + token;
+	}
+
+	return !job.computers.empty();
+}
+
+/**
+ * Serve the requests of a client, one request per message.
+ */
+void serve(const int client, JobQueue *queue)
+{
+	std::vector< char > buffer(64 * 1024);
+
+	while(true)
+	{
+		int fds[2] = { -1, -1 };
+		unsigned int number_of_fds = 0;
+
+		char control[CMSG_SPACE(sizeof(fds))];
+		struct iovec iov;
+		iov.iov_base = &buffer[0];
+		iov.iov_len = buffer.size();
+
+		struct msghdr message;
+		std::memset(&message, 0, sizeof(message));
+		message.msg_iov = &iov;
+		message.msg_iovlen = 1;
+		message.msg_control = control;
+		message.msg_controllen = sizeof(control);
+
+		const ssize_t received = recvmsg(client, &message, MSG_CMSG_CLOEXEC);
+		if(received <= 0)
+			break;
+
+		for(struct cmsghdr *header = CMSG_FIRSTHDR(&message); header != NULL; header = CMSG_NXTHDR(&message, header))
+		{
+			if(header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS)
+			{
+				number_of_fds = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+				std::memcpy(fds, CMSG_DATA(header), std::min(number_of_fds, 2u) * sizeof(int));
+			}
+		}
+
+		std::string request(&buffer[0], received);
+		while(!request.empty() && (request[request.size() - 1] == '\n' || request[request.size() - 1] == '\0'))
+			request.erase(request.size() - 1);
+
+		std::string response;
+		if(request == "status") {
+			response = queue->status();
+		} else {
+			Job job;
+			if(!parse_job(request, job)) {
+				response = "error Invalid request";
+			} else if(number_of_fds != 2 || (message.msg_flags & MSG_CTRUNC)) {
+				response = "error A compute request needs the input and output shared memory";
+			} else {
+				job.input_fd = fds[0];
+				job.output_fd = fds[1];
+				queue->run(job);
+				response = job.response;
+			}
+		}
+
+		for(unsigned int i = 0; i < std::min(number_of_fds, 2u); ++i)
+			close(fds[i]);
+
+		response += "\n";
+		if(send(client, response.data(), response.size(), MSG_NOSIGNAL) < 0)
+			break;
+	}
+
+	close(client);
+}
+
+int main(int argc, char** argv)
+{
+#ifdef USE_LOG4CXX
+	log4cxx::BasicConfigurator::configure(
+			log4cxx::AppenderPtr(new log4cxx::ConsoleAppender(
+					log4cxx::LayoutPtr(new log4cxx::PatternLayout("\%-5p - [%c] - \%m\%n")),
+					log4cxx::ConsoleAppender::getSystemErr()
+					)
+				)
+			);
+
+	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+#endif
+
+	std::string socket_path;
+	unsigned int number_of_workers;
+	unsigned int buffer_pool_size;
+
+	po::options_description main_options("Main options");
+
+	main_options.add_options()
+		("help,h",
+			"Produce help message")
+		("socket,s",
+			po::value< std::string >(&socket_path)->required(),
+			"Path of the Unix socket to listen on (required)")
+		("workers,w",
+			po::value< unsigned int >(&number_of_workers)->default_value(1),
+			"Number of jobs computed at the same time")
+		("buffer-pool-size",
+			po::value< unsigned int >(&buffer_pool_size)->default_value(1024),
+			"Maximum size of the scratch buffers each worker keeps between its jobs, in MiB (0: unlimited)")
+		;
+
+	po::variables_map vm;
+
+	try {
+		po::store(po::command_line_parser(argc, argv).options(main_options).run(), vm);
+
+		if (vm.count("help")) {
+			std::cerr << "Usage: " << argv[0] << " [options]" << std::endl;
+			std::cerr << main_options;
+			return 0;
+		}
+
+		vm.notify();
+	} catch(po::error &err) {
+#ifdef USE_LOG4CXX
+		LOG4CXX_FATAL(logger, err.what());
+#endif
+		return -1;
+	}
+
+	struct sockaddr_un address;
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if(socket_path.size() >= sizeof(address.sun_path))
+	{
+#ifdef USE_LOG4CXX
+		LOG4CXX_FATAL(logger, "The socket path \"" << socket_path << "\" is too long");
+#endif
+		return -1;
+	}
+	std::strcpy(address.sun_path, socket_path.c_str());
+
+	// Messages keep their boundaries, so that each request is a single message
+	const int server = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	unlink(socket_path.c_str());
+	if(server < 0 || bind(server, reinterpret_cast< struct sockaddr * >(&address), sizeof(address)) != 0 || listen(server, 64) != 0)
+	{
+#ifdef USE_LOG4CXX
+		LOG4CXX_FATAL(logger, "Unable to listen on \"" << socket_path << "\" (" << std::strerror(errno) << ")");
+#endif
+		return -1;
+	}
+
+	std::signal(SIGPIPE, SIG_IGN);
+
+	JobQueue queue(std::max(number_of_workers, 1u), static_cast< size_t >(buffer_pool_size) * 1024 * 1024);
+
+#ifdef USE_LOG4CXX
+	LOG4CXX_INFO(logger, "Listening on \"" << socket_path << "\" with " << number_of_workers << " workers");
+#endif
+
+	while(true)
+	{
+		const int client = accept4(server, NULL, NULL, SOCK_CLOEXEC);
+		if(client < 0)
+		{
+			if(errno == EINTR)
+				continue;
+#ifdef USE_LOG4CXX
+			LOG4CXX_FATAL(logger, "Unable to accept a client (" << std::strerror(errno) << ")");
+#endif
+			break;
+		}
+
+		std::thread(serve, client, &queue).detach();
+	}
+
+	close(server);
+	unlink(socket_path.c_str());
+
+	return -1;
+}
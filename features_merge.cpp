@@ -0,0 +1,182 @@
+#ifdef USE_LOG4CXX
+#  include "log4cxx/logger.h"
+#  include "log4cxx/consoleappender.h"
+#  include "log4cxx/patternlayout.h"
+#  include "log4cxx/basicconfigurator.h"
+#endif
+
+#include <boost/lexical_cast.hpp>
+#include <boost/program_options.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "itkImageFileReader.h"
+
+#include "datatypes.h"
+
+#include "shard.h"
+#include "features_pipeline.h"
+#include "channel_statistics.h"
+#include "image_writer.h"
+
+namespace po = boost::program_options;
+
+typedef itk::ImageFileReader< OutputImageType > ImageReader;
+
+int main(int argc, char** argv)
+{
+#ifdef USE_LOG4CXX
+	log4cxx::BasicConfigurator::configure(
+			log4cxx::AppenderPtr(new log4cxx::ConsoleAppender(
+					log4cxx::LayoutPtr(new log4cxx::PatternLayout("\%-5p - [%c] - \%m\%n")),
+					log4cxx::ConsoleAppender::getSystemErr()
+					)
+				)
+			);
+
+	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+#endif
+
+	std::vector< std::string > shard_paths;
+	std::string output_image_path;
+	bool compress;
+	std::string normalize_channels;
+
+	po::options_description main_options("Main options");
+
+	main_options.add_options()
+		("help,h",
+			"Produce help message")
+		("input-image,i",
+			po::value< std::vector< std::string > >(&shard_paths)->required()->multitoken(),
+			"Outputs of the shards of a run (features_computer --shard), in any order (required)")
+		("output-image,o",
+			po::value< std::string >(&output_image_path)->required(),
+			"Ouput image (required)")
+		("compress",
+			po::bool_switch(&compress),
+			"Compress the output image")
+		("normalize-channels",
+			po::value< std::string >(&normalize_channels),
+			"Normalize each channel of the output: minmax (to [0,1]) or zscore (zero mean, unit variance)")
+		;
+
+	po::variables_map vm;
+
+	try {
+		po::store(po::command_line_parser(argc, argv).options(main_options).run(), vm);
+
+		// Handling --help before notify() in order to allow ->required()
+		if (vm.count("help")) {
+			std::cerr << "Usage: " << argv[0] << " [options]" << std::endl;
+			std::cerr << main_options;
+			return 0;
+		}
+
+		vm.notify();
+
+		if(!normalize_channels.empty() && (normalize_channels != "minmax") && (normalize_channels != "zscore"))
+			throw po::validation_error(po::validation_error::invalid_option_value, "normalize-channels", normalize_channels);
+	} catch(po::error &err) {
+#ifdef USE_LOG4CXX
+		LOG4CXX_FATAL(logger, err.what());
+#endif
+		return -1;
+	}
+
+	// The shards are read one at a time, and copied at their planes in the final image
+	OutputImageType::Pointer output_image;
+	std::vector< bool > merged;
+	unsigned int shard_count = 0;
+	std::string run;
+
+	const ChannelStatistics::Normalization normalization = ChannelStatistics::normalization(normalize_channels);
+	boost::scoped_ptr< ChannelStatistics > statistics;
+
+	try {
+		for(unsigned int i = 0; i < shard_paths.size(); ++i)
+		{
+			ImageReader::Pointer reader = ImageReader::New();
+			reader->SetFileName(shard_paths[i]);
+			try {
+				reader->Update();
+			} catch( itk::ExceptionObject &ex ) {
+				throw ShardException("The shard located at \"" + shard_paths[i] + "\" is not readable");
+			}
+
+			OutputImageType::Pointer shard_image = reader->GetOutput();
+			const Shard shard = Shard::read(shard_image);
+
+#ifdef USE_LOG4CXX
+			LOG4CXX_INFO(logger, "Shard " << shard.get_index() << "/" << shard.get_count() << ": " << shard_paths[i]);
+#endif
+
+			if(output_image.IsNull())
+			{
+				shard_count = shard.get_count();
+				run = shard.get_run();
+				merged.assign(shard_count, false);
+
+				// The first plane of the image is the one of the first shard
+				OutputImageType::IndexType start;
+				start.Fill(0);
+				start[2] = -static_cast< long >(shard.get_first_plane());
+				OutputImageType::PointType origin;
+				shard_image->TransformIndexToPhysicalPoint(start, origin);
+
+				output_image = OutputImageType::New();
+				output_image->CopyInformation(shard_image);
+				output_image->SetOrigin(origin);
+				output_image->SetRegions(shard.get_image_size());
+				output_image->SetVectorLength(shard_image->GetNumberOfComponentsPerPixel());
+				output_image->Allocate();
+
+				if(normalization != ChannelStatistics::NoNormalization)
+					statistics.reset(new ChannelStatistics(output_image->GetNumberOfComponentsPerPixel()));
+			}
+
+			// The same input, computers and options in all the shards
+			if((shard.get_run() != run) || (shard.get_count() != shard_count) || (shard.get_image_size() != output_image->GetBufferedRegion().GetSize())
+				|| (shard_image->GetNumberOfComponentsPerPixel() != output_image->GetNumberOfComponentsPerPixel()))
+				throw ShardException("The shard located at \"" + shard_paths[i] + "\" is not a shard of the same run");
+
+			if(merged[shard.get_index()])
+				throw ShardException("The shard located at \"" + shard_paths[i] + "\" is given twice");
+			merged[shard.get_index()] = true;
+
+			// The statistics of the channels are gathered as the shards are copied
+			FeaturesPipeline::copy_channels(shard_image, 0, output_image, shard.get_first_plane(), shard.get_number_of_planes(), 0, statistics.get());
+		}
+
+		for(unsigned int i = 0; i < shard_count; ++i)
+			if(!merged[i])
+				throw ShardException("The shard " + boost::lexical_cast< std::string >(i) + "/" + boost::lexical_cast< std::string >(shard_count) + " is missing");
+	} catch( std::exception &ex ) {
+#ifdef USE_LOG4CXX
+		LOG4CXX_FATAL(logger, ex.what());
+#endif
+		return -1;
+	}
+
+	// Written as a MetaImage or a NRRD file, the channels are rescaled as they are written
+	ChannelRescale rescale;
+	const bool rescaled = statistics && ImageStreamWriter::can_stream(output_image_path);
+	if(rescaled) {
+		rescale = statistics->rescale(normalization);
+		statistics->record(output_image, normalization);
+	} else if(statistics) {
+		statistics->normalize(output_image, normalization);
+	}
+
+	try {
+		ImageWriter::write(output_image, output_image_path, compress, rescaled ? &rescale : NULL);
+	} catch ( ImageWritingException & err ) {
+#ifdef USE_LOG4CXX
+		LOG4CXX_FATAL(logger, err.what());
+#endif
+		return -1;
+	}
+}
@@ -0,0 +1,672 @@
+#include "features_pipeline.h"
+
+#include "itkImportImageFilter.h"
+#include "itkComposeVectorImageFilter.h"
+#include "itkMultiThreader.h"
+#include "channel_copy.h"
+
+#include <algorithm>
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+
+#ifdef _OPENMP
+#  include <omp.h>
+#endif
+
+#ifdef USE_LOG4CXX
+	#include "log4cxx/logger.h"
+#endif
+
+typedef itk::ImportImageFilter< InputImageType::PixelType, InputImageType::ImageDimension > InputImportFilter;
+typedef itk::ComposeVectorImageFilter< OutputImageType, OutputImageType > JoinImageFilterType;
+
+namespace
+{
+
+/**
+ * Copy the channels of an image in some channels of a caller's buffer.
+ */
+void interleave(const OutputImageType *image, const unsigned int size[3], float *output, const unsigned int number_of_channels, const unsigned int first_channel)
+{
+	const unsigned int channels = image->GetNumberOfComponentsPerPixel();
+	const float *source = image->GetBufferPointer();
+	const long plane_size = static_cast< long >(size[0]) * size[1];
+
+#pragma omp parallel for
+	for(long z = 0; z < static_cast< long >(size[2]); ++z)
+		channel_copy::copy_run(source + z * plane_size * channels, channels, output + z * plane_size * number_of_channels + first_channel, number_of_channels, channels, plane_size);
+}
+
+/**
+ * Number of threads of the parallel regions started while in scope, and of
+ * the ITK filters created while in scope (the defaults of OpenMP and ITK if 0).
+ */
+class ScopedThreads
+{
+public:
+	ScopedThreads(const unsigned int threads) :
+		threads(threads)
+	{
+		if(threads == 0)
+			return;
+
+#ifdef _OPENMP
+		this->previous = omp_get_max_threads();
+		omp_set_num_threads(threads);
+#endif
+		this->previous_itk = itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+		itk::MultiThreader::SetGlobalDefaultNumberOfThreads(threads);
+	}
+
+	~ScopedThreads()
+	{
+		if(this->threads == 0)
+			return;
+
+#ifdef _OPENMP
+		omp_set_num_threads(this->previous);
+#endif
+		itk::MultiThreader::SetGlobalDefaultNumberOfThreads(this->previous_itk);
+	}
+
+private:
+	const unsigned int threads;
+	int previous;
+	int previous_itk;
+};
+
+}
+
+FeaturesPipeline::FeaturesPipeline() :
+	buffer_pool(new BufferPool)
+{
+}
+
+void FeaturesPipeline::set_buffer_pool(const boost::shared_ptr< BufferPool > &buffer_pool)
+{
+	this->buffer_pool = buffer_pool;
+
+	for(unsigned int i = 0; i < this->computers.size(); ++i)
+		(*this->computers[i])->set_buffer_pool(this->buffer_pool.get());
+}
+
+BufferPool& FeaturesPipeline::get_buffer_pool()
+{
+	return *this->buffer_pool;
+}
+
+void FeaturesPipeline::add_computer(const std::string name, const std::vector< std::string > options)
+{
+	boost::shared_ptr< FeaturesComputerLoader > computer(new FeaturesComputerLoader(name));
+
+#ifdef USE_LOG4CXX
+	(*computer)->setLogger(log4cxx::Logger::getLogger("main"));
+#endif
+	(*computer)->set_buffer_pool(this->buffer_pool.get());
+
+	this->computers.push_back(computer);
+	this->names.push_back(name);
+	this->options.push_back(options);
+	this->tunings.push_back(Tuning());
+}
+
+unsigned int FeaturesPipeline::get_number_of_computers() const
+{
+	return this->computers.size();
+}
+
+const std::string& FeaturesPipeline::get_computer_name(const unsigned int computer) const
+{
+	return this->names.at(computer);
+}
+
+const std::vector< std::string >& FeaturesPipeline::get_computer_options(const unsigned int computer) const
+{
+	return this->options.at(computer);
+}
+
+std::vector< std::string > FeaturesPipeline::get_normalized_options(const unsigned int computer)
+{
+	return (*this->computers.at(computer))->normalize_options(this->options.at(computer));
+}
+
+std::string FeaturesPipeline::get_computer_version(const unsigned int computer) const
+{
+	return (*this->computers.at(computer))->version();
+}
+
+void FeaturesPipeline::set_tuning(const unsigned int computer, const Tuning &tuning)
+{
+	(*this->computers.at(computer))->set_tile_voxels(tuning.tile_voxels > 0 ? tuning.tile_voxels : TileScheduler::default_tile_voxels);
+	this->tunings.at(computer) = tuning;
+}
+
+const Tuning& FeaturesPipeline::get_tuning(const unsigned int computer) const
+{
+	return this->tunings.at(computer);
+}
+
+bool FeaturesPipeline::has_kernel(const unsigned int computer)
+{
+	boost::scoped_ptr< NeighborhoodKernel > kernel((*this->computers.at(computer))->create_kernel(this->options.at(computer)));
+	return kernel.get() != NULL;
+}
+
+bool FeaturesPipeline::has_estimate(const unsigned int computer) const
+{
+	return this->computers.at(computer)->has_estimate();
+}
+
+FeaturesEstimate FeaturesPipeline::estimate(const unsigned int computer, const InputImageType::SizeType &size) const
+{
+	return this->computers.at(computer)->estimate(this->options.at(computer), size);
+}
+
+bool FeaturesPipeline::estimate_channels(const InputImageType::SizeType &size, std::vector< unsigned int > &first_channels, unsigned int &channels) const
+{
+	first_channels.clear();
+	channels = 0;
+	for(unsigned int i = 0; i < this->computers.size(); ++i)
+	{
+		if(!this->has_estimate(i))
+			return false;
+		first_channels.push_back(channels);
+		channels += this->estimate(i, size).channels;
+	}
+
+	return true;
+}
+
+OutputImageType::Pointer FeaturesPipeline::compute(const unsigned int computer, InputImageType::Pointer input_image)
+{
+#ifdef USE_LOG4CXX
+	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+	LOG4CXX_INFO(logger, "Running: " << this->names.at(computer));
+#endif
+
+	ScopedThreads threads(this->tunings.at(computer).threads);
+
+	return (*this->computers.at(computer))->compute(input_image, this->options.at(computer));
+}
+
+OutputImageType::Pointer FeaturesPipeline::compute_planes(const unsigned int computer, InputImageType::Pointer input_image, const unsigned int first_plane, const unsigned int number_of_planes)
+{
+#ifdef USE_LOG4CXX
+	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+	LOG4CXX_INFO(logger, "Running: " << this->names.at(computer) << " (planes " << first_plane << " to " << first_plane + number_of_planes - 1 << ")");
+#endif
+
+	ScopedThreads threads(this->tunings.at(computer).threads);
+
+	OutputImageType::Pointer computed = (*this->computers.at(computer))->compute_planes(input_image, first_plane, number_of_planes, this->options.at(computer));
+	if(computed.IsNull())
+		throw FeaturesPipelineException(this->names.at(computer) + " cannot compute some planes alone");
+
+	return computed;
+}
+
+void FeaturesPipeline::compute(const unsigned int computer, InputImageType::Pointer input_image, const unsigned int slab_depth, OutputImageType *output, const unsigned int first_channel, ChannelStatistics *statistics)
+{
+	const InputImageType::RegionType region = input_image->GetBufferedRegion();
+	const long nz = region.GetSize()[2];
+
+	const FeaturesEstimate estimate = this->estimate(computer, region.GetSize());
+
+	if(!estimate.tileable || (slab_depth == 0) || (slab_depth >= nz))
+	{
+		OutputImageType::Pointer computed = this->compute(computer, input_image);
+		FeaturesPipeline::copy_channels(computed, 0, output, 0, nz, first_channel, statistics);
+		return;
+	}
+
+	const long halo = estimate.halo[2];
+
+	for(long z0 = 0; z0 < nz; z0 += slab_depth)
+	{
+		const long z1 = std::min(z0 + static_cast< long >(slab_depth), nz);
+		const long first = std::max(z0 - halo, 0L), last = std::min(z1 + halo, nz);
+
+#ifdef USE_LOG4CXX
+		log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+		LOG4CXX_INFO(logger, "Planes " << z0 << " to " << z1 - 1 << " (slab from " << first << " to " << last - 1 << ")");
+#endif
+
+		OutputImageType::Pointer computed = this->compute(computer, FeaturesPipeline::slab(input_image, first, last));
+		if(computed->GetNumberOfComponentsPerPixel() != estimate.channels)
+			throw FeaturesPipelineException("The channels computed by " + this->names.at(computer) + " differ from its estimate");
+
+		FeaturesPipeline::copy_channels(computed, z0 - first, output, z0, z1 - z0, first_channel, statistics);
+	}
+}
+
+FeaturesPipeline::Sweep FeaturesPipeline::create_sweep(const std::vector< unsigned int > &computers, const unsigned int output_channels, const std::vector< unsigned int > &first_channels)
+{
+	Sweep sweep;
+	sweep.threads = 0;
+	sweep.tile_voxels = 0;
+	bool default_threads = false;
+
+	for(unsigned int i = 0; i < computers.size(); ++i)
+	{
+		const unsigned int computer = computers[i];
+
+		boost::shared_ptr< NeighborhoodKernel > kernel((*this->computers.at(computer))->create_kernel(this->options.at(computer)));
+		if(!kernel)
+			continue;
+
+		if(first_channels.at(i) + kernel->get_number_of_channels() > output_channels)
+			throw FeaturesPipelineException("The features computed by " + this->names.at(computer) + " do not fit in the output image");
+
+		sweep.computers.push_back(computer);
+		sweep.kernels.push_back(kernel);
+		sweep.kernel_pointers.push_back(kernel.get());
+		sweep.first_channels.push_back(first_channels[i]);
+
+		const Tuning &tuning = this->tunings.at(computer);
+		default_threads = default_threads || (tuning.threads == 0);
+		sweep.threads = std::max(sweep.threads, tuning.threads);
+		const unsigned long computer_tile_voxels = tuning.tile_voxels > 0 ? tuning.tile_voxels : TileScheduler::default_tile_voxels;
+		sweep.tile_voxels = (sweep.tile_voxels == 0) ? computer_tile_voxels : std::min(sweep.tile_voxels, computer_tile_voxels);
+	}
+
+	if(default_threads)
+		sweep.threads = 0;
+
+#ifdef USE_LOG4CXX
+	if(!sweep.computers.empty())
+	{
+		log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+		std::string names;
+		for(unsigned int i = 0; i < sweep.computers.size(); ++i)
+			names += (i > 0 ? ", " : "") + this->names.at(sweep.computers[i]);
+		LOG4CXX_INFO(logger, "Running in a single sweep: " << names);
+	}
+#endif
+
+	return sweep;
+}
+
+std::vector< unsigned int > FeaturesPipeline::compute_fused(const std::vector< unsigned int > &computers, InputImageType::Pointer input_image, float *output, const unsigned int output_channels, const std::vector< unsigned int > &first_channels, ChannelStatistics *statistics)
+{
+	const Sweep sweep = this->create_sweep(computers, output_channels, first_channels);
+	if(sweep.computers.empty())
+		return sweep.computers;
+
+	ScopedThreads scoped_threads(sweep.threads);
+	NeighborhoodKernel::run(sweep.kernel_pointers, input_image, output, output_channels, sweep.first_channels, sweep.tile_voxels, statistics);
+
+	return sweep.computers;
+}
+
+void FeaturesPipeline::compute_slab(InputImageType::Pointer input_image, const long z0, const long z1, const Sweep &sweep, const std::vector< bool > &skipped, const std::vector< FeaturesEstimate > &estimates, const std::vector< unsigned int > &first_channels, OutputImageType *output, const long output_plane)
+{
+	const InputImageType::SizeType size = input_image->GetBufferedRegion().GetSize();
+	const long nz = size[2], number_of_planes = z1 - z0;
+	const long plane_size = size[0] * size[1];
+	const unsigned int number_of_channels = output->GetNumberOfComponentsPerPixel();
+
+	if(!sweep.computers.empty())
+	{
+		// The channels of the kernels packed in the output of the sweep
+		std::vector< unsigned int > swept_first_channels;
+		std::vector< channel_copy::ChannelPair > swept_channels;
+		long halo = 0;
+		for(unsigned int k = 0; k < sweep.computers.size(); ++k)
+		{
+			const FeaturesEstimate &estimate = estimates[sweep.computers[k]];
+			swept_first_channels.push_back(swept_channels.size());
+			for(unsigned int c = 0; c < estimate.channels; ++c)
+				swept_channels.push_back(channel_copy::ChannelPair(swept_channels.size(), sweep.first_channels[k] + c));
+			halo = std::max< long >(halo, estimate.halo[2]);
+		}
+
+		const long first = std::max(z0 - halo, 0L), last = std::min(z1 + halo, nz);
+
+		InputImageType::Pointer extended = FeaturesPipeline::slab(input_image, first, last);
+		OutputImageType::Pointer swept = FeaturesPipeline::allocate(extended, swept_channels.size());
+		{
+			ScopedThreads scoped_threads(sweep.threads);
+			NeighborhoodKernel::sweep(sweep.kernel_pointers, extended, swept->GetBufferPointer(), swept_channels.size(), swept_first_channels, sweep.tile_voxels);
+		}
+
+		const float *source = swept->GetBufferPointer() + (z0 - first) * plane_size * swept_channels.size();
+		float *destination = output->GetBufferPointer() + output_plane * plane_size * number_of_channels;
+
+#pragma omp parallel for
+		for(long z = 0; z < number_of_planes; ++z)
+			channel_copy::gather(source + z * plane_size * swept_channels.size(), swept_channels.size(), swept_channels, destination + z * plane_size * number_of_channels, number_of_channels, plane_size);
+	}
+
+	for(unsigned int i = 0; i < this->computers.size(); ++i)
+	{
+		if(skipped[i] || (std::find(sweep.computers.begin(), sweep.computers.end(), i) != sweep.computers.end()))
+			continue;
+
+		OutputImageType::Pointer computed;
+		long source_plane = 0;
+		if(estimates[i].planes)
+		{
+			computed = this->compute_planes(i, input_image, z0, number_of_planes);
+		}
+		else
+		{
+			long first = 0, last = nz;
+			if(estimates[i].tileable)
+			{
+				first = std::max(z0 - static_cast< long >(estimates[i].halo[2]), 0L);
+				last = std::min(z1 + static_cast< long >(estimates[i].halo[2]), nz);
+			}
+
+			computed = this->compute(i, FeaturesPipeline::slab(input_image, first, last));
+			source_plane = z0 - first;
+		}
+
+		if(computed->GetNumberOfComponentsPerPixel() != estimates[i].channels)
+			throw FeaturesPipelineException("The channels computed by " + this->names.at(i) + " differ from its estimate");
+
+		FeaturesPipeline::copy_channels(computed, source_plane, output, output_plane, number_of_planes, first_channels[i]);
+	}
+}
+
+OutputImageType::Pointer FeaturesPipeline::compute_planes(InputImageType::Pointer input_image, const unsigned int first_plane, const unsigned int number_of_planes)
+{
+	const InputImageType::SizeType size = input_image->GetBufferedRegion().GetSize();
+	const long nz = size[2], z0 = first_plane, z1 = z0 + number_of_planes;
+
+	if((number_of_planes == 0) || (z1 > nz))
+		throw FeaturesPipelineException("The planes to compute are outside of the image");
+
+	std::vector< unsigned int > first_channels;
+	unsigned int number_of_channels;
+	if(!this->estimate_channels(size, first_channels, number_of_channels))
+		throw FeaturesPipelineException("Computing some planes only needs estimates from all the computers");
+
+	std::vector< unsigned int > computers;
+	std::vector< FeaturesEstimate > estimates;
+	for(unsigned int i = 0; i < this->computers.size(); ++i)
+	{
+		computers.push_back(i);
+		estimates.push_back(this->estimate(i, size));
+	}
+
+	OutputImageType::Pointer output_image = FeaturesPipeline::allocate(FeaturesPipeline::slab(input_image, z0, z1), number_of_channels);
+
+	const Sweep sweep = this->create_sweep(computers, number_of_channels, first_channels);
+	NeighborhoodKernel::prepare_all(sweep.kernel_pointers, input_image);
+
+	this->compute_slab(input_image, z0, z1, sweep, std::vector< bool >(this->computers.size(), false), estimates, first_channels, output_image, 0);
+
+	return output_image;
+}
+
+void FeaturesPipeline::compute_slabs(InputImageType::Pointer input_image, const unsigned int slab_depth, OutputImageType *output, const std::function< void(unsigned int, unsigned int) > &slab_done)
+{
+	const InputImageType::SizeType size = input_image->GetBufferedRegion().GetSize();
+	const long nz = size[2];
+
+	std::vector< unsigned int > first_channels;
+	unsigned int number_of_channels;
+	if(!this->estimate_channels(size, first_channels, number_of_channels))
+		throw FeaturesPipelineException("Computing by slabs needs estimates from all the computers");
+
+	std::vector< unsigned int > computers;
+	std::vector< FeaturesEstimate > estimates;
+	for(unsigned int i = 0; i < this->computers.size(); ++i)
+	{
+		computers.push_back(i);
+		estimates.push_back(this->estimate(i, size));
+	}
+
+	const Sweep sweep = this->create_sweep(computers, number_of_channels, first_channels);
+	NeighborhoodKernel::prepare_all(sweep.kernel_pointers, input_image);
+
+	// The computers depending on the whole image first
+	std::vector< bool > done(this->computers.size(), false);
+	for(unsigned int i = 0; i < this->computers.size(); ++i)
+	{
+		if(estimates[i].tileable || estimates[i].planes || (std::find(sweep.computers.begin(), sweep.computers.end(), i) != sweep.computers.end()))
+			continue;
+
+		this->compute(i, input_image, 0, output, first_channels[i]);
+		done[i] = true;
+	}
+
+	for(long z0 = 0; z0 < nz; z0 += slab_depth)
+	{
+		const long z1 = std::min(z0 + static_cast< long >(std::max(slab_depth, 1u)), nz);
+
+#ifdef USE_LOG4CXX
+		log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+		LOG4CXX_INFO(logger, "Planes " << z0 << " to " << z1 - 1);
+#endif
+
+		this->compute_slab(input_image, z0, z1, sweep, done, estimates, first_channels, output, z0);
+		slab_done(z0, z1 - z0);
+	}
+}
+
+OutputImageType::Pointer FeaturesPipeline::compute(InputImageType::Pointer input_image)
+{
+	const InputImageType::SizeType size = input_image->GetBufferedRegion().GetSize();
+
+	// Each output is freed once copied, instead of all being kept until their composition
+	std::vector< unsigned int > first_channels;
+	unsigned int number_of_channels;
+	if((this->computers.size() > 1) && this->estimate_channels(size, first_channels, number_of_channels))
+	{
+		OutputImageType::Pointer output_image = FeaturesPipeline::allocate(input_image, number_of_channels);
+
+		std::vector< unsigned int > computers;
+		for(unsigned int i = 0; i < this->computers.size(); ++i)
+			computers.push_back(i);
+
+		const std::vector< unsigned int > fused = this->compute_fused(computers, input_image, output_image->GetBufferPointer(), number_of_channels, first_channels);
+
+		for(unsigned int i = 0; i < this->computers.size(); ++i)
+		{
+			if(std::find(fused.begin(), fused.end(), i) != fused.end())
+				continue;
+
+			const unsigned int channels = (i + 1 < this->computers.size() ? first_channels[i + 1] : number_of_channels) - first_channels[i];
+
+			OutputImageType::Pointer computed = this->compute(i, input_image);
+			if(computed->GetNumberOfComponentsPerPixel() != channels)
+				throw FeaturesPipelineException("The channels computed by " + this->names.at(i) + " differ from its estimate");
+
+			FeaturesPipeline::copy_channels(computed, 0, output_image, 0, size[2], first_channels[i]);
+		}
+
+		return output_image;
+	}
+
+	std::vector< OutputImageType::Pointer > outputs;
+	for(unsigned int i = 0; i < this->computers.size(); ++i)
+		outputs.push_back(this->compute(i, input_image));
+
+	return FeaturesPipeline::compose(outputs);
+}
+
+unsigned int FeaturesPipeline::compute(const unsigned char *input, const unsigned int size[3], const double spacing[3], float *output, const size_t output_length)
+{
+	// Wrap the caller's buffer, without copy nor ownership
+	InputImageType::SizeType image_size;
+	InputImageType::IndexType start;
+	double origin[InputImageType::ImageDimension];
+	for(unsigned int i = 0; i < InputImageType::ImageDimension; ++i)
+	{
+		image_size[i] = size[i];
+		start[i] = 0;
+		origin[i] = 0;
+	}
+
+	const size_t number_of_pixels = static_cast< size_t >(size[0]) * size[1] * size[2];
+
+	InputImportFilter::Pointer importFilter = InputImportFilter::New();
+	importFilter->SetRegion(InputImportFilter::RegionType(start, image_size));
+	importFilter->SetSpacing(spacing);
+	importFilter->SetOrigin(origin);
+	importFilter->SetImportPointer(const_cast< unsigned char * >(input), number_of_pixels, false);
+	importFilter->Update();
+
+	InputImageType::Pointer input_image = importFilter->GetOutput();
+
+	// The computers providing a kernel write directly in the caller's buffer,
+	// in a single sweep, and each other output is interleaved as soon as it is
+	// computed
+	std::vector< unsigned int > first_channels;
+	unsigned int number_of_channels;
+	if(this->estimate_channels(image_size, first_channels, number_of_channels))
+	{
+		if(number_of_pixels * number_of_channels > output_length)
+			return number_of_channels;
+
+		std::vector< unsigned int > computers;
+		for(unsigned int i = 0; i < this->computers.size(); ++i)
+			computers.push_back(i);
+
+		const std::vector< unsigned int > fused = this->compute_fused(computers, input_image, output, number_of_channels, first_channels);
+
+		for(unsigned int i = 0; i < this->computers.size(); ++i)
+		{
+			if(std::find(fused.begin(), fused.end(), i) != fused.end())
+				continue;
+
+			const unsigned int channels = (i + 1 < this->computers.size() ? first_channels[i + 1] : number_of_channels) - first_channels[i];
+
+			OutputImageType::Pointer computed = this->compute(i, input_image);
+			if(computed->GetNumberOfComponentsPerPixel() != channels)
+				throw FeaturesPipelineException("The channels computed by " + this->names.at(i) + " differ from its estimate");
+
+			interleave(computed, size, output, number_of_channels, first_channels[i]);
+		}
+
+		return number_of_channels;
+	}
+
+	std::vector< OutputImageType::Pointer > outputs;
+	number_of_channels = 0;
+	for(unsigned int i = 0; i < this->computers.size(); ++i)
+	{
+		outputs.push_back(this->compute(i, input_image));
+		number_of_channels += outputs.back()->GetNumberOfComponentsPerPixel();
+	}
+
+	if(number_of_pixels * number_of_channels > output_length)
+		return number_of_channels;
+
+	// Interleave the outputs directly in the caller's buffer
+	unsigned int first_channel = 0;
+	for(unsigned int i = 0; i < outputs.size(); ++i)
+	{
+		interleave(outputs[i], size, output, number_of_channels, first_channel);
+		first_channel += outputs[i]->GetNumberOfComponentsPerPixel();
+		outputs[i] = NULL;
+	}
+
+	return number_of_channels;
+}
+
+OutputImageType::Pointer FeaturesPipeline::compose(const std::vector< OutputImageType::Pointer > &outputs)
+{
+	if(outputs.empty())
+		throw FeaturesPipelineException("No features to compose");
+
+	if(outputs.size() == 1)
+		return outputs.front();
+
+	JoinImageFilterType::Pointer joinFilter = JoinImageFilterType::New();
+	for(unsigned int i = 0; i < outputs.size(); ++i)
+		joinFilter->SetInput(i, outputs[i]);
+	joinFilter->Update();
+
+	return joinFilter->GetOutput();
+}
+
+InputImageType::Pointer FeaturesPipeline::slab(InputImageType::Pointer input_image, const long first, const long last)
+{
+	const InputImageType::RegionType region = input_image->GetBufferedRegion();
+	const long plane_size = region.GetSize()[0] * region.GetSize()[1];
+
+	InputImageType::IndexType start = region.GetIndex();
+	start[2] += first;
+	InputImageType::PointType origin;
+	input_image->TransformIndexToPhysicalPoint(start, origin);
+
+	InputImageType::SizeType slab_size = region.GetSize();
+	slab_size[2] = last - first;
+
+	InputImageType::PixelContainerPointer pixels = InputImageType::PixelContainer::New();
+	pixels->SetImportPointer(input_image->GetBufferPointer() + first * plane_size, (last - first) * plane_size, false);
+
+	InputImageType::Pointer slab = InputImageType::New();
+	slab->CopyInformation(input_image);
+	slab->SetOrigin(origin);
+	slab->SetRegions(slab_size);
+	slab->SetPixelContainer(pixels);
+
+	return slab;
+}
+
+OutputImageType::Pointer FeaturesPipeline::allocate(const InputImageType *input_image, const unsigned int number_of_channels)
+{
+	OutputImageType::Pointer output_image = OutputImageType::New();
+	output_image->CopyInformation(input_image);
+	output_image->SetRegions(input_image->GetBufferedRegion());
+	output_image->SetVectorLength(number_of_channels);
+	output_image->Allocate();
+
+	return output_image;
+}
+
+void FeaturesPipeline::copy_channels(const OutputImageType *source, const unsigned int source_plane, OutputImageType *destination, const unsigned int destination_plane, const unsigned int number_of_planes, const unsigned int first_channel, ChannelStatistics *statistics)
+{
+	const unsigned int source_channels = source->GetNumberOfComponentsPerPixel();
+	const unsigned int destination_channels = destination->GetNumberOfComponentsPerPixel();
+	const OutputImageType::SizeType source_size = source->GetBufferedRegion().GetSize();
+	const OutputImageType::SizeType destination_size = destination->GetBufferedRegion().GetSize();
+
+	if((source_size[0] != destination_size[0]) || (source_size[1] != destination_size[1])
+		|| (source_plane + number_of_planes > source_size[2]) || (destination_plane + number_of_planes > destination_size[2])
+		|| (first_channel + source_channels > destination_channels))
+		throw FeaturesPipelineException("The computed features do not fit in the output image");
+
+	const long plane_size = source_size[0] * source_size[1];
+	const float *input = source->GetBufferPointer() + source_plane * plane_size * source_channels;
+	float *output = destination->GetBufferPointer() + destination_plane * plane_size * destination_channels + first_channel;
+
+	if(!statistics)
+	{
+#pragma omp parallel for
+		for(long z = 0; z < static_cast< long >(number_of_planes); ++z)
+			channel_copy::copy_run(input + z * plane_size * source_channels, source_channels, output + z * plane_size * destination_channels, destination_channels, source_channels, plane_size);
+		return;
+	}
+
+	if(first_channel + source_channels > statistics->get_number_of_channels())
+		throw FeaturesPipelineException("The computed features do not fit in the channel statistics");
+
+	// Each block of voxels is added to the statistics of the thread right after being copied
+	static const long block_size = 1024;
+
+#pragma omp parallel
+	{
+		ChannelStatistics thread_statistics(source_channels);
+
+#pragma omp for
+		for(long z = 0; z < static_cast< long >(number_of_planes); ++z)
+		{
+			for(long first = 0; first < plane_size; first += block_size)
+			{
+				const long block = std::min(block_size, plane_size - first);
+				const float *source_block = input + (z * plane_size + first) * source_channels;
+
+				channel_copy::copy_run(source_block, source_channels, output + (z * plane_size + first) * destination_channels, destination_channels, source_channels, block);
+				thread_statistics.add(source_block, source_channels, block);
+			}
+		}
+
+#pragma omp critical
+		statistics->merge(thread_statistics, first_channel);
+	}
+}
@@ -0,0 +1,255 @@
+#ifndef FEATURES_PIPELINE_H
+#define FEATURES_PIPELINE_H
+
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+#include "datatypes.h"
+#include "buffer_pool.h"
+#include "channel_statistics.h"
+#include "FeaturesComputerLoader.h"
+#include "tuning_profile.h"
+
+class FeaturesPipelineException : public std::runtime_error
+{
+public:
+	FeaturesPipelineException ( const std::string &err ) : std::runtime_error (err) {}
+};
+
+/**
+ * A sequence of features computers, whose outputs are concatenated channel
+ * by channel.
+ *
+ * The computers are loaded once, so that a pipeline can process any number
+ * of images without reloading them. Their scratch buffers come from a buffer
+ * pool, reused from one computer and one image to the next.
+ */
+class FeaturesPipeline
+{
+public:
+	FeaturesPipeline();
+
+	/**
+	 * Share a buffer pool with other pipelines (by default, each pipeline has its own).
+	 */
+	void set_buffer_pool(const boost::shared_ptr< BufferPool > &buffer_pool);
+
+	BufferPool& get_buffer_pool();
+
+	/**
+	 * Load a computer and add it at the end of the pipeline.
+	 * @param[in] name The name of the computer (e.g. "Haralick").
+	 * @param[in] options The options of the computer, as on the command line.
+	 * @throw FeaturesComputerLoadingException If the computer cannot be loaded.
+	 */
+	void add_computer(const std::string name, const std::vector< std::string > options);
+
+	unsigned int get_number_of_computers() const;
+	const std::string& get_computer_name(const unsigned int computer) const;
+	const std::vector< std::string >& get_computer_options(const unsigned int computer) const;
+
+	/**
+	 * Normalized options of a computer (see FeaturesComputer::normalize_options()).
+	 */
+	std::vector< std::string > get_normalized_options(const unsigned int computer);
+
+	/**
+	 * Version of the features of a computer (see FeaturesComputer::version()).
+	 */
+	std::string get_computer_version(const unsigned int computer) const;
+
+	/**
+	 * Set how a computer runs: its number of threads and the size of its
+	 * tiles, the features being the same. The computers providing a kernel
+	 * that run in a single sweep use the most threads and the smallest tiles
+	 * of their tunings.
+	 */
+	void set_tuning(const unsigned int computer, const Tuning &tuning);
+
+	const Tuning& get_tuning(const unsigned int computer) const;
+
+	/**
+	 * Whether a computer of the pipeline provides a neighborhood kernel for its options.
+	 */
+	bool has_kernel(const unsigned int computer);
+
+	/**
+	 * Whether a computer of the pipeline provides estimates.
+	 */
+	bool has_estimate(const unsigned int computer) const;
+
+	/**
+	 * Estimate the output and the needs of a computer for an image size,
+	 * validating its options (see FeaturesEstimate).
+	 * @throw FeaturesComputerLoadingException If the computer provides no estimates.
+	 */
+	FeaturesEstimate estimate(const unsigned int computer, const InputImageType::SizeType &size) const;
+
+	/**
+	 * Run a single computer of the pipeline.
+	 */
+	OutputImageType::Pointer compute(const unsigned int computer, InputImageType::Pointer input_image);
+
+	/**
+	 * Run a single computer of the pipeline on slabs of the input image (along
+	 * z), and write its output in some channels of an existing image. Each slab
+	 * is a view of the input, extended by the halo of the computer. A computer
+	 * that is not tileable runs on the whole image.
+	 * @param[in] slab_depth The number of planes computed at once.
+	 * @param[out] output An image of the size of the input.
+	 * @param[in] first_channel The channel of the output where the channels of the computer begin.
+	 * @param[in,out] statistics If not null, gathers the statistics of the channels written in the output.
+	 */
+	void compute(const unsigned int computer, InputImageType::Pointer input_image, const unsigned int slab_depth, OutputImageType *output, const unsigned int first_channel, ChannelStatistics *statistics = NULL);
+
+	/**
+	 * Run the computers providing a neighborhood kernel among some computers
+	 * in a single sweep of the input image (see NeighborhoodKernel), writing
+	 * their channels directly in an output buffer.
+	 * @param[in] computers The candidate computers.
+	 * @param[out] output The output buffer, of the size of the input.
+	 * @param[in] output_channels The number of channels of a voxel of the output.
+	 * @param[in] first_channels The channel of the output where the channels of each candidate begin.
+	 * @param[in,out] statistics If not null, gathers the statistics of the channels written in the output, during the sweep.
+	 * @return The computers run, the other candidates being left to the caller.
+	 */
+	std::vector< unsigned int > compute_fused(const std::vector< unsigned int > &computers, InputImageType::Pointer input_image, float *output, const unsigned int output_channels, const std::vector< unsigned int > &first_channels, ChannelStatistics *statistics = NULL);
+
+	/**
+	 * Run all the computers for some planes of the input image only (along z),
+	 * e.g. as a shard of a run spread over several processes. The computers
+	 * providing a neighborhood kernel, prepared for the whole image, sweep the
+	 * planes extended by their largest halo; each other tileable computer
+	 * runs on the planes extended by its halo, the computers computing some
+	 * planes alone (FeaturesEstimate::planes) compute these planes, and the
+	 * other computers run on the whole image. The features are the ones these
+	 * planes have in the features of the whole image.
+	 * @return An image of the planes, with their geometry in the input image.
+	 * @throw FeaturesPipelineException If a computer provides no estimates.
+	 */
+	OutputImageType::Pointer compute_planes(InputImageType::Pointer input_image, const unsigned int first_plane, const unsigned int number_of_planes);
+
+	/**
+	 * Run all the computers by slabs of planes (along z), writing their
+	 * channels in an image of the size of the input, and report each slab once
+	 * all its channels are written (e.g. to write it while the next slabs are
+	 * computed). The computers that are not tileable, nor compute some planes
+	 * alone, run first, on the whole image. Then, slab after slab, the computers providing a neighborhood
+	 * kernel, prepared once for the whole image, sweep the slab extended by
+	 * their largest halo, and each other computer runs on the slab extended by
+	 * its halo, or computes the planes of the slab.
+	 * @param[in] slab_done Called with the first plane and the number of planes of each slab, in order.
+	 * @throw FeaturesPipelineException If a computer provides no estimates.
+	 */
+	void compute_slabs(InputImageType::Pointer input_image, const unsigned int slab_depth, OutputImageType *output, const std::function< void(unsigned int, unsigned int) > &slab_done);
+
+	/**
+	 * Run all the computers and concatenate their outputs. When all the
+	 * computers provide estimates, the concatenated image is allocated first:
+	 * the computers providing a neighborhood kernel write in it in a single
+	 * sweep, and the output of each other computer is copied in it as soon as
+	 * it is computed.
+	 */
+	OutputImageType::Pointer compute(InputImageType::Pointer input_image);
+
+	/**
+	 * Run all the computers on a caller-owned buffer, and write the concatenated
+	 * outputs in a caller-owned buffer.
+	 *
+	 * The input buffer is wrapped without copy. The output buffer holds the
+	 * channels of each voxel contiguously (x fastest, then y, then z).
+	 * @param[in] input The input voxels, x fastest, then y, then z.
+	 * @param[in] size The size of the input image.
+	 * @param[in] spacing The spacing of the input image.
+	 * @param[out] output The output buffer.
+	 * @param[in] output_length The number of floats the output buffer can hold.
+	 * @return The number of channels of the output. If the output buffer is too
+	 *         small to hold them, nothing is written in it (and nothing is
+	 *         computed when all the computers provide estimates).
+	 */
+	unsigned int compute(const unsigned char *input, const unsigned int size[3], const double spacing[3], float *output, const size_t output_length);
+
+	/**
+	 * Concatenate images channel by channel.
+	 */
+	static OutputImageType::Pointer compose(const std::vector< OutputImageType::Pointer > &outputs);
+
+	/**
+	 * Allocate an output image with the geometry of an input image.
+	 */
+	static OutputImageType::Pointer allocate(const InputImageType *input_image, const unsigned int number_of_channels);
+
+	/**
+	 * Copy planes of an image into some channels of another one.
+	 * @param[in] source_plane The first plane copied from the source.
+	 * @param[in] destination_plane The plane of the destination receiving it.
+	 * @param[in] number_of_planes The number of planes copied.
+	 * @param[in] first_channel The channel of the destination receiving the first channel of the source.
+	 * @param[in,out] statistics If not null, gathers the statistics of the copied channels (as
+	 *                channels of the destination), while they are in the cache.
+	 */
+	static void copy_channels(const OutputImageType *source, const unsigned int source_plane, OutputImageType *destination, const unsigned int destination_plane, const unsigned int number_of_planes, const unsigned int first_channel, ChannelStatistics *statistics = NULL);
+
+private:
+	/**
+	 * The kernels of the computers providing one among some computers, run in
+	 * a single sweep.
+	 */
+	struct Sweep
+	{
+		std::vector< unsigned int > computers;
+		std::vector< boost::shared_ptr< NeighborhoodKernel > > kernels;
+		std::vector< NeighborhoodKernel * > kernel_pointers;
+		std::vector< unsigned int > first_channels; // The channel of the output where the channels of each kernel begin
+		unsigned int threads;                       // The most threads of their tunings (0: the default of OpenMP)
+		unsigned long tile_voxels;                  // The smallest tiles of their tunings
+	};
+
+	/**
+	 * Create the kernels of the computers providing one among some computers.
+	 * @throw FeaturesPipelineException If the channels of a kernel do not fit in the output.
+	 */
+	Sweep create_sweep(const std::vector< unsigned int > &computers, const unsigned int output_channels, const std::vector< unsigned int > &first_channels);
+
+	/**
+	 * Compute the planes [z0, z1) of the features of an image, into an image
+	 * holding these planes from output_plane: the prepared kernels of a sweep
+	 * on the planes extended by their largest halo, each other tileable
+	 * computer on the planes extended by its halo, the computers computing
+	 * some planes alone on these planes, and the others on the whole image.
+	 * @param[in] skipped The computers not computed (e.g. already done).
+	 */
+	void compute_slab(InputImageType::Pointer input_image, const long z0, const long z1, const Sweep &sweep, const std::vector< bool > &skipped, const std::vector< FeaturesEstimate > &estimates, const std::vector< unsigned int > &first_channels, OutputImageType *output, const long output_plane);
+
+	/**
+	 * Run a single computer of the pipeline for some planes of the input
+	 * image (see FeaturesComputer::compute_planes()).
+	 * @throw FeaturesPipelineException If the computer cannot.
+	 */
+	OutputImageType::Pointer compute_planes(const unsigned int computer, InputImageType::Pointer input_image, const unsigned int first_plane, const unsigned int number_of_planes);
+
+	/**
+	 * View of the planes [first, last) of an image, without copy.
+	 */
+	static InputImageType::Pointer slab(InputImageType::Pointer input_image, const long first, const long last);
+
+	/**
+	 * Number of channels of the computers, from their estimates.
+	 * @param[out] first_channels The channel where the channels of each computer begin.
+	 * @param[out] channels The total number of channels.
+	 * @return false if a computer provides no estimates.
+	 */
+	bool estimate_channels(const InputImageType::SizeType &size, std::vector< unsigned int > &first_channels, unsigned int &channels) const;
+
+	boost::shared_ptr< BufferPool > buffer_pool;
+	std::vector< boost::shared_ptr< FeaturesComputerLoader > > computers;
+	std::vector< std::string > names;
+	std::vector< std::vector< std::string > > options;
+	std::vector< Tuning > tunings;
+};
+
+#endif /* FEATURES_PIPELINE_H */
@@ -0,0 +1,52 @@
+#ifndef FILE_SYNC_H
+#define FILE_SYNC_H
+
+#include <boost/filesystem.hpp>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ * Durable replacement of files: a file is written to a temporary file next
+ * to it, which is synced, then renamed over it, the directory being synced
+ * around the rename. A crash of the machine leaves either the old or the new
+ * file, whole, never a file whose data is not on the disk yet.
+ */
+namespace file_sync
+{
+
+/**
+ * Flush a file (or a directory, for the entries renamed in it) to the disk.
+ */
+inline bool sync(const boost::filesystem::path &path, const bool directory)
+{
+	const int fd = open(path.string().c_str(), directory ? (O_RDONLY | O_DIRECTORY) : O_RDONLY);
+	if(fd < 0)
+		return false;
+
+	const bool synced = fsync(fd) == 0;
+	close(fd);
+
+	return synced;
+}
+
+/**
+ * Replace a file by a temporary file of the same directory, already written.
+ * @return false if the files cannot be synced (the rename may have happened).
+ * @throw boost::filesystem::filesystem_error If the file cannot be renamed.
+ */
+inline bool replace(const boost::filesystem::path &tmp_path, const boost::filesystem::path &path)
+{
+	const boost::filesystem::path directory = path.has_parent_path() ? path.parent_path() : boost::filesystem::path(".");
+
+	if(!sync(tmp_path, false) || !sync(directory, true))
+		return false;
+
+	boost::filesystem::rename(tmp_path, path);
+
+	return sync(directory, true);
+}
+
+}
+
+#endif /* FILE_SYNC_H */
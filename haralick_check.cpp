@@ -0,0 +1,155 @@
+#ifdef USE_LOG4CXX
+#  include "log4cxx/logger.h"
+#  include "log4cxx/consoleappender.h"
+#  include "log4cxx/patternlayout.h"
+#  include "log4cxx/basicconfigurator.h"
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "datatypes.h"
+
+#include "features_pipeline.h"
+
+/**
+ * Check that the native engine of the Haralick computer computes the
+ * features of the itk engine (ITK_Haralick): both engines run on a random
+ * volume with the same options, for static and dynamic levels, and their
+ * features are compared, up to the rounding of their sums, on the voxels
+ * whose window is inside the volume.
+ *
+ * Run by ctest from the build directory, where the plugins are.
+ */
+
+namespace
+{
+
+/**
+ * A volume whose gray levels vary along every axis, with some noise.
+ */
+InputImageType::Pointer random_volume(const InputImageType::SizeType &size, const unsigned int seed)
+{
+	InputImageType::Pointer image = InputImageType::New();
+	image->SetRegions(size);
+	image->Allocate();
+
+	std::mt19937 generator(seed);
+	std::uniform_int_distribution< int > noise(0, 63);
+
+	InputImageType::PixelType *voxel = image->GetBufferPointer();
+	for(unsigned long z = 0; z < size[2]; ++z)
+		for(unsigned long y = 0; y < size[1]; ++y)
+			for(unsigned long x = 0; x < size[0]; ++x, ++voxel)
+				*voxel = static_cast< InputImageType::PixelType >((x * 7 + y * 13 + z * 29 + noise(generator)) % 256);
+
+	return image;
+}
+
+std::vector< std::string > split(const std::string options)
+{
+	std::vector< std::string > tokens;
+	std::istringstream stream(options);
+	std::string token;
+	while(stream >> token)
+		tokens.push_back(token);
+	return tokens;
+}
+
+// Tolerance of the comparison, relative to the magnitude of the features
+const double relative_tolerance = 1e-3;
+const double absolute_tolerance = 1e-4;
+
+}
+
+int main()
+{
+#ifdef USE_LOG4CXX
+	log4cxx::BasicConfigurator::configure(
+			log4cxx::AppenderPtr(new log4cxx::ConsoleAppender(
+					log4cxx::LayoutPtr(new log4cxx::PatternLayout("\%-5p - [%c] - \%m\%n")),
+					log4cxx::ConsoleAppender::getSystemErr()
+					)
+				)
+			);
+#endif
+
+	// The options and window radius of each run (8 and 16 levels have their own kernels, 12 does not)
+	const char * const runs[] = {
+		"-p 8 -w 2,2,1 --offset 1,0,0 --offset 0,1,1",
+		"-p 16 -w 1,1,1 --directions 3d13",
+		"-p 12 -w 2,1,1 --offset 1,-1,0 --offset 2,0,0"
+	};
+	const long radii[][3] = { {2, 2, 1}, {1, 1, 1}, {2, 1, 1} };
+
+	InputImageType::SizeType size;
+	size[0] = 19;
+	size[1] = 17;
+	size[2] = 11;
+
+	InputImageType::Pointer input_image = random_volume(size, 42);
+	bool agree = true;
+
+	for(unsigned int r = 0; r < sizeof(runs) / sizeof(runs[0]); ++r)
+	{
+		OutputImageType::Pointer native, itk;
+		try {
+			FeaturesPipeline native_pipeline, itk_pipeline;
+			native_pipeline.add_computer("Haralick", split(runs[r]));
+			itk_pipeline.add_computer("Haralick", split(std::string(runs[r]) + " --engine itk"));
+
+			native = native_pipeline.compute(input_image);
+			itk = itk_pipeline.compute(input_image);
+		} catch(std::exception &ex) {
+			std::cerr << runs[r] << ": " << ex.what() << std::endl;
+			agree = false;
+			continue;
+		}
+
+		const unsigned int number_of_channels = native->GetNumberOfComponentsPerPixel();
+		if(itk->GetNumberOfComponentsPerPixel() != number_of_channels)
+		{
+			std::cerr << runs[r] << ": the engines do not compute the same number of features" << std::endl;
+			agree = false;
+			continue;
+		}
+
+		unsigned long differences = 0;
+		for(long z = radii[r][2]; z < static_cast< long >(size[2]) - radii[r][2]; ++z)
+			for(long y = radii[r][1]; y < static_cast< long >(size[1]) - radii[r][1]; ++y)
+				for(long x = radii[r][0]; x < static_cast< long >(size[0]) - radii[r][0]; ++x)
+				{
+					const unsigned long voxel = (z * size[1] + y) * size[0] + x;
+					const float *expected = itk->GetBufferPointer() + voxel * number_of_channels;
+					const float *computed = native->GetBufferPointer() + voxel * number_of_channels;
+
+					for(unsigned int c = 0; c < number_of_channels; ++c)
+					{
+						const double magnitude = std::max(std::fabs(expected[c]), std::fabs(computed[c]));
+						if(!(std::fabs(expected[c] - computed[c]) <= absolute_tolerance + relative_tolerance * magnitude))
+						{
+							if(differences++ == 0)
+								std::cerr << runs[r] << ": feature " << c << " of voxel (" << x << "," << y << "," << z << ") is "
+									<< computed[c] << " instead of " << expected[c] << std::endl;
+						}
+					}
+				}
+
+		if(differences > 0)
+		{
+			std::cerr << runs[r] << ": " << differences << " features differ between the engines" << std::endl;
+			agree = false;
+		}
+	}
+
+	if(!agree)
+		return -1;
+
+	std::cout << "The native engine computes the features of the itk engine" << std::endl;
+	return 0;
+}
@@ -0,0 +1,63 @@
+#include "image_features.h"
+
+#include "features_pipeline.h"
+
+#include <exception>
+#include <new>
+#include <string>
+#include <vector>
+
+struct image_features_pipeline
+{
+	FeaturesPipeline pipeline;
+	std::string error;
+};
+
+image_features_pipeline* image_features_pipeline_new(void)
+{
+	return new (std::nothrow) image_features_pipeline;
+}
+
+void image_features_pipeline_free(image_features_pipeline *pipeline)
+{
+	delete pipeline;
+}
+
+int image_features_pipeline_add_computer(image_features_pipeline *pipeline, const char *name, const char * const *options, size_t number_of_options)
+{
+	try {
+		pipeline->pipeline.add_computer(name, std::vector< std::string >(options, options + number_of_options));
+	} catch( std::exception &ex ) {
+		pipeline->error = ex.what();
+		return IMAGE_FEATURES_ERROR;
+	}
+
+	return IMAGE_FEATURES_OK;
+}
+
+int image_features_pipeline_compute(image_features_pipeline *pipeline, const unsigned char *input, const unsigned int size[3], const double spacing[3], float *output, size_t output_length, unsigned int *number_of_channels)
+{
+	unsigned int channels;
+	try {
+		channels = pipeline->pipeline.compute(input, size, spacing, output, output_length);
+	} catch( std::exception &ex ) {
+		pipeline->error = ex.what();
+		return IMAGE_FEATURES_ERROR;
+	}
+
+	if(number_of_channels)
+		*number_of_channels = channels;
+
+	if(static_cast< size_t >(size[0]) * size[1] * size[2] * channels > output_length)
+	{
+		pipeline->error = "The output buffer is too small";
+		return IMAGE_FEATURES_BUFFER_TOO_SMALL;
+	}
+
+	return IMAGE_FEATURES_OK;
+}
+
+const char* image_features_pipeline_error(const image_features_pipeline *pipeline)
+{
+	return pipeline->error.c_str();
+}
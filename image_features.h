@@ -0,0 +1,61 @@
+#ifndef IMAGE_FEATURES_H
+#define IMAGE_FEATURES_H
+
+/*
+ * Plain C interface of libimagefeatures (see features_pipeline.h for the C++
+ * interface).
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define IMAGE_FEATURES_OK 0
+#define IMAGE_FEATURES_ERROR -1
+#define IMAGE_FEATURES_BUFFER_TOO_SMALL -2
+
+typedef struct image_features_pipeline image_features_pipeline;
+
+/**
+ * Create an empty pipeline. Returns NULL on failure.
+ */
+image_features_pipeline* image_features_pipeline_new(void);
+
+void image_features_pipeline_free(image_features_pipeline *pipeline);
+
+/**
+ * Load a computer and add it at the end of the pipeline.
+ * @param[in] name The name of the computer (e.g. "Haralick").
+ * @param[in] options The options of the computer, as on the command line.
+ * @param[in] number_of_options The number of strings in options.
+ */
+int image_features_pipeline_add_computer(image_features_pipeline *pipeline, const char *name, const char * const *options, size_t number_of_options);
+
+/**
+ * Run the computers on a caller-owned input buffer, and write the concatenated
+ * features in a caller-owned output buffer (the channels of each voxel are
+ * contiguous, voxels are ordered x fastest, then y, then z).
+ * @param[in] input The input voxels, wrapped without copy.
+ * @param[in] size The size of the input image.
+ * @param[in] spacing The spacing of the input image.
+ * @param[out] output The output buffer.
+ * @param[in] output_length The number of floats the output buffer can hold.
+ * @param[out] number_of_channels The number of channels of the output (may be NULL).
+ * @return IMAGE_FEATURES_OK, IMAGE_FEATURES_BUFFER_TOO_SMALL if the output
+ *         buffer cannot hold the features (number_of_channels is still set),
+ *         or IMAGE_FEATURES_ERROR.
+ */
+int image_features_pipeline_compute(image_features_pipeline *pipeline, const unsigned char *input, const unsigned int size[3], const double spacing[3], float *output, size_t output_length, unsigned int *number_of_channels);
+
+/**
+ * Description of the last error of the pipeline.
+ */
+const char* image_features_pipeline_error(const image_features_pipeline *pipeline);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IMAGE_FEATURES_H */
@@ -2,6 +2,8 @@
 
 #include "itkImageFileReader.h"
 #include "itkImageSeriesReader.h"
+#include "itkImageIOFactory.h"
+#include "itkRegionOfInterestImageFilter.h"
 
 #include <ostream>
 #include <algorithm>
@@ -15,6 +17,7 @@
 
 typedef itk::ImageFileReader< InputImageType > ImageReader;
 typedef itk::ImageSeriesReader< InputImageType > ImageSeriesReader;
+typedef itk::RegionOfInterestImageFilter< InputImageType, InputImageType > RegionFilter;
 
 InputImageType::Pointer ImageLoader::load(const std::string filename)
 {
@@ -69,6 +72,67 @@ InputImageType::Pointer ImageLoader::load(const std::string filename)
 	}
 }
 
+InputImageType::Pointer ImageLoader::load(const std::string filename, const InputImageType::RegionType &region)
+{
+
+#ifdef USE_LOG4CXX
+	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+	LOG4CXX_INFO(logger, "Loading a region of image \"" << filename << "\"");
+#endif
+
+	bool serie;
+	try
+	{
+		boost::filesystem::path path(filename);
+
+		if(!boost::filesystem::exists(path)) {
+			std::stringstream err;
+			err << "\"" << filename << "\" does not exists";
+
+			throw ImageLoadingException(err.str());
+		}
+
+		serie = boost::filesystem::is_directory(path);
+	} catch(boost::filesystem::filesystem_error &ex) {
+		std::stringstream err;
+		err << filename << " cannot be read (" << ex.what() << ")" << std::endl;
+		throw ImageLoadingException(err.str());
+	}
+
+	// The filter only requests the region from the reader
+	typename ImageReader::Pointer reader;
+	typename ImageSeriesReader::Pointer serie_reader;
+	RegionFilter::Pointer filter = RegionFilter::New();
+	filter->SetRegionOfInterest(region);
+
+	if(serie) {
+		serie_reader = ImageSeriesReader::New();
+		serie_reader->SetFileNames(serieFileNames(filename));
+		filter->SetInput(serie_reader->GetOutput());
+	} else {
+		reader = ImageReader::New();
+		reader->SetFileName(filename);
+		filter->SetInput(reader->GetOutput());
+	}
+
+	try {
+		filter->Update();
+	}
+	catch( itk::ExceptionObject &ex )
+	{
+		std::stringstream err;
+		err << "ITK is unable to load a region of the image \"" << filename << "\" (" << ex.what() << ")";
+
+		throw ImageLoadingException(err.str());
+	}
+
+#ifdef USE_LOG4CXX
+	LOG4CXX_INFO(logger, "Region of image \"" << filename << "\" loaded");
+#endif
+
+	return filter->GetOutput();
+}
+
 InputImageType::Pointer ImageLoader::loadImage(const std::string filename)
 {
 	typename ImageReader::Pointer reader = ImageReader::New();
@@ -93,7 +157,25 @@ InputImageType::Pointer ImageLoader::loadImageSerie(const std::string filename)
 {
 	typename ImageSeriesReader::Pointer reader = ImageSeriesReader::New();
 
-	typename ImageSeriesReader::FileNamesContainer filenames;
+	reader->SetFileNames(serieFileNames(filename));
+
+	try {
+		reader->Update();
+	}
+	catch( itk::ExceptionObject &ex )
+	{
+		std::stringstream err;
+		err << "ITK is unable to load the image serie located in \"" << filename << "\" (" << ex.what() << ")";
+
+		throw ImageLoadingException(err.str());
+	}
+
+	return reader->GetOutput();
+}
+
+std::vector< std::string > ImageLoader::serieFileNames(const std::string filename)
+{
+	std::vector< std::string > filenames;
 
 #ifdef USE_LOG4CXX
 	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
@@ -130,19 +212,73 @@ InputImageType::Pointer ImageLoader::loadImageSerie(const std::string filename)
 
 	std::sort(filenames.begin(), filenames.end());
 
-	reader->SetFileNames(filenames);
+	return filenames;
+}
+
+InputImageType::SizeType ImageLoader::size(const std::string filename)
+{
+	try
+	{
+		boost::filesystem::path path(filename);
+
+		if(!boost::filesystem::exists(path)) {
+			std::stringstream err;
+			err << "\"" << filename << "\" does not exists";
+
+			throw ImageLoadingException(err.str());
+		}
 
+		if(!boost::filesystem::is_directory(path))
+			return fileSize(filename);
+	} catch(boost::filesystem::filesystem_error &ex) {
+		std::stringstream err;
+		err << filename << " cannot be read (" << ex.what() << ")" << std::endl;
+		throw ImageLoadingException(err.str());
+	}
+
+	const std::vector< std::string > filenames = serieFileNames(filename);
+	if(filenames.empty())
+	{
+		std::stringstream err;
+		err << "The serie located in \"" << filename << "\" has no slices";
+
+		throw ImageLoadingException(err.str());
+	}
+
+	// The slices are stacked along z
+	InputImageType::SizeType size = fileSize(filenames.front());
+	size[2] *= filenames.size();
+
+	return size;
+}
+
+InputImageType::SizeType ImageLoader::fileSize(const std::string filename)
+{
+	itk::ImageIOBase::Pointer io = itk::ImageIOFactory::CreateImageIO(filename.c_str(), itk::ImageIOFactory::ReadMode);
+
+	if(io.IsNull())
+	{
+		std::stringstream err;
+		err << "ITK is unable to read the image \"" << filename << "\"";
+
+		throw ImageLoadingException(err.str());
+	}
+
+	InputImageType::SizeType size;
 	try {
-		reader->Update();
+		io->SetFileName(filename);
+		io->ReadImageInformation();
+
+		for(unsigned int i = 0; i < InputImageType::ImageDimension; ++i)
+			size[i] = i < io->GetNumberOfDimensions() ? io->GetDimensions(i) : 1;
 	}
 	catch( itk::ExceptionObject &ex )
 	{
 		std::stringstream err;
-		err << "ITK is unable to load the image serie located in \"" << filename << "\" (" << ex.what() << ")";
+		err << "ITK is unable to read the header of \"" << filename << "\" (" << ex.what() << ")";
 
 		throw ImageLoadingException(err.str());
 	}
 
-	return reader->GetOutput();
+	return size;
 }
-
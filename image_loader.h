@@ -2,6 +2,8 @@
 #define IMAGE_LOADER_H
 
 #include <stdexcept>
+#include <string>
+#include <vector>
 
 #include "datatypes.h"
 
@@ -22,6 +24,21 @@ public:
 	 */
 	static InputImageType::Pointer load(const std::string filename);
 
+	/**
+	 * Load a region of an image. Only the region is read from the formats ITK
+	 * streams (e.g. uncompressed MetaImage), and only the slices it crosses
+	 * from a serie.
+	 * @param[in] filename The file to load of the folder containing the files. Must exists.
+	 * @param[in] region The region to load, within the size of the image (see size()).
+	 */
+	static InputImageType::Pointer load(const std::string filename, const InputImageType::RegionType &region);
+
+	/**
+	 * Read the size of an image from the headers of its files, without loading it.
+	 * @param[in] filename The file or the folder containing the files. Must exists.
+	 */
+	static InputImageType::SizeType size(const std::string filename);
+
 private:
 	/**
 	 * Load an image as a single file.
@@ -35,6 +52,17 @@ private:
 	 */
 	static InputImageType::Pointer loadImageSerie(const std::string filename);
 
+	/**
+	 * List the slices of a serie, in loading order.
+	 * @param[in] filename The folder containing the files. Must be a directory.
+	 */
+	static std::vector< std::string > serieFileNames(const std::string filename);
+
+	/**
+	 * Read the size stored in the header of a file.
+	 */
+	static InputImageType::SizeType fileSize(const std::string filename);
+
 };
 
 #endif /* IMAGE_LOADER_H */
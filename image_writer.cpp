@@ -0,0 +1,476 @@
+#include "image_writer.h"
+#include "npy_writer.h"
+
+#include "itkImageFileWriter.h"
+#include "itkByteSwapper.h"
+#include "itkMetaDataObject.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <boost/filesystem.hpp>
+
+#ifdef USE_LOG4CXX
+	#include "log4cxx/logger.h"
+#endif
+
+typedef itk::ImageFileWriter< OutputImageType > ImageFileWriter;
+
+namespace
+{
+
+// Size of the uncompressed chunks. Each chunk is compressed independently,
+// which only costs a few bytes per chunk and a negligible loss of ratio.
+const size_t chunk_size = 1 << 20;
+
+/**
+ * A chunk of the data, compressed as a raw deflate stream.
+ */
+struct Chunk
+{
+	std::vector< unsigned char > data;
+	uLong checksum;
+	size_t offset;
+};
+
+/**
+ * Compress a chunk as a sequence of deflate blocks.
+ *
+ * The data chunks are ended with a sync flush, which byte-aligns them without
+ * marking their last block as final, and the stream is ended by an empty last
+ * chunk: once concatenated, the chunks form a single valid deflate stream.
+ */
+bool compress_chunk(const unsigned char *data, const size_t size, const bool last, const bool gzip, Chunk &chunk)
+{
+	z_stream stream;
+	stream.zalloc = Z_NULL;
+	stream.zfree = Z_NULL;
+	stream.opaque = Z_NULL;
+
+	if(deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return false;
+
+	// The sync flush marker is not accounted for by deflateBound()
+	chunk.data.resize(deflateBound(&stream, size) + 16);
+
+	stream.next_in = const_cast< unsigned char * >(data);
+	stream.avail_in = size;
+	stream.next_out = &chunk.data[0];
+	stream.avail_out = chunk.data.size();
+
+	const int status = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+	const bool done = last ? (status == Z_STREAM_END) : (status == Z_OK && stream.avail_in == 0 && stream.avail_out > 0);
+
+	chunk.data.resize(stream.total_out);
+	deflateEnd(&stream);
+
+	chunk.checksum = gzip ? crc32(crc32(0L, Z_NULL, 0), data, size) : adler32(adler32(0L, Z_NULL, 0), data, size);
+
+	return done;
+}
+
+void put_le32(std::string &s, const uLong v)
+{
+	for(unsigned int i = 0; i < 4; ++i)
+		s.push_back(static_cast< char >((v >> (8 * i)) & 0xff));
+}
+
+void put_be32(std::string &s, const uLong v)
+{
+	for(unsigned int i = 0; i < 4; ++i)
+		s.push_back(static_cast< char >((v >> (8 * (3 - i))) & 0xff));
+}
+
+/**
+ * The string entries of the metadata of an image that fit on a header line
+ * (e.g. the normalization of the channels).
+ */
+std::vector< std::pair< std::string, std::string > > string_metadata(const OutputImageType *image)
+{
+	std::vector< std::pair< std::string, std::string > > entries;
+
+	const itk::MetaDataDictionary &dictionary = image->GetMetaDataDictionary();
+	const std::vector< std::string > keys = dictionary.GetKeys();
+
+	std::vector< std::string >::const_iterator it;
+	for(it = keys.begin(); it != keys.end(); ++it)
+	{
+		std::string value;
+		if(it->empty() || (it->find_first_of(" =:\n") != std::string::npos)
+			|| !itk::ExposeMetaData< std::string >(dictionary, *it, value) || (value.find('\n') != std::string::npos))
+			continue;
+
+		entries.push_back(std::make_pair(*it, value));
+	}
+
+	return entries;
+}
+
+bool pwrite_all(const int fd, const void *data, const size_t size, const off_t offset)
+{
+	const char *buffer = static_cast< const char * >(data);
+	size_t written = 0;
+	while(written < size)
+	{
+		const ssize_t n = pwrite(fd, buffer + written, size - written, offset + written);
+		if(n <= 0)
+			return false;
+		written += n;
+	}
+	return true;
+}
+
+}
+
+void ImageWriter::write(const OutputImageType *image, const std::string filename, const bool compress, const ChannelRescale *rescale)
+{
+	const std::string extension = boost::filesystem::path(filename).extension().string();
+
+	if(rescale && !ImageStreamWriter::can_stream(filename))
+		throw ImageWritingException("The channels of the image \"" + filename + "\" can only be rescaled while written as a MetaImage or a NRRD file");
+
+	// A matrix meant to be mapped as is, never compressed
+	if(extension == ".npy")
+	{
+		NpyWriter::write(image, filename);
+		return;
+	}
+
+	if(ImageStreamWriter::can_stream(filename))
+	{
+		ImageStreamWriter writer(image, filename, compress, rescale);
+		writer.write_planes(0, image->GetBufferedRegion().GetSize()[2]);
+		writer.close();
+		return;
+	}
+
+	ImageFileWriter::Pointer writer = ImageFileWriter::New();
+	writer->SetInput(image);
+	writer->SetFileName(filename);
+	writer->SetUseCompression(compress);
+
+	try {
+		writer->Update();
+	} catch( itk::ExceptionObject &ex ) {
+		throw ImageWritingException("ITK is unable to write the image \"" + filename + "\" (" + ex.what() + ")");
+	}
+}
+
+ImageStreamWriter::ImageStreamWriter(const OutputImageType *image, const std::string filename, const bool compress, const ChannelRescale *rescale) :
+	image(image),
+	filename(filename),
+	compress(compress),
+	rescale(rescale),
+	nrrd(boost::filesystem::path(filename).extension() == ".nrrd"),
+	fd(-1),
+	next_plane(0),
+	stream_size(0),
+	checksum(nrrd ? crc32(0L, Z_NULL, 0) : adler32(0L, Z_NULL, 0))
+{
+	const OutputImageType::SizeType size = image->GetBufferedRegion().GetSize();
+	this->plane_bytes = size[0] * size[1] * image->GetNumberOfComponentsPerPixel() * sizeof(OutputImageType::InternalPixelType);
+
+	this->fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if(this->fd < 0)
+		throw ImageWritingException("Unable to open the image \"" + filename + "\" for writing");
+
+	const std::string header = this->header(0);
+	this->header_size = header.size();
+	this->write_at(header.data(), header.size(), 0);
+}
+
+ImageStreamWriter::~ImageStreamWriter()
+{
+	// An incomplete file
+	if(this->fd >= 0)
+	{
+		::close(this->fd);
+		unlink(this->filename.c_str());
+	}
+}
+
+bool ImageStreamWriter::can_stream(const std::string filename)
+{
+	const std::string extension = boost::filesystem::path(filename).extension().string();
+	return (extension == ".mha") || (extension == ".nrrd");
+}
+
+void ImageStreamWriter::write_at(const void *data, const size_t size, const off_t offset)
+{
+	if(!pwrite_all(this->fd, data, size, offset))
+		throw ImageWritingException("Unable to write the image \"" + this->filename + "\"");
+}
+
+const unsigned char* ImageStreamWriter::chunk(const size_t begin, const size_t size, std::vector< float > &buffer) const
+{
+	const unsigned char *data = reinterpret_cast< const unsigned char * >(this->image->GetBufferPointer()) + begin;
+	if(!this->rescale)
+		return data;
+
+	// The chunks and the planes are made of whole floats, the voxels not always
+	const size_t first_value = begin / sizeof(float);
+	buffer.resize(size / sizeof(float));
+	this->rescale->apply(reinterpret_cast< const float * >(data), &buffer[0], buffer.size(), first_value % this->image->GetNumberOfComponentsPerPixel());
+
+	return reinterpret_cast< const unsigned char * >(&buffer[0]);
+}
+
+void ImageStreamWriter::write_planes(const unsigned int first_plane, const unsigned int number_of_planes)
+{
+	if(first_plane + number_of_planes > this->image->GetBufferedRegion().GetSize()[2])
+		throw ImageWritingException("The planes written are outside of the image \"" + this->filename + "\"");
+
+	const size_t first_byte = first_plane * this->plane_bytes;
+	const size_t size = number_of_planes * this->plane_bytes;
+	const long number_of_chunks = (size + chunk_size - 1) / chunk_size;
+
+	// Each chunk is written at its own position, in parallel
+	bool written = true;
+
+	if(!this->compress)
+	{
+		const off_t offset = this->header_size + first_byte;
+
+#pragma omp parallel reduction(&&:written)
+		{
+			std::vector< float > buffer;
+
+#pragma omp for schedule(dynamic)
+			for(long i = 0; i < number_of_chunks; ++i)
+			{
+				const size_t begin = i * chunk_size, length = std::min(chunk_size, size - begin);
+				written = pwrite_all(this->fd, this->chunk(first_byte + begin, length, buffer), length, offset + begin) && written;
+			}
+		}
+
+		if(!written)
+			throw ImageWritingException("Unable to write the image \"" + this->filename + "\"");
+		return;
+	}
+
+	if(first_plane != this->next_plane)
+		throw ImageWritingException("The planes of the compressed image \"" + this->filename + "\" are not written in order");
+
+	std::vector< Chunk > chunks(number_of_chunks);
+	bool compressed = true;
+
+#pragma omp parallel reduction(&&:compressed)
+	{
+		std::vector< float > buffer;
+
+#pragma omp for schedule(dynamic)
+		for(long i = 0; i < number_of_chunks; ++i)
+		{
+			const size_t begin = i * chunk_size, length = std::min(chunk_size, size - begin);
+			compressed = compress_chunk(this->chunk(first_byte + begin, length, buffer), length, false, this->nrrd, chunks[i]) && compressed;
+		}
+	}
+
+	if(!compressed)
+		throw ImageWritingException("Unable to compress the image \"" + this->filename + "\"");
+
+	// Lay out the chunks after the ones already written, and combine their checksums
+	for(long i = 0; i < number_of_chunks; ++i)
+	{
+		const size_t length = std::min(chunk_size, size - i * chunk_size);
+		this->checksum = this->nrrd ? crc32_combine(this->checksum, chunks[i].checksum, length) : adler32_combine(this->checksum, chunks[i].checksum, length);
+		chunks[i].offset = this->stream_size;
+		this->stream_size += chunks[i].data.size();
+	}
+
+#pragma omp parallel for schedule(dynamic) reduction(&&:written)
+	for(long i = 0; i < number_of_chunks; ++i)
+		written = pwrite_all(this->fd, &chunks[i].data[0], chunks[i].data.size(), this->header_size + chunks[i].offset) && written;
+
+	if(!written)
+		throw ImageWritingException("Unable to write the image \"" + this->filename + "\"");
+
+	this->next_plane += number_of_planes;
+}
+
+void ImageStreamWriter::close()
+{
+	const unsigned int number_of_planes = this->image->GetBufferedRegion().GetSize()[2];
+
+	if(this->compress)
+	{
+		if(this->next_plane != number_of_planes)
+			throw ImageWritingException("Some planes of the compressed image \"" + this->filename + "\" are not written");
+
+		Chunk last;
+		if(!compress_chunk(NULL, 0, true, this->nrrd, last))
+			throw ImageWritingException("Unable to compress the image \"" + this->filename + "\"");
+
+		// Stream trailer: gzip (RFC 1952) for NRRD, zlib (RFC 1950) for MetaImage
+		std::string stream_trailer;
+		if(this->nrrd) {
+			put_le32(stream_trailer, this->checksum);
+			put_le32(stream_trailer, (number_of_planes * this->plane_bytes) & 0xffffffffUL);
+		} else {
+			put_be32(stream_trailer, this->checksum);
+		}
+		last.data.insert(last.data.end(), stream_trailer.begin(), stream_trailer.end());
+
+		this->write_at(&last.data[0], last.data.size(), this->header_size + this->stream_size);
+		this->stream_size += last.data.size();
+
+		// The header, with the size of the compressed stream
+		const std::string header = this->header(this->stream_header().size() + this->stream_size);
+		this->write_at(header.data(), header.size(), 0);
+	}
+
+	const int fd = this->fd;
+	this->fd = -1;
+	if(::close(fd) != 0)
+	{
+		unlink(this->filename.c_str());
+		throw ImageWritingException("Unable to write the image \"" + this->filename + "\"");
+	}
+
+#ifdef USE_LOG4CXX
+	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+	LOG4CXX_INFO(logger, "Image \"" << this->filename << "\" written (" << this->header_size + (this->compress ? this->stream_size : number_of_planes * this->plane_bytes) << " bytes)");
+#endif
+}
+
+std::string ImageStreamWriter::header(const size_t compressed_size) const
+{
+	return (this->nrrd ? this->nrrdHeader() : this->metaImageHeader(compressed_size)) + (this->compress ? this->stream_header() : "");
+}
+
+std::string ImageStreamWriter::stream_header() const
+{
+	// gzip (RFC 1952) for NRRD, zlib (RFC 1950) for MetaImage
+	if(this->nrrd)
+	{
+		const char gzip_header[] = { '\x1f', '\x8b', '\x08', 0, 0, 0, 0, 0, 0, '\x03' };
+		return std::string(gzip_header, sizeof(gzip_header));
+	}
+
+	return "\x78\x9c";
+}
+
+std::string ImageStreamWriter::metaImageHeader(const size_t compressed_size) const
+{
+	const OutputImageType *image = this->image;
+	const unsigned int dimension = OutputImageType::ImageDimension;
+	const OutputImageType::SizeType image_size = image->GetLargestPossibleRegion().GetSize();
+
+	std::ostringstream header;
+	header.precision(17);
+
+	header << "ObjectType = Image" << std::endl;
+	header << "NDims = " << dimension << std::endl;
+	header << "BinaryData = True" << std::endl;
+	header << "BinaryDataByteOrderMSB = " << (itk::ByteSwapper< float >::SystemIsBigEndian() ? "True" : "False") << std::endl;
+	header << "CompressedData = " << (this->compress ? "True" : "False") << std::endl;
+
+	// On a fixed width, the header keeping its size once the size is known
+	if(this->compress)
+		header << "CompressedDataSize = " << std::setw(20) << compressed_size << std::endl;
+
+	// MetaImage stores the direction matrix column by column
+	header << "TransformMatrix =";
+	for(unsigned int i = 0; i < dimension; ++i)
+		for(unsigned int j = 0; j < dimension; ++j)
+			header << " " << image->GetDirection()(j, i);
+	header << std::endl;
+
+	header << "Offset =";
+	for(unsigned int i = 0; i < dimension; ++i)
+		header << " " << image->GetOrigin()[i];
+	header << std::endl;
+
+	header << "ElementSpacing =";
+	for(unsigned int i = 0; i < dimension; ++i)
+		header << " " << image->GetSpacing()[i];
+	header << std::endl;
+
+	header << "DimSize =";
+	for(unsigned int i = 0; i < dimension; ++i)
+		header << " " << image_size[i];
+	header << std::endl;
+
+	header << "ElementNumberOfChannels = " << image->GetNumberOfComponentsPerPixel() << std::endl;
+	header << "ElementType = MET_FLOAT" << std::endl;
+
+	// ElementDataFile must be the last field
+	const std::vector< std::pair< std::string, std::string > > metadata = string_metadata(image);
+	for(unsigned int i = 0; i < metadata.size(); ++i)
+		header << metadata[i].first << " = " << metadata[i].second << std::endl;
+
+	header << "ElementDataFile = LOCAL" << std::endl;
+
+	return header.str();
+}
+
+std::string ImageStreamWriter::nrrdHeader() const
+{
+	const OutputImageType *image = this->image;
+	const unsigned int dimension = OutputImageType::ImageDimension;
+	const OutputImageType::SizeType image_size = image->GetLargestPossibleRegion().GetSize();
+	const unsigned int channels = image->GetNumberOfComponentsPerPixel();
+
+	std::ostringstream header;
+	header.precision(17);
+
+	header << "NRRD0004" << std::endl;
+	header << "# Complete NRRD file format specification at:" << std::endl;
+	header << "# http://teem.sourceforge.net/nrrd/format.html" << std::endl;
+	header << "type: float" << std::endl;
+
+	// The channels are the fastest axis, as an additional non-spatial one
+	header << "dimension: " << (channels > 1 ? dimension + 1 : dimension) << std::endl;
+	header << "space: left-posterior-superior" << std::endl;
+
+	header << "sizes:";
+	if(channels > 1)
+		header << " " << channels;
+	for(unsigned int i = 0; i < dimension; ++i)
+		header << " " << image_size[i];
+	header << std::endl;
+
+	header << "space directions:";
+	if(channels > 1)
+		header << " none";
+	for(unsigned int i = 0; i < dimension; ++i)
+	{
+		header << " (";
+		for(unsigned int j = 0; j < dimension; ++j)
+			header << (j > 0 ? "," : "") << image->GetDirection()(j, i) * image->GetSpacing()[i];
+		header << ")";
+	}
+	header << std::endl;
+
+	header << "kinds:";
+	if(channels > 1)
+		header << " vector";
+	for(unsigned int i = 0; i < dimension; ++i)
+		header << " domain";
+	header << std::endl;
+
+	header << "endian: " << (itk::ByteSwapper< float >::SystemIsBigEndian() ? "big" : "little") << std::endl;
+	header << "encoding: " << (this->compress ? "gzip" : "raw") << std::endl;
+
+	header << "space origin: (";
+	for(unsigned int i = 0; i < dimension; ++i)
+		header << (i > 0 ? "," : "") << image->GetOrigin()[i];
+	header << ")" << std::endl;
+
+	// Key/value pairs
+	const std::vector< std::pair< std::string, std::string > > metadata = string_metadata(image);
+	for(unsigned int i = 0; i < metadata.size(); ++i)
+		header << metadata[i].first << ":=" << metadata[i].second << std::endl;
+
+	// An empty line ends the header, the data follows
+	header << std::endl;
+
+	return header.str();
+}
@@ -0,0 +1,143 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "datatypes.h"
+#include "channel_statistics.h"
+
+class ImageWritingException : public std::runtime_error
+{
+public:
+	ImageWritingException ( const std::string &err ) : std::runtime_error (err) {}
+};
+
+
+class ImageWriter
+{
+public:
+
+	/**
+	 * Write an image to a single file.
+	 *
+	 * MetaImage (.mha) and NRRD (.nrrd) outputs are written by an
+	 * ImageStreamWriter, in a single pass. NumPy (.npy) outputs are written
+	 * as a voxels × channels matrix (see NpyWriter). Other formats are
+	 * written by ITK.
+	 * @param[in] image The image to write.
+	 * @param[in] filename The file to write.
+	 * @param[in] compress Compress the image data.
+	 * @param[in] rescale If not null, the rescaling of the channels applied
+	 *            to the data as it is written (MetaImage and NRRD only).
+	 * @throw ImageWritingException If the image cannot be written.
+	 */
+	static void write(const OutputImageType *image, const std::string filename, const bool compress, const ChannelRescale *rescale = NULL);
+
+};
+
+/**
+ * Writes an image to a single MetaImage (.mha) or NRRD (.nrrd) file plane by
+ * plane (along z), so that the planes already computed are written while the
+ * next ones are computed.
+ *
+ * The header is written first, from the geometry and the metadata of the
+ * image, which must not change afterwards. Each call to write_planes() then
+ * writes some planes of the image at their place in the file. Uncompressed,
+ * the planes are written at their offset, in any order. Compressed, the
+ * planes are split into chunks compressed in parallel, appended as the next
+ * blocks of a single standard zlib (MetaImage) or gzip (NRRD) stream: they
+ * must then be written in order. The channels may be rescaled (normalized)
+ * chunk by chunk as they are written, the image itself being left as is.
+ *
+ * A file that is not closed is removed when the writer is destroyed.
+ */
+class ImageStreamWriter
+{
+public:
+	/**
+	 * Open the file and write its header.
+	 * @param[in] image The image whose planes are written, allocated.
+	 * @param[in] rescale If not null, the rescaling of the channels applied to the data written.
+	 * @throw ImageWritingException If the file cannot be written.
+	 */
+	ImageStreamWriter(const OutputImageType *image, const std::string filename, const bool compress, const ChannelRescale *rescale = NULL);
+
+	~ImageStreamWriter();
+
+	/**
+	 * Whether a file can be written by planes (.mha and .nrrd files).
+	 */
+	static bool can_stream(const std::string filename);
+
+	/**
+	 * Write some planes of the image.
+	 * @throw ImageWritingException If they cannot be written, or if compressed
+	 *        planes do not follow the ones already written.
+	 */
+	void write_planes(const unsigned int first_plane, const unsigned int number_of_planes);
+
+	/**
+	 * End the data and close the file, once all the planes are written.
+	 * @throw ImageWritingException If the file cannot be written, or if some
+	 *        compressed planes are missing.
+	 */
+	void close();
+
+private:
+	ImageStreamWriter(const ImageStreamWriter &); //purposely not implemented
+	void operator=(const ImageStreamWriter &); //purposely not implemented
+
+	/**
+	 * Header of the file, ending with the header of the compressed stream if any.
+	 * @param[in] compressed_size The size of the compressed stream (MetaImage),
+	 *            written on a fixed width to be updated once known.
+	 */
+	std::string header(const size_t compressed_size) const;
+
+	/**
+	 * Header of the compressed stream.
+	 */
+	std::string stream_header() const;
+
+	/**
+	 * Header of a MetaImage file with local data.
+	 */
+	std::string metaImageHeader(const size_t compressed_size) const;
+
+	/**
+	 * Header of a NRRD file with raw or gzip encoded local data.
+	 */
+	std::string nrrdHeader() const;
+
+	void write_at(const void *data, const size_t size, const off_t offset);
+
+	/**
+	 * The data of a chunk as written: the data of the image, or its rescaled
+	 * copy in a buffer of the calling thread.
+	 * @param[in] begin The offset of the chunk from the first plane of the image, in bytes.
+	 */
+	const unsigned char* chunk(const size_t begin, const size_t size, std::vector< float > &buffer) const;
+
+	const OutputImageType *image;
+	const std::string filename;
+	const bool compress;
+	const ChannelRescale *rescale;
+	const bool nrrd;
+	int fd;
+
+	size_t plane_bytes;
+	size_t header_size;
+
+	// Compressed stream: the next plane, the size of the stream written (after
+	// its header) and the checksum of its data
+	unsigned int next_plane;
+	size_t stream_size;
+	unsigned long checksum;
+};
+
+#endif /* IMAGE_WRITER_H */
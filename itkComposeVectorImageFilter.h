@@ -20,8 +20,6 @@
 
 #include "itkImageToImageFilter.h"
 #include "itkVectorImage.h"
-#include "itkImageRegionConstIterator.h"
-#include <vector>
 
 namespace itk
 {
@@ -43,6 +41,10 @@ namespace itk
  * All input images are expected to have the same template parameters and have
  * the same size and origin.
  *
+ * This version copies the channels of each input line by line, with the
+ * kernels of channel_copy.h, instead of composing a pixel at a time: the
+ * inputs and the output must be images of scalars or itk::VectorImage.
+ *
  * \sa VectorImage
  * \ingroup ITKImageCompose
  *
@@ -94,25 +96,6 @@ protected:
 private:
   ComposeVectorImageFilter(const Self &); //purposely not implemented
   void operator=(const Self &);           //purposely not implemented
-
-  typedef ImageRegionConstIterator< InputImageType > InputIteratorType;
-  typedef std::vector< InputIteratorType >           InputIteratorContainerType;
-
-  template<class TPixel>
-  void ComputeOutputPixel(TPixel & pix, InputIteratorContainerType & inputItContainer)
-    {
-    unsigned int k = 0;
-    for ( unsigned int i = 0; i < this->GetNumberOfInputs(); i++ )
-      {
-        unsigned int jmax = inputItContainer[i].Get().GetSize();
-        for(unsigned int j = 0; j < jmax; ++j)
-         {
-         pix[k] = static_cast<typename NumericTraits<OutputPixelType>::ValueType >(inputItContainer[i].Get()[j]);
-         ++k;
-         }
-      ++( inputItContainer[i] );
-      }
-    }
 };
 }
 
@@ -19,7 +19,7 @@
 #define __itkComposeVectorImageFilter_hxx
 
 #include "itkComposeVectorImageFilter.h"
-#include "itkImageRegionIterator.h"
+#include "channel_copy.h"
 
 namespace itk
 {
@@ -124,30 +124,47 @@ ComposeVectorImageFilter< TInputImage, TOutputImage >
 ::ThreadedGenerateData(const RegionType & outputRegionForThread,
                        ThreadIdType)
 {
-  typename OutputImageType::Pointer outputImage =
+  typedef typename InputImageType::InternalPixelType  InputValueType;
+  typedef typename OutputImageType::InternalPixelType OutputValueType;
+
+  OutputImageType *outputImage =
     static_cast< OutputImageType * >( this->ProcessObject::GetOutput(0) );
 
-  ImageRegionIterator< OutputImageType > oit(outputImage, outputRegionForThread);
-  oit.GoToBegin();
+  const unsigned int numberOfInputs = this->GetNumberOfIndexedInputs();
+  const unsigned int outputComponents = outputImage->GetNumberOfComponentsPerPixel();
 
-  InputIteratorContainerType inputItContainer;
+  const typename RegionType::IndexType start = outputRegionForThread.GetIndex();
+  const typename RegionType::SizeType  size = outputRegionForThread.GetSize();
+  const SizeValueType lineLength = size[0];
+  const SizeValueType numberOfLines = lineLength > 0 ? outputRegionForThread.GetNumberOfPixels() / lineLength : 0;
 
-  for ( unsigned int i = 0; i < this->GetNumberOfIndexedInputs(); i++ )
+  // Each line of the region is a block: the channels of each input are copied
+  // into the output line while it stays in the cache
+  typename RegionType::IndexType index = start;
+  for ( SizeValueType line = 0; line < numberOfLines; ++line )
     {
-    const InputImageType * inputImage = this->GetInput(i);
+    SizeValueType rest = line;
+    for ( unsigned int d = 1; d < RegionType::ImageDimension; ++d )
+      {
+      index[d] = start[d] + static_cast< IndexValueType >( rest % size[d] );
+      rest /= size[d];
+      }
 
-    InputIteratorType iit( inputImage, outputRegionForThread);
-    iit.GoToBegin();
-    inputItContainer.push_back(iit);
-    }
+    OutputValueType *output = outputImage->GetBufferPointer()
+      + outputImage->ComputeOffset(index) * outputComponents;
 
-  OutputPixelType pix;
-  NumericTraits<OutputPixelType>::SetLength( pix, outputImage->GetNumberOfComponentsPerPixel() );
-  while ( !oit.IsAtEnd() )
-    {
-    ComputeOutputPixel( pix, inputItContainer );
-    oit.Set(pix);
-    ++oit;
+    unsigned int firstComponent = 0;
+    for ( unsigned int i = 0; i < numberOfInputs; i++ )
+      {
+      const InputImageType *inputImage = this->GetInput(i);
+      const unsigned int inputComponents = inputImage->GetNumberOfComponentsPerPixel();
+      const InputValueType *input = inputImage->GetBufferPointer()
+        + inputImage->ComputeOffset(index) * inputComponents;
+
+      channel_copy::copy_run(input, inputComponents, output + firstComponent, outputComponents, inputComponents, lineLength);
+
+      firstComponent += inputComponents;
+      }
     }
 }
 } // end namespace itk
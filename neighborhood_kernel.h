@@ -0,0 +1,163 @@
+#ifndef NEIGHBORHOOD_KERNEL_H
+#define NEIGHBORHOOD_KERNEL_H
+
+#include "datatypes.h"
+#include "channel_statistics.h"
+#include "tile_scheduler.h"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+/**
+ * Computation of features of a computer, voxel tile by voxel tile, from the
+ * neighborhood of each voxel, so that several computers can run in a single
+ * sweep of the input (see FeaturesComputer::create_kernel()).
+ *
+ * A sweep cuts the image into tiles of whole rows in a single plane, and
+ * runs all its kernels on a tile before taking the next one: the
+ * neighborhood of the tile (its rows and the ones of the halos) is brought
+ * into the cache by the first kernel and read from it by the next ones, so
+ * that the input is read from memory about once, whatever the number of
+ * kernels. Each kernel writes its channels directly in the output.
+ *
+ * The features of a voxel only depend on the voxels within the halo of the
+ * estimate of the computer, and on what prepare() gathers from the image: a
+ * slab of an image extended by the halo, swept by kernels prepared for the
+ * whole image, gets the features of the whole image.
+ */
+class NeighborhoodKernel
+{
+public:
+	typedef OutputImageType::InternalPixelType FeatureType;
+
+	/**
+	 * State of a kernel in a thread (histograms, matrices...), reused from
+	 * one tile to the next.
+	 */
+	class Workspace
+	{
+	public:
+		virtual ~Workspace() {}
+	};
+
+	virtual ~NeighborhoodKernel() {}
+
+	virtual unsigned int get_number_of_channels() const = 0;
+
+	/**
+	 * Least number of rows of a tile, for the initialization of the kernel on
+	 * each tile to be amortized.
+	 */
+	virtual unsigned long get_minimum_tile_rows() const { return 1; }
+
+	/**
+	 * Prepare the kernel for an image (e.g. from its intensity range), before
+	 * it is swept. Called outside of any parallel region.
+	 */
+	virtual void prepare(const InputImageType *image) {}
+
+	/**
+	 * Create the workspace of a thread, for an image size (NULL if the kernel
+	 * needs none).
+	 */
+	virtual Workspace* create_workspace(const InputImageType::SizeType &size) const { return NULL; }
+
+	/**
+	 * Compute the features of the voxels of a tile. Called concurrently, each
+	 * thread with its own workspace.
+	 * @param[in] input The whole input image.
+	 * @param[in] size The size of the input image.
+	 * @param[in] tile The tile, made of whole rows in a single plane.
+	 * @param[out] output The first channel of the kernel, for the first voxel of the image.
+	 * @param[in] stride The number of channels of a voxel of the output.
+	 */
+	virtual void compute(const unsigned char *input, const InputImageType::SizeType &size, const Tile &tile, Workspace *workspace, FeatureType *output, const unsigned int stride) const = 0;
+
+	/**
+	 * Prepare some kernels for an image, before it (or slabs of it) are swept.
+	 */
+	static void prepare_all(const std::vector< NeighborhoodKernel * > &kernels, const InputImageType *image)
+	{
+		for(unsigned int k = 0; k < kernels.size(); ++k)
+			kernels[k]->prepare(image);
+	}
+
+	/**
+	 * Sweep an image once with prepared kernels, running all of them on each tile.
+	 * @param[out] output The output, of stride channels per voxel.
+	 * @param[in] first_channels The channel of the output where the channels of each kernel begin.
+	 * @param[in] tile_voxels The number of voxels of a tile (more if the kernels need more rows).
+	 * @param[in,out] statistics If not null, gathers the statistics of the channels of the kernels
+	 *                (channels of the output), from each tile just computed.
+	 */
+	static void sweep(const std::vector< NeighborhoodKernel * > &kernels, const InputImageType *image, FeatureType *output, const unsigned int stride, const std::vector< unsigned int > &first_channels, const unsigned long tile_voxels = TileScheduler::default_tile_voxels, ChannelStatistics *statistics = NULL)
+	{
+		const InputImageType::SizeType size = image->GetBufferedRegion().GetSize();
+
+		InputImageType::SizeType tile_size = TileScheduler::row_tiles(size, tile_voxels);
+		tile_size[2] = 1;
+		for(unsigned int k = 0; k < kernels.size(); ++k)
+			tile_size[1] = std::max< itk::SizeValueType >(tile_size[1], kernels[k]->get_minimum_tile_rows());
+
+		TileScheduler tiles(size, tile_size);
+		const unsigned char *input = image->GetBufferPointer();
+
+#pragma omp parallel
+		{
+			std::vector< std::unique_ptr< Workspace > > workspaces;
+			for(unsigned int k = 0; k < kernels.size(); ++k)
+				workspaces.push_back(std::unique_ptr< Workspace >(kernels[k]->create_workspace(size)));
+
+			std::unique_ptr< ChannelStatistics > thread_statistics;
+			if(statistics)
+				thread_statistics.reset(new ChannelStatistics(statistics->get_number_of_channels()));
+
+			tiles.run([&](const Tile &tile) {
+				for(unsigned int k = 0; k < kernels.size(); ++k)
+				{
+					kernels[k]->compute(input, size, tile, workspaces[k].get(), output + first_channels[k], stride);
+
+					// The rows of the tile are still in the cache
+					if(thread_statistics)
+						for(long z = tile.begin[2]; z < tile.end[2]; ++z)
+							for(long y = tile.begin[1]; y < tile.end[1]; ++y)
+								thread_statistics->add(output + ((z * size[1] + y) * size[0]) * stride + first_channels[k], kernels[k]->get_number_of_channels(), size[0], first_channels[k], stride);
+				}
+			});
+
+			if(thread_statistics)
+			{
+#pragma omp critical
+				statistics->merge(*thread_statistics);
+			}
+		}
+	}
+
+	/**
+	 * Prepare some kernels and sweep an image once (see sweep()).
+	 */
+	static void run(const std::vector< NeighborhoodKernel * > &kernels, const InputImageType *image, FeatureType *output, const unsigned int stride, const std::vector< unsigned int > &first_channels, const unsigned long tile_voxels = TileScheduler::default_tile_voxels, ChannelStatistics *statistics = NULL)
+	{
+		NeighborhoodKernel::prepare_all(kernels, image);
+		NeighborhoodKernel::sweep(kernels, image, output, stride, first_channels, tile_voxels, statistics);
+	}
+
+	/**
+	 * Sweep an image with a single kernel, into an image of its channels.
+	 */
+	static OutputImageType::Pointer run(NeighborhoodKernel &kernel, const InputImageType *image, const unsigned long tile_voxels = TileScheduler::default_tile_voxels)
+	{
+		OutputImageType::Pointer output_image = OutputImageType::New();
+		output_image->CopyInformation(image);
+		output_image->SetRegions(image->GetBufferedRegion());
+		output_image->SetVectorLength(kernel.get_number_of_channels());
+		output_image->Allocate();
+
+		NeighborhoodKernel::run(std::vector< NeighborhoodKernel * >(1, &kernel), image, output_image->GetBufferPointer(), kernel.get_number_of_channels(), std::vector< unsigned int >(1, 0), tile_voxels);
+
+		return output_image;
+	}
+};
+
+#endif /* NEIGHBORHOOD_KERNEL_H */
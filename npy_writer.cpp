@@ -0,0 +1,178 @@
+#include "npy_writer.h"
+
+#include "itkByteSwapper.h"
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+
+#ifdef USE_LOG4CXX
+	#include "log4cxx/logger.h"
+#endif
+
+namespace
+{
+
+// Number of rows gathered before being written
+const size_t block_rows = 4096;
+
+const char * type_prefix()
+{
+	return itk::ByteSwapper< float >::SystemIsBigEndian() ? ">" : "<";
+}
+
+}
+
+bool NpyWriter::is_npy(const std::string filename)
+{
+	return boost::filesystem::path(filename).extension().string() == ".npy";
+}
+
+std::string NpyWriter::header(const std::string descr, const std::string shape)
+{
+	std::string dictionary = "{'descr': '" + descr + "', 'fortran_order': False, 'shape': " + shape + ", }";
+
+	// Magic string, version and header length, then the dictionary, padded
+	// with spaces and ended by a newline
+	const size_t preamble = 10;
+	const size_t length = (preamble + dictionary.size() + 1 + 63) / 64 * 64 - preamble;
+	dictionary.resize(length - 1, ' ');
+	dictionary.push_back('\n');
+
+	std::string header("\x93NUMPY\x01\x00", 8);
+	header.push_back(static_cast< char >(length & 0xff));
+	header.push_back(static_cast< char >((length >> 8) & 0xff));
+
+	return header + dictionary;
+}
+
+void NpyWriter::write(const OutputImageType *image, const std::string filename)
+{
+	const unsigned int channels = image->GetNumberOfComponentsPerPixel();
+	const unsigned long long number_of_voxels = image->GetBufferedRegion().GetNumberOfPixels();
+
+	std::ostringstream shape;
+	shape << "(" << number_of_voxels << ", " << channels << ")";
+
+	std::ofstream file(filename.c_str(), std::ios::binary | std::ios::trunc);
+	const std::string npy_header = NpyWriter::header(std::string(type_prefix()) + "f4", shape.str());
+	file.write(npy_header.data(), npy_header.size());
+
+	// The buffer is the matrix
+	file.write(reinterpret_cast< const char * >(image->GetBufferPointer()), number_of_voxels * channels * sizeof(OutputImageType::InternalPixelType));
+	file.close();
+
+	if(!file)
+		throw ImageWritingException("Unable to write the matrix \"" + filename + "\"");
+}
+
+void NpyWriter::write(const OutputImageType *image, const std::string filename, const std::vector< boost::uint64_t > &voxels)
+{
+#ifdef USE_LOG4CXX
+	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+	LOG4CXX_INFO(logger, "Writing " << voxels.size() << " voxels to \"" << filename << "\"");
+#endif
+
+	const unsigned int channels = image->GetNumberOfComponentsPerPixel();
+	const unsigned long long number_of_voxels = image->GetBufferedRegion().GetNumberOfPixels();
+	const float *data = image->GetBufferPointer();
+
+	std::ostringstream shape;
+	shape << "(" << voxels.size() << ", " << channels << ")";
+
+	std::ofstream file(filename.c_str(), std::ios::binary | std::ios::trunc);
+	const std::string npy_header = NpyWriter::header(std::string(type_prefix()) + "f4", shape.str());
+	file.write(npy_header.data(), npy_header.size());
+
+	std::vector< float > block(block_rows * channels);
+	for(size_t first = 0; (first < voxels.size()) && file; first += block_rows)
+	{
+		const size_t rows = std::min(block_rows, voxels.size() - first);
+		for(size_t r = 0; r < rows; ++r)
+		{
+			const boost::uint64_t voxel = voxels[first + r];
+			if(voxel >= number_of_voxels)
+				throw ImageWritingException("A voxel written to the matrix \"" + filename + "\" is outside of the image");
+
+			std::copy(data + voxel * channels, data + (voxel + 1) * channels, block.begin() + r * channels);
+		}
+
+		file.write(reinterpret_cast< const char * >(&block[0]), rows * channels * sizeof(float));
+	}
+	file.close();
+
+	if(!file)
+		throw ImageWritingException("Unable to write the matrix \"" + filename + "\"");
+}
+
+void NpyWriter::write_indices(const std::vector< boost::uint64_t > &voxels, const std::string filename)
+{
+	std::ostringstream shape;
+	shape << "(" << voxels.size() << ",)";
+
+	std::ofstream file(filename.c_str(), std::ios::binary | std::ios::trunc);
+	const std::string npy_header = NpyWriter::header(std::string(type_prefix()) + "i8", shape.str());
+	file.write(npy_header.data(), npy_header.size());
+
+	if(!voxels.empty())
+		file.write(reinterpret_cast< const char * >(&voxels[0]), voxels.size() * sizeof(boost::uint64_t));
+	file.close();
+
+	if(!file)
+		throw ImageWritingException("Unable to write the voxel indices \"" + filename + "\"");
+}
+
+std::string NpyWriter::indices_filename(const std::string filename)
+{
+	boost::filesystem::path path(filename);
+	return path.replace_extension(".indices.npy").string();
+}
+
+std::vector< boost::uint64_t > NpyWriter::select_voxels(const InputImageType *mask, const InputImageType::SizeType &size, const unsigned long long sample, const unsigned int seed)
+{
+	const long long number_of_voxels = static_cast< long long >(size[0]) * size[1] * size[2];
+	const InputImageType::PixelType *mask_data = NULL;
+
+	long long candidates = number_of_voxels;
+	if(mask)
+	{
+		if(mask->GetBufferedRegion().GetSize() != size)
+			throw ImageWritingException("The mask and the image do not have the same size");
+
+		mask_data = mask->GetBufferPointer();
+
+		candidates = 0;
+#pragma omp parallel for reduction(+:candidates)
+		for(long long v = 0; v < number_of_voxels; ++v)
+			candidates += (mask_data[v] != 0);
+	}
+
+	unsigned long long needed = ((sample == 0) || (sample > static_cast< unsigned long long >(candidates))) ? candidates : sample;
+
+	std::vector< boost::uint64_t > voxels;
+	voxels.reserve(needed);
+
+	// Selection sampling (Knuth's algorithm S): each candidate is kept with
+	// the probability of the voxels still needed among the remaining ones
+	std::mt19937_64 generator(seed);
+	std::uniform_real_distribution< double > uniform(0, 1);
+
+	unsigned long long remaining = candidates;
+	for(long long v = 0; (v < number_of_voxels) && (needed > 0); ++v)
+	{
+		if(mask_data && (mask_data[v] == 0))
+			continue;
+
+		if((needed >= remaining) || (remaining * uniform(generator) < needed))
+		{
+			voxels.push_back(v);
+			--needed;
+		}
+		--remaining;
+	}
+
+	return voxels;
+}
@@ -0,0 +1,73 @@
+#ifndef NPY_WRITER_H
+#define NPY_WRITER_H
+
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+#include "datatypes.h"
+#include "image_writer.h"
+
+/**
+ * Writes features as a NumPy (.npy) matrix of voxels × channels (float32,
+ * C order), loadable with np.load(filename, mmap_mode='r') without any
+ * conversion: the channels of a voxel being contiguous in a vector image,
+ * its buffer is already such a matrix.
+ *
+ * The rows are the voxels in the order of the image (x fastest, then y, then
+ * z), or only some of them, whose linear indices are written to a side file
+ * (a .npy vector of int64).
+ */
+class NpyWriter
+{
+public:
+	static bool is_npy(const std::string filename);
+
+	/**
+	 * Write all the voxels of an image.
+	 * @throw ImageWritingException If the file cannot be written.
+	 */
+	static void write(const OutputImageType *image, const std::string filename);
+
+	/**
+	 * Write some voxels of an image, a block of rows at a time.
+	 * @param[in] voxels The linear indices of the voxels (see select_voxels()).
+	 * @throw ImageWritingException If the file cannot be written.
+	 */
+	static void write(const OutputImageType *image, const std::string filename, const std::vector< boost::uint64_t > &voxels);
+
+	/**
+	 * Write the linear indices of the voxels written to a matrix.
+	 */
+	static void write_indices(const std::vector< boost::uint64_t > &voxels, const std::string filename);
+
+	/**
+	 * The side file holding the indices of the voxels of a matrix
+	 * (output.npy -> output.indices.npy).
+	 */
+	static std::string indices_filename(const std::string filename);
+
+	/**
+	 * Select the voxels of an image: those of a mask, and a uniform random
+	 * sample of them, in the order of the image.
+	 * @param[in] mask The voxels to keep (non-zero), or null to keep all of them.
+	 * @param[in] size The size of the image.
+	 * @param[in] sample The number of voxels drawn from the kept ones (0 to keep all of them).
+	 * @param[in] seed The seed of the random draw.
+	 * @throw ImageWritingException If the mask and the image sizes differ.
+	 */
+	static std::vector< boost::uint64_t > select_voxels(const InputImageType *mask, const InputImageType::SizeType &size, const unsigned long long sample, const unsigned int seed);
+
+private:
+	/**
+	 * Header of a .npy file (format version 1.0), padded so that the data is
+	 * aligned on 64 bytes.
+	 * @param[in] descr The type of the elements (e.g. "<f4").
+	 * @param[in] shape The shape of the array, as a Python tuple (e.g. "(10, 3)").
+	 */
+	static std::string header(const std::string descr, const std::string shape);
+
+};
+
+#endif /* NPY_WRITER_H */
@@ -0,0 +1,90 @@
+#ifndef POSTERIZATION_H
+#define POSTERIZATION_H
+
+#include "datatypes.h"
+
+#include <itkImageAdaptor.h>
+
+#include <algorithm>
+
+/**
+ * Pixel accessor posterizing 8-bit intensities through a lookup table.
+ *
+ * The table reproduces the mapping of itk::RescaleIntensityImageFilter with an
+ * output range of [0, levels - 1], so wrapping the input image in an
+ * itk::ImageAdaptor with this accessor gives the same values as the rescaled
+ * copy, without allocating nor writing it.
+ */
+class PosterizationAccessor
+{
+public:
+	typedef InputImageType::PixelType InternalType;
+	typedef InputImageType::PixelType ExternalType;
+
+	PosterizationAccessor()
+	{
+		std::fill(m_Table, m_Table + TableSize, 0);
+	}
+
+	/**
+	 * Build the table for an image.
+	 * @param[in] image The image whose intensity range is used.
+	 * @param[in] levels The number of posterization levels, in [1, 256].
+	 */
+	void Build(const InputImageType *image, const unsigned int levels)
+	{
+		InternalType min, max;
+		PosterizationAccessor::Range(image, min, max);
+
+		// Same scale and shift as itk::RescaleIntensityImageFilter
+		double scale = 0;
+		if(min != max)
+			scale = (levels - 1.0) / (static_cast< double >(max) - static_cast< double >(min));
+		else if(max != 0)
+			scale = (levels - 1.0) / static_cast< double >(max);
+		const double shift = -static_cast< double >(min) * scale;
+
+		for(unsigned int i = 0; i < TableSize; ++i)
+		{
+			const double value = std::min(std::max(i * scale + shift, 0.0), levels - 1.0);
+			m_Table[i] = static_cast< ExternalType >(value);
+		}
+	}
+
+	inline ExternalType Get(const InternalType &input) const
+	{
+		return m_Table[input];
+	}
+
+	/**
+	 * Compute the intensity range of an image in a single parallel pass.
+	 */
+	static void Range(const InputImageType *image, InternalType &min, InternalType &max)
+	{
+		const InternalType *buffer = image->GetBufferPointer();
+		const long size = image->GetBufferedRegion().GetNumberOfPixels();
+
+		InternalType lo = TableSize - 1, hi = 0;
+
+#pragma omp parallel for reduction(min:lo) reduction(max:hi)
+		for(long i = 0; i < size; ++i)
+		{
+			lo = std::min(lo, buffer[i]);
+			hi = std::max(hi, buffer[i]);
+		}
+
+		min = lo;
+		max = hi;
+	}
+
+private:
+	static const unsigned int TableSize = 256;
+
+	static_assert(sizeof(InternalType) == 1, "Posterization tables are built for 8-bit images");
+
+	ExternalType m_Table[TableSize];
+};
+
+typedef itk::ImageAdaptor< InputImageType, PosterizationAccessor > PosterizedImageAdaptor;
+
+#endif /* POSTERIZATION_H */
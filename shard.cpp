@@ -0,0 +1,127 @@
+#include "shard.h"
+
+#include "itkMetaDataObject.h"
+
+#include <sstream>
+
+namespace
+{
+
+const char * const index_key = "ShardIndex";
+const char * const count_key = "ShardCount";
+const char * const first_plane_key = "ShardFirstPlane";
+const char * const image_size_key = "ShardImageSize";
+const char * const run_key = "ShardRun";
+
+/**
+ * Read the string entry of a dictionary holding some values.
+ */
+template< typename T >
+void expose(const itk::MetaDataDictionary &dictionary, const std::string key, T *values, const unsigned int number_of_values)
+{
+	std::string value;
+	if(!itk::ExposeMetaData< std::string >(dictionary, key, value))
+		throw ShardException("The image is not the output of a shard (no " + key + " in its metadata)");
+
+	std::istringstream stream(value);
+	for(unsigned int i = 0; i < number_of_values; ++i)
+		if(!(stream >> values[i]))
+			throw ShardException("Invalid " + key + " in the metadata of the shard: " + value);
+}
+
+}
+
+Shard::Shard(const unsigned int index, const unsigned int count, const InputImageType::SizeType &image_size) :
+	index(index),
+	count(count),
+	image_size(image_size)
+{
+	if(index >= count)
+		throw ShardException("The index of a shard must be below the number of shards");
+
+	if(count > image_size[2])
+		throw ShardException("The image has fewer planes than shards");
+
+	// The planes [i * nz / N, (i + 1) * nz / N)
+	const unsigned long long nz = image_size[2];
+	this->first_plane = index * nz / count;
+	this->number_of_planes = (index + 1) * nz / count - this->first_plane;
+}
+
+Shard Shard::read(const OutputImageType *image)
+{
+	const itk::MetaDataDictionary &dictionary = image->GetMetaDataDictionary();
+
+	unsigned int index, count, first_plane;
+	unsigned long image_size[InputImageType::ImageDimension];
+	expose(dictionary, index_key, &index, 1);
+	expose(dictionary, count_key, &count, 1);
+	expose(dictionary, first_plane_key, &first_plane, 1);
+	expose(dictionary, image_size_key, image_size, InputImageType::ImageDimension);
+
+	InputImageType::SizeType size;
+	for(unsigned int i = 0; i < InputImageType::ImageDimension; ++i)
+		size[i] = image_size[i];
+
+	Shard shard(index, count, size);
+
+	if(!itk::ExposeMetaData< std::string >(dictionary, run_key, shard.run) || shard.run.empty())
+		throw ShardException(std::string("The image is not the output of a shard (no ") + run_key + " in its metadata)");
+
+	const OutputImageType::SizeType shard_size = image->GetBufferedRegion().GetSize();
+	if((shard.first_plane != first_plane) || (shard_size[0] != size[0]) || (shard_size[1] != size[1]) || (shard_size[2] != shard.number_of_planes))
+		throw ShardException("The size of the shard does not match its placement");
+
+	return shard;
+}
+
+void Shard::record(OutputImageType *image) const
+{
+	std::ostringstream index, count, first_plane, image_size;
+	index << this->index;
+	count << this->count;
+	first_plane << this->first_plane;
+	image_size << this->image_size[0] << " " << this->image_size[1] << " " << this->image_size[2];
+
+	itk::MetaDataDictionary &dictionary = image->GetMetaDataDictionary();
+	itk::EncapsulateMetaData< std::string >(dictionary, index_key, index.str());
+	itk::EncapsulateMetaData< std::string >(dictionary, count_key, count.str());
+	itk::EncapsulateMetaData< std::string >(dictionary, first_plane_key, first_plane.str());
+	itk::EncapsulateMetaData< std::string >(dictionary, image_size_key, image_size.str());
+	itk::EncapsulateMetaData< std::string >(dictionary, run_key, this->run);
+}
+
+void Shard::set_run(const std::string run)
+{
+	this->run = run;
+}
+
+unsigned int Shard::get_index() const
+{
+	return this->index;
+}
+
+unsigned int Shard::get_count() const
+{
+	return this->count;
+}
+
+unsigned int Shard::get_first_plane() const
+{
+	return this->first_plane;
+}
+
+unsigned int Shard::get_number_of_planes() const
+{
+	return this->number_of_planes;
+}
+
+const InputImageType::SizeType& Shard::get_image_size() const
+{
+	return this->image_size;
+}
+
+const std::string& Shard::get_run() const
+{
+	return this->run;
+}
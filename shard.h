@@ -0,0 +1,69 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stdexcept>
+#include <string>
+
+#include "datatypes.h"
+
+class ShardException : public std::runtime_error
+{
+public:
+	ShardException ( const std::string &err ) : std::runtime_error (err) {}
+};
+
+/**
+ * A shard of a run spread over several processes: the i-th of N slabs of
+ * planes (along z) of the image, as even as possible.
+ *
+ * The output of a shard holds the features of its planes, with their
+ * geometry in the image, and records its placement in its metadata, for
+ * features_merge to assemble the shards:
+ *
+ *     ShardIndex        i (from 0)
+ *     ShardCount        N
+ *     ShardFirstPlane   the plane of the image where the shard begins
+ *     ShardImageSize    the size of the image (x y z)
+ *     ShardRun          the signature of the run (its input and its computers
+ *                       with their options), the same in all its shards
+ */
+class Shard
+{
+public:
+	/**
+	 * @throw ShardException If the index is not below the count, or if the
+	 *        image has fewer planes than shards.
+	 */
+	Shard(const unsigned int index, const unsigned int count, const InputImageType::SizeType &image_size);
+
+	/**
+	 * The placement and the run recorded in the metadata of the output of a shard.
+	 * @throw ShardException If the image is not the output of a shard.
+	 */
+	static Shard read(const OutputImageType *image);
+
+	/**
+	 * Set the signature of the run the shard belongs to.
+	 */
+	void set_run(const std::string run);
+
+	/**
+	 * Record the placement and the run of the shard in the metadata of its output.
+	 */
+	void record(OutputImageType *image) const;
+
+	unsigned int get_index() const;
+	unsigned int get_count() const;
+	unsigned int get_first_plane() const;
+	unsigned int get_number_of_planes() const;
+	const InputImageType::SizeType& get_image_size() const;
+	const std::string& get_run() const;
+
+private:
+	unsigned int index, count;
+	unsigned int first_plane, number_of_planes;
+	InputImageType::SizeType image_size;
+	std::string run;
+};
+
+#endif /* SHARD_H */
@@ -0,0 +1,140 @@
+#ifdef USE_LOG4CXX
+#  include "log4cxx/logger.h"
+#  include "log4cxx/consoleappender.h"
+#  include "log4cxx/patternlayout.h"
+#  include "log4cxx/basicconfigurator.h"
+#endif
+
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "datatypes.h"
+
+#include "shard.h"
+#include "features_pipeline.h"
+
+/**
+ * Check that the shards of a run assemble into the features of the whole
+ * image, bit for bit: the computers that can run in a shard run on a random
+ * volume, on the whole of it and by shards, the planes of each shard being
+ * compared with the same planes of the whole output.
+ *
+ * Run by ctest from the build directory, where the plugins are.
+ */
+
+namespace
+{
+
+/**
+ * A volume whose gray levels vary along every axis, with some noise.
+ */
+InputImageType::Pointer random_volume(const InputImageType::SizeType &size, const unsigned int seed)
+{
+	InputImageType::Pointer image = InputImageType::New();
+	image->SetRegions(size);
+	image->Allocate();
+
+	std::mt19937 generator(seed);
+	std::uniform_int_distribution< int > noise(0, 31);
+
+	InputImageType::PixelType *voxel = image->GetBufferPointer();
+	for(unsigned long z = 0; z < size[2]; ++z)
+		for(unsigned long y = 0; y < size[1]; ++y)
+			for(unsigned long x = 0; x < size[0]; ++x, ++voxel)
+				*voxel = static_cast< InputImageType::PixelType >((x * 7 + y * 13 + z * 29 + noise(generator)) % 256);
+
+	return image;
+}
+
+std::vector< std::string > split(const std::string options)
+{
+	std::vector< std::string > tokens;
+	std::istringstream stream(options);
+	std::string token;
+	while(stream >> token)
+		tokens.push_back(token);
+	return tokens;
+}
+
+}
+
+int main()
+{
+#ifdef USE_LOG4CXX
+	log4cxx::BasicConfigurator::configure(
+			log4cxx::AppenderPtr(new log4cxx::ConsoleAppender(
+					log4cxx::LayoutPtr(new log4cxx::PatternLayout("\%-5p - [%c] - \%m\%n")),
+					log4cxx::ConsoleAppender::getSystemErr()
+					)
+				)
+			);
+#endif
+
+	// The computers (FilterBank and the itk engine of Haralick depend on the whole image)
+	const char * const computers[][2] = {
+		{"Coordinates", "--normalize"},
+		{"Haralick", "-p 8 -w 2,2,1 --offset 1,0,0 --offset 0,0,1"},
+		{"LBP", "-d 3 -m ri -w 1,1,1"},
+		{"LocalHistogram", "-w 2,2,2 -p 50"},
+		{"LocalStats", "-r 2"},
+		{"MeanValue", "-r 1"},
+		{"RunLength", "-p 8 -w 2,2,1"},
+		{"SizeZone", "-p 8 -w 1,1,1"}
+	};
+	const unsigned int shard_counts[] = {1, 2, 3, 5};
+
+	InputImageType::SizeType size;
+	size[0] = 23;
+	size[1] = 19;
+	size[2] = 13;
+	const unsigned long plane_size = size[0] * size[1];
+
+	InputImageType::Pointer input_image = random_volume(size, 42);
+
+	FeaturesPipeline pipeline;
+	OutputImageType::Pointer whole;
+	try {
+		for(unsigned int i = 0; i < sizeof(computers) / sizeof(computers[0]); ++i)
+			pipeline.add_computer(computers[i][0], split(computers[i][1]));
+
+		whole = pipeline.compute(input_image);
+	} catch(std::exception &ex) {
+		std::cerr << ex.what() << std::endl;
+		return -1;
+	}
+
+	const unsigned int number_of_channels = whole->GetNumberOfComponentsPerPixel();
+	bool identical = true;
+
+	for(unsigned int c = 0; c < sizeof(shard_counts) / sizeof(shard_counts[0]); ++c)
+	{
+		for(unsigned int index = 0; index < shard_counts[c]; ++index)
+		{
+			try {
+				const Shard shard(index, shard_counts[c], size);
+				OutputImageType::Pointer planes = pipeline.compute_planes(input_image, shard.get_first_plane(), shard.get_number_of_planes());
+
+				const float *expected = whole->GetBufferPointer() + shard.get_first_plane() * plane_size * number_of_channels;
+				if((planes->GetNumberOfComponentsPerPixel() != number_of_channels)
+					|| (std::memcmp(planes->GetBufferPointer(), expected, shard.get_number_of_planes() * plane_size * number_of_channels * sizeof(float)) != 0))
+				{
+					std::cerr << "Shard " << index << "/" << shard_counts[c] << ": the features differ from the ones of the whole image" << std::endl;
+					identical = false;
+				}
+			} catch(std::exception &ex) {
+				std::cerr << "Shard " << index << "/" << shard_counts[c] << ": " << ex.what() << std::endl;
+				identical = false;
+			}
+		}
+	}
+
+	if(!identical)
+		return -1;
+
+	std::cout << "The shards are identical to the whole image" << std::endl;
+	return 0;
+}
@@ -0,0 +1,129 @@
+#ifndef TEXTURE_MATRIX_H
+#define TEXTURE_MATRIX_H
+
+#include "datatypes.h"
+
+#include <algorithm>
+#include <vector>
+
+// The 13 unique directions of the 26-neighborhood, and the 4 ones of the
+// 8-neighborhood (the opposite directions lead to the same pairs and runs).
+// Their x component is 0 or 1.
+const long directions_3d13[13][3] = {
+	{ 1,  0,  0}, { 0,  1,  0}, { 0,  0,  1},
+	{ 1,  1,  0}, { 1, -1,  0}, { 1,  0,  1}, { 1,  0, -1}, { 0,  1,  1}, { 0,  1, -1},
+	{ 1,  1,  1}, { 1,  1, -1}, { 1, -1,  1}, { 1, -1, -1}
+};
+const long directions_2d4[4][3] = {
+	{ 1,  0,  0}, { 0,  1,  0}, { 1,  1,  0}, { 1, -1,  0}
+};
+
+/**
+ * Features of a matrix counting the groups of voxels of each gray level and
+ * size: the runs of a gray level run length matrix (GLRLM), or the zones of
+ * a gray level size zone matrix (GLSZM). The cells of the matrix are added
+ * one by one, the features being computed without storing it.
+ *
+ * The features are, in this order, as defined by pyradiomics (the gray
+ * levels counting from 1): small and large size emphasis, gray level and
+ * size non-uniformity, percentage (groups per voxel), low and high gray
+ * level emphasis, and the four small/large size low/high gray level
+ * emphasis.
+ */
+class SizeMatrixFeatures
+{
+public:
+	typedef OutputImageType::InternalPixelType FeatureType;
+
+	static const unsigned int number_of_features = 11;
+
+	/**
+	 * @param[in] levels The number of gray levels.
+	 * @param[in] max_size The largest size of a group.
+	 */
+	SizeMatrixFeatures(const unsigned int levels, const unsigned int max_size) :
+		level_counts(levels, 0), size_counts(max_size + 1, 0)
+	{
+		this->clear();
+	}
+
+	void clear()
+	{
+		std::fill(this->level_counts.begin(), this->level_counts.end(), 0);
+
+		// Only the sizes met since the last clear
+		std::vector< unsigned int >::const_iterator it;
+		for(it = this->sizes.begin(); it != this->sizes.end(); ++it)
+			this->size_counts[*it] = 0;
+		this->sizes.clear();
+
+		this->groups = this->voxels = 0;
+		this->small = this->large = this->low = this->high = 0;
+		this->small_low = this->small_high = this->large_low = this->large_high = 0;
+	}
+
+	/**
+	 * Add count groups of a gray level (from 0) and a size (from 1).
+	 */
+	inline void add(const unsigned int level, const unsigned int size, const double count)
+	{
+		if(this->size_counts[size] == 0)
+			this->sizes.push_back(size);
+
+		this->level_counts[level] += count;
+		this->size_counts[size] += count;
+
+		const double i2 = static_cast< double >(level + 1) * (level + 1);
+		const double j2 = static_cast< double >(size) * size;
+
+		this->groups += count;
+		this->voxels += count * size;
+		this->small += count / j2;
+		this->large += count * j2;
+		this->low += count / i2;
+		this->high += count * i2;
+		this->small_low += count / (i2 * j2);
+		this->small_high += count * i2 / j2;
+		this->large_low += count * j2 / i2;
+		this->large_high += count * i2 * j2;
+	}
+
+	void features(FeatureType *output) const
+	{
+		if(this->groups == 0)
+		{
+			std::fill(output, output + number_of_features, 0);
+			return;
+		}
+
+		double level_non_uniformity = 0, size_non_uniformity = 0;
+		for(unsigned int i = 0; i < this->level_counts.size(); ++i)
+			level_non_uniformity += this->level_counts[i] * this->level_counts[i];
+
+		std::vector< unsigned int >::const_iterator it;
+		for(it = this->sizes.begin(); it != this->sizes.end(); ++it)
+			size_non_uniformity += this->size_counts[*it] * this->size_counts[*it];
+
+		const double N = this->groups;
+
+		output[0] = this->small / N;
+		output[1] = this->large / N;
+		output[2] = level_non_uniformity / N;
+		output[3] = size_non_uniformity / N;
+		output[4] = N / this->voxels;
+		output[5] = this->low / N;
+		output[6] = this->high / N;
+		output[7] = this->small_low / N;
+		output[8] = this->small_high / N;
+		output[9] = this->large_low / N;
+		output[10] = this->large_high / N;
+	}
+
+private:
+	std::vector< double > level_counts, size_counts;
+	std::vector< unsigned int > sizes;
+	double groups, voxels;
+	double small, large, low, high, small_low, small_high, large_low, large_high;
+};
+
+#endif /* TEXTURE_MATRIX_H */
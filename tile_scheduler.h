@@ -0,0 +1,226 @@
+#ifndef TILE_SCHEDULER_H
+#define TILE_SCHEDULER_H
+
+#include "datatypes.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+#include <boost/cstdint.hpp>
+
+#ifdef _OPENMP
+#  include <omp.h>
+#endif
+
+/**
+ * A box of voxels: [begin, end) along each direction.
+ */
+struct Tile
+{
+	long begin[3];
+	long end[3];
+};
+
+/**
+ * Parallel loop over the tiles of a region, balanced by work stealing.
+ *
+ * The region is cut into small tiles, and each thread of the OpenMP team
+ * gets a contiguous range of them. A thread takes the tiles from the front of
+ * its own range, and once it is empty, steals the back half of the largest
+ * remaining range. On uneven images (flat areas, clipped borders, masks),
+ * the threads finishing early therefore keep working instead of waiting for
+ * the last ones.
+ *
+ * Inside a parallel region, run() is called by every thread, like an omp for
+ * construct (each thread may prepare its own buffers before):
+ *
+ *     TileScheduler tiles(size, TileScheduler::row_tiles(size));
+ *     #pragma omp parallel
+ *     {
+ *         std::vector< double > buffer(size[0]);
+ *         tiles.run([&](const Tile &tile) { ... });
+ *     }
+ */
+class TileScheduler
+{
+public:
+	// Default number of voxels of a tile, small enough for the data a tile
+	// touches to stay in the cache
+	static const unsigned long default_tile_voxels = 16384;
+
+	TileScheduler(const InputImageType::SizeType &size, const InputImageType::SizeType &tile_size) :
+		size(size), tile_size(tile_size), number_of_ranges(0)
+	{
+		this->number_of_tiles = 1;
+		for(unsigned int i = 0; i < 3; ++i)
+		{
+			this->tile_size[i] = std::max< itk::SizeValueType >(std::min(this->tile_size[i], size[i]), 1);
+			this->tiles[i] = (size[i] + this->tile_size[i] - 1) / this->tile_size[i];
+			this->number_of_tiles *= this->tiles[i];
+		}
+	}
+
+	unsigned long get_number_of_tiles() const
+	{
+		return this->number_of_tiles;
+	}
+
+	Tile get_tile(const unsigned long index) const
+	{
+		const unsigned long position[3] = {
+			index % this->tiles[0],
+			(index / this->tiles[0]) % this->tiles[1],
+			index / (this->tiles[0] * this->tiles[1])};
+
+		Tile tile;
+		for(unsigned int i = 0; i < 3; ++i)
+		{
+			tile.begin[i] = position[i] * this->tile_size[i];
+			tile.end[i] = std::min< long >(tile.begin[i] + this->tile_size[i], this->size[i]);
+		}
+
+		return tile;
+	}
+
+	/**
+	 * Process all the tiles, calling function(const Tile &) for each of them.
+	 * Must be called by all the threads of the current parallel region (or
+	 * outside of any), and ends with a barrier.
+	 */
+	template< class TFunction >
+	void run(TFunction function)
+	{
+#ifdef _OPENMP
+		const unsigned int thread = omp_get_thread_num();
+		const unsigned int number_of_threads = omp_get_num_threads();
+#else
+		const unsigned int thread = 0;
+		const unsigned int number_of_threads = 1;
+#endif
+
+#pragma omp single
+		{
+			this->ranges.reset(new Range[number_of_threads]);
+			this->number_of_ranges = number_of_threads;
+			for(unsigned int t = 0; t < number_of_threads; ++t)
+				this->ranges[t].tiles = pack(this->number_of_tiles * t / number_of_threads, this->number_of_tiles * (t + 1) / number_of_threads);
+		}
+
+		unsigned long index;
+		while(this->next(thread, index))
+			function(this->get_tile(index));
+
+#pragma omp barrier
+	}
+
+	/**
+	 * Process the tiles of a region in a parallel region of its own.
+	 */
+	template< class TFunction >
+	static void parallel_for(const InputImageType::SizeType &size, const InputImageType::SizeType &tile_size, TFunction function)
+	{
+		TileScheduler scheduler(size, tile_size);
+
+#pragma omp parallel
+		scheduler.run(function);
+	}
+
+	/**
+	 * Size of tiles made of whole rows (along x), stacked along y then z.
+	 *
+	 * The scheduler takes any box as a tile, but the computers use these
+	 * tiles: their windows slide along x, each voxel updating the window of
+	 * the previous one (a column in, a column out), which a tile cut along x
+	 * would have to rebuild at its first voxel, i.e. a whole window per tile.
+	 * The rows of a tile stay contiguous in memory, and the rows of the
+	 * windows around them are shared by the neighboring rows of the tile.
+	 */
+	static InputImageType::SizeType row_tiles(const InputImageType::SizeType &size, const unsigned long voxels = default_tile_voxels)
+	{
+		const unsigned long rows = std::max< unsigned long >(voxels / std::max< unsigned long >(size[0], 1), 1);
+
+		InputImageType::SizeType tile_size;
+		tile_size[0] = size[0];
+		tile_size[1] = std::min< unsigned long >(rows, size[1]);
+		tile_size[2] = std::max< unsigned long >(rows / std::max< unsigned long >(size[1], 1), 1);
+
+		return tile_size;
+	}
+
+private:
+	// Range of tiles of a thread, padded to its own cache line
+	struct Range
+	{
+		std::atomic< boost::uint64_t > tiles;
+		char padding[64 - sizeof(std::atomic< boost::uint64_t >)];
+	};
+
+	static inline boost::uint64_t pack(const boost::uint64_t begin, const boost::uint64_t end)
+	{
+		return (begin << 32) | end;
+	}
+
+	static inline unsigned long begin(const boost::uint64_t range) { return range >> 32; }
+	static inline unsigned long end(const boost::uint64_t range) { return range & 0xffffffff; }
+
+	/**
+	 * Take the next tile of a thread, stealing it when its range is empty.
+	 * @return false when no tile is left.
+	 */
+	bool next(const unsigned int thread, unsigned long &index)
+	{
+		std::atomic< boost::uint64_t > &own = this->ranges[thread].tiles;
+
+		boost::uint64_t range = own.load();
+		while(begin(range) < end(range))
+		{
+			if(own.compare_exchange_weak(range, pack(begin(range) + 1, end(range))))
+			{
+				index = begin(range);
+				return true;
+			}
+		}
+
+		for(;;)
+		{
+			unsigned int victim = thread;
+			unsigned long largest = 0;
+			for(unsigned int t = 0; t < this->number_of_ranges; ++t)
+			{
+				const boost::uint64_t other = this->ranges[t].tiles.load();
+				if((t != thread) && (end(other) > begin(other)) && (end(other) - begin(other) > largest))
+				{
+					victim = t;
+					largest = end(other) - begin(other);
+				}
+			}
+
+			if(largest == 0)
+				return false;
+
+			boost::uint64_t stolen = this->ranges[victim].tiles.load();
+			if(end(stolen) <= begin(stolen))
+				continue;
+
+			// The back half, the first stolen tile being processed at once
+			const unsigned long first = end(stolen) - (end(stolen) - begin(stolen) + 1) / 2;
+			if(this->ranges[victim].tiles.compare_exchange_strong(stolen, pack(begin(stolen), first)))
+			{
+				index = first;
+				own.store(pack(first + 1, end(stolen)));
+				return true;
+			}
+		}
+	}
+
+	const InputImageType::SizeType size;
+	InputImageType::SizeType tile_size;
+	unsigned long tiles[3];
+	unsigned long number_of_tiles;
+
+	std::unique_ptr< Range[] > ranges;
+	unsigned int number_of_ranges;
+};
+
+#endif /* TILE_SCHEDULER_H */
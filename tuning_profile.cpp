@@ -0,0 +1,134 @@
+#include "tuning_profile.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+
+#ifdef USE_LOG4CXX
+	#include "log4cxx/logger.h"
+#endif
+
+namespace
+{
+
+std::vector< std::string > split(const std::string line, const char separator)
+{
+	std::vector< std::string > fields;
+	std::istringstream stream(line);
+	std::string field;
+	while(std::getline(stream, field, separator))
+		fields.push_back(field);
+
+	return fields;
+}
+
+}
+
+TuningProfile::TuningProfile(const std::string filename) :
+	filename(filename)
+{
+	std::ifstream file(filename.c_str());
+
+	std::string line;
+	while(std::getline(file, line))
+	{
+		if(line.empty() || (line[0] == '#'))
+			continue;
+
+		const std::vector< std::string > fields = split(line, '\t');
+		if(fields.size() < 3)
+			continue;
+
+		Tuning tuning;
+		std::istringstream threads(fields[1]), tile_voxels(fields[2]);
+		if(!(threads >> tuning.threads) || !(tile_voxels >> tuning.tile_voxels))
+			continue;
+
+		this->tunings[fields[0]] = tuning;
+	}
+
+#ifdef USE_LOG4CXX
+	if(!this->tunings.empty())
+	{
+		log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+		LOG4CXX_INFO(logger, "Tuning profile: " << filename << " (" << this->tunings.size() << " tunings)");
+	}
+#endif
+}
+
+std::string TuningProfile::default_filename()
+{
+	char hostname[256] = "";
+	if(gethostname(hostname, sizeof(hostname) - 1) != 0)
+		hostname[0] = '\0';
+
+	const char *home = std::getenv("HOME");
+	const boost::filesystem::path directory = boost::filesystem::path(home ? home : ".") / ".features_computer";
+
+	return (directory / (std::string("tuning-") + (hostname[0] ? hostname : "localhost"))).string();
+}
+
+std::string TuningProfile::key(const std::string computer, const std::vector< std::string > options)
+{
+	std::string k = computer;
+
+	std::vector< std::string >::const_iterator it;
+	for(it = options.begin(); it != options.end(); ++it)
+		k += " " + *it;
+
+	return k;
+}
+
+bool TuningProfile::find(const std::string key, Tuning &tuning) const
+{
+	std::map< std::string, Tuning >::const_iterator it = this->tunings.find(key);
+	if(it == this->tunings.end())
+		return false;
+
+	tuning = it->second;
+	return true;
+}
+
+void TuningProfile::set(const std::string key, const Tuning &tuning)
+{
+	this->tunings[key] = tuning;
+}
+
+void TuningProfile::save() const
+{
+	const boost::filesystem::path path(this->filename);
+	const boost::filesystem::path tmp_path = path.string() + ".tmp";
+
+	try {
+		if(path.has_parent_path())
+			boost::filesystem::create_directories(path.parent_path());
+
+		{
+			std::ofstream file(tmp_path.string().c_str(), std::ios::trunc);
+			file << "# Tuning profile of features_computer (written by --autotune)" << std::endl;
+
+			std::map< std::string, Tuning >::const_iterator it;
+			for(it = this->tunings.begin(); it != this->tunings.end(); ++it)
+			{
+				file << it->first << '\t' << it->second.threads << '\t' << it->second.tile_voxels << std::endl;
+			}
+
+			if(!file)
+				throw TuningProfileException("Unable to write the tuning profile " + tmp_path.string());
+		}
+
+		// Runs reading the profile meanwhile find the old one or the new one
+		boost::filesystem::rename(tmp_path, path);
+	} catch(boost::filesystem::filesystem_error &ex) {
+		throw TuningProfileException(std::string("Unable to write the tuning profile (") + ex.what() + ")");
+	}
+}
+
+const std::string& TuningProfile::get_filename() const
+{
+	return this->filename;
+}
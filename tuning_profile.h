@@ -0,0 +1,78 @@
+#ifndef TUNING_PROFILE_H
+#define TUNING_PROFILE_H
+
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+class TuningProfileException : public std::runtime_error
+{
+public:
+	TuningProfileException ( const std::string &err ) : std::runtime_error (err) {}
+};
+
+/**
+ * How a computer runs, without changing the features it computes.
+ */
+struct Tuning
+{
+	Tuning() : threads(0), tile_voxels(0) {}
+
+	unsigned int threads;               // Number of threads (0: the default of OpenMP)
+	unsigned long tile_voxels;          // Number of voxels of a tile (0: TileScheduler::default_tile_voxels)
+};
+
+/**
+ * Tunings of the computers found the fastest on a host by --autotune, kept in
+ * a text file, so that the next runs on the host use them.
+ *
+ * Each line holds the tuning of a computer for some options, as fields
+ * separated by tabs: the key (the name of the computer and its normalized
+ * options), the number of threads and the number of voxels of a tile.
+ * Lines starting with # and malformed lines are ignored, as well as extra
+ * fields (the options of another engine, written by former versions).
+ */
+class TuningProfile
+{
+public:
+	/**
+	 * @param[in] filename The file of the profile, loaded if it exists.
+	 */
+	TuningProfile(const std::string filename);
+
+	/**
+	 * The profile of the host: tuning-<hostname> in ~/.features_computer.
+	 */
+	static std::string default_filename();
+
+	/**
+	 * Build the key identifying the tuning of a computer.
+	 */
+	static std::string key(const std::string computer, const std::vector< std::string > options);
+
+	/**
+	 * Find the tuning of a computer.
+	 * @return false if the profile holds none.
+	 */
+	bool find(const std::string key, Tuning &tuning) const;
+
+	/**
+	 * Set the tuning of a computer, replacing the previous one.
+	 */
+	void set(const std::string key, const Tuning &tuning);
+
+	/**
+	 * Write the profile, replacing its file at once.
+	 * @throw TuningProfileException If it cannot be written.
+	 */
+	void save() const;
+
+	const std::string& get_filename() const;
+
+private:
+	std::string filename;
+	std::map< std::string, Tuning > tunings;
+};
+
+#endif /* TUNING_PROFILE_H */